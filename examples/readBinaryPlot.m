@@ -4,9 +4,15 @@
 %
 %    Easily modifiable for any geometry or cross-section (just remove
 %              extra fread statements in lower dimensionality)
+%
+%    The index file 'fileName.dat.idx' written along with the dump holds
+%    the time and the byte offset of each frame, as a double and an int64:
+%    set tPlot to the times to plot (the last frame at or before each one
+%    is shown), or leave it empty to plot all the frames
 %-------------------------------------------------------------------------
 
 f  = fopen('fileName.dat', 'rb'); % Read the dump file
+tPlot = [];                       % Times to plot ([] = all frames)
 
 G  = fread(f, 1, 'int');        % Read geometry (lowest 2 bits = # of dimensions)
 
@@ -24,13 +30,32 @@ zNode  = 2;                     % Choose your z-slice
 zCoord = X3(zNode);             % z-coordinate of the z-slize
 
 N = N1 * N2 * N3;               % Number of nodes
-state = 0;
+g = fopen('fileName.dat.idx', 'rb');  % Read the frame index
+if g > 0
+    I = fread(g, [16 Inf], '*uint8');  % (time, offset) pairs of 16 bytes
+    fclose(g);
+    T = typecast(reshape(I(1:8,:),  [], 1), 'double');
+    P = double(typecast(reshape(I(9:16,:), [], 1), 'int64'));
+else                                % no index: frames follow the header
+    P0 = ftell(f);
+    fseek(f, 0, 'eof');
+    P  = P0 + (0 : floor((ftell(f) - P0) / (8 * (N + 1))) - 1)' * 8 * (N + 1);
+    T  = zeros(size(P));
+    for k = 1 : length(P)
+        fseek(f, P(k), 'bof');
+        T(k) = fread(f, 1, 'double');
+    end
+end
+
+if isempty(tPlot)
+    frames = 1 : length(P);
+else
+    frames = arrayfun(@(t) max([1; find(T <= t)]), tPlot);
+end
 
-while ~state
+for k = frames
+    fseek(f, P(k), 'bof');      % Go to the frame
     t = fread(f, 1, 'double');  % Read Time
-    if feof(f) 
-        return;  
-    end;
     A = fread(f, N, 'double');  % Read the data
     B = reshape(A, N1, N2, N3); % Reshape into 3D array
     Z = squeeze(B(:,:,zNode))'; % Take the z-slice, NOTE THE TRANSPOSITION!
@@ -42,7 +67,6 @@ while ~state
     colorbar;
     drawnow;
     pause(0.2);
-    state = feof(f);
 end
 
 fclose(f);                   % close the file
\ No newline at end of file
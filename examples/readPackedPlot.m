@@ -0,0 +1,171 @@
+%
+%   Read and plot a packed field dump produced by "plot binary Field fileName"
+%   with "plot.binary.pack = double | float | error" (see source/packed.h)
+%
+%    Each frame is stored as bricks of nodes, compressed losslessly; the
+%    frames are decoded here as by "calc --unpack", which converts the file
+%    to the raw format read by readBinaryPlot.m. Set tPlot to the times to
+%    plot (the last frame at or before each one is shown), or leave it empty
+%    to plot all the frames (MATLAB R2016b or later, for the local functions)
+%-------------------------------------------------------------------------
+
+fileName = 'fileName.dat';
+tPlot = [];                       % Times to plot ([] = all frames)
+zNode = 2;                        % Choose your z-slice
+
+f = fopen(fileName, 'rb');
+if ~strcmp(fread(f, [1 8], '*char'), ['CalCfld' 0])
+    error('%s is not a packed field plot file', fileName);
+end
+info = fread(f, 7, 'int32');      % version, geometry, sizes, brick, value size
+E    = fread(f, 1, 'double');     % the error of the quantized values
+G    = info(2);                   % geometry (lowest 2 bits = # of dimensions)
+N    = info(3:5)';                % number of x, y and z-nodes (1 if absent)
+B    = info(6);                   % brick size
+V    = info(7);                   % 8 (double), 4 (float) or 0 (quantized)
+
+X = cell(1, 3);
+for d = 1 : 3
+    if d <= bitand(G, 3), X{d} = fread(f, N(d), 'double'); else X{d} = 0; end
+end
+
+g = fopen([fileName '.idx'], 'rb');   % Read the frame index
+if g > 0
+    I = fread(g, [16 Inf], '*uint8');
+    fclose(g);
+    T = typecast(reshape(I(1:8,:),  [], 1), 'double');
+    P = double(typecast(reshape(I(9:16,:), [], 1), 'int64'));
+else                                  % no index: scan the frames
+    [T, P] = packedFrames(f, N, B);
+end
+
+if isempty(tPlot)
+    frames = 1 : length(P);
+else
+    frames = arrayfun(@(t) max([1; find(T <= t)]), tPlot);
+end
+
+[XX, YY] = meshgrid(X{1}, X{2});
+zNode = min(zNode, N(3));
+
+for k = frames
+    [A, t] = packedFrame(f, P(k), N, B, V, E);
+    Z = squeeze(A(:,:,zNode))';       % Take the z-slice, NOTE THE TRANSPOSITION!
+    contourf(XX, YY, Z);
+
+    title([ 'Z = ', num2str(X{3}(zNode)), ' \mum; time = ', num2str(t), ' ms' ]);
+
+    xlabel('X (\mum)'); ylabel('Y (\mum)');
+    colorbar;
+    drawnow;
+    pause(0.2);
+end
+
+fclose(f);
+
+%-------------------------------------------------------------------------
+
+function [T, P] = packedFrames(f, N, B)   % the times and offsets of the frames
+    nb = prod(ceil(N / B));
+    here = ftell(f);
+    fseek(f, 0, 'eof');  last = ftell(f);
+    T = [];  P = [];
+    while here + 8 <= last
+        fseek(f, here, 'bof');
+        t = fread(f, 1, 'double');
+        next = here + 8;
+        for b = 1 : nb
+            if next + 5 > last, next = Inf; break; end
+            fseek(f, next, 'bof');
+            next = next + 5 + fread(f, 1, 'uint32');
+        end
+        if next > last, break; end   % an incomplete frame
+        T(end+1, 1) = t;  P(end+1, 1) = here;
+        here = next;
+    end
+end
+
+%-------------------------------------------------------------------------
+
+function [A, t] = packedFrame(f, offset, N, B, V, E)
+    W  = 8;  if V == 4, W = 4; end
+    nb = ceil(N / B);
+    A  = zeros(N);
+    fseek(f, offset, 'bof');
+    t  = fread(f, 1, 'double');
+    for bz = 0 : nb(3) - 1
+      for by = 0 : nb(2) - 1
+        for bx = 0 : nb(1) - 1       % x fastest
+            s  = [bx by bz] * B;
+            ex = min(B, N - s);
+            n  = prod(ex);
+            k  = fread(f, 1, 'uint32');
+            method = fread(f, 1, 'uint8');
+            S  = fread(f, k, '*uint8');
+            if method == 1, S = lzDecode(S, n * W); end
+            v  = brickValues(reshape(S, n, W), W, V, E);
+            A(s(1)+1 : s(1)+ex(1), s(2)+1 : s(2)+ex(2), s(3)+1 : s(3)+ex(3)) = reshape(v, ex);
+        end
+      end
+    end
+end
+
+%-------------------------------------------------------------------------
+%   The bytes of word i are S(i,:), least significant first; a word is the
+%   zigzag coded difference with the previous one, summed modulo 2^(8W)
+
+function v = brickValues(S, W, V, E)
+    if W == 4
+        z = typecast(reshape(S', [], 1), 'uint32');
+        d = double(bitxor(bitshift(z, -1), uint32(bitand(z, 1)) * intmax('uint32')));
+        v = double(typecast(uint32(mod(cumsum(d), 2^32)), 'single'));
+        return
+    end
+    z  = typecast(reshape(S', [], 1), 'uint64');
+    d  = bitxor(bitshift(z, -1), uint64(bitand(z, 1)) * intmax('uint64'));
+    lo = cumsum(double(bitand(d, uint64(4294967295))));
+    hi = mod(cumsum(double(bitshift(d, -32))) + floor(lo / 2^32), 2^32);
+    w  = bitor(bitshift(uint64(hi), 32), uint64(mod(lo, 2^32)));
+    if V == 8
+        v = typecast(w, 'double');
+    else
+        v = double(typecast(w, 'int64')) * 2 * E;
+    end
+end
+
+%-------------------------------------------------------------------------
+%   LZ77 sequences: a token (literals in the upper 4 bits, match length - 4
+%   in the lower 4; 15 is extended by the following bytes, up to one below
+%   255), the literals, and the 16-bit offset of the match
+
+function out = lzDecode(in, m)
+    out = zeros(m, 1, 'uint8');
+    n = numel(in);  ip = 1;  op = 0;
+    while ip <= n
+        token = double(in(ip));  ip = ip + 1;
+        lit = floor(token / 16);
+        if lit == 15, [lit, ip] = lzLength(in, ip, lit); end
+        out(op+1 : op+lit) = in(ip : ip+lit-1);
+        ip = ip + lit;  op = op + lit;
+        if ip > n, break; end
+        off = double(in(ip)) + 256 * double(in(ip+1));  ip = ip + 2;
+        len = mod(token, 16);
+        if len == 15, [len, ip] = lzLength(in, ip, len); end
+        len = len + 4;
+        if off >= len
+            out(op+1 : op+len) = out(op-off+1 : op-off+len);
+        else
+            for j = 1 : len, out(op+j) = out(op+j-off); end   % an overlapping copy
+        end
+        op = op + len;
+    end
+    if op ~= m, error('Corrupt packed data: %d bytes of %d', op, m); end
+end
+
+function [len, ip] = lzLength(in, ip, len)
+    b = 255;
+    while b == 255
+        b = double(in(ip));  ip = ip + 1;
+        len = len + b;
+    end
+end
@@ -53,25 +53,35 @@
 #include "fplot.h"
 #include "gate.h"
 #include "loop.h"
+#include "ensemble.h"
+#include "sweep.h"
+#include "output.h"
+#include "packed.h"
+#include "stream.h"
+#include "snapshot.h"
 #include "time.h"
 
-double  CHARGE_LOSS;
-int     Number_Of_Iterations_Per_PDE_Step = 4;
-
-int     DIMENSIONALITY = 3;
-int     VERBOSE        = 3;
-int     GEOMETRY       = CARTESIAN3D;
-int     GEOMETRY1      = 0;
-int     GEOMETRY2      = 0;
-int     GEOMETRY3      = 0;
-char    LABEL_DIM1[2];
-char    LABEL_DIM2[6];
-char    LABEL_DIM3[4];
-
-PlotArray* GluPlotArray = NULL;
-char*      globalLabelX = NULL;
+// The state of a simulation is thread-local, so that independent simulations
+// may run concurrently on different threads of the same process
+
+thread_local double  CHARGE_LOSS;
+thread_local int     Number_Of_Iterations_Per_PDE_Step = 4;
+
+thread_local int     DIMENSIONALITY = 3;
+thread_local int     VERBOSE        = 3;
+thread_local int     GEOMETRY       = CARTESIAN3D;
+thread_local int     GEOMETRY1      = 0;
+thread_local int     GEOMETRY2      = 0;
+thread_local int     GEOMETRY3      = 0;
+thread_local char    LABEL_DIM1[2];
+thread_local char    LABEL_DIM2[6];
+thread_local char    LABEL_DIM3[4];
+
+thread_local PlotArray* GluPlotArray = NULL;
+thread_local char*      globalLabelX = NULL;
+thread_local char       scriptFileName[2048];
+
 char*      versionStr = StrCpy("7.10.8");
-char       scriptFileName[1024];
 
 #define EXTRA_PARAM_STRING  "; pA=5.182134 ; pi=4 atan(1) ; "
 
@@ -120,36 +130,174 @@ void header() {
 
 
  //**************************************************************************************************
- //                                           M A I N
+ //  Ensemble ODE mode: all the steps of the "for" loops are integrated at once, then tracked 
+ //  and printed step by step, as in the main loop below
  //**************************************************************************************************
 
+ void runEnsemble(LoopObj &vary, VectorObj &result, int argc, char **argv) {
 
- int main(int argc, char **argv) {
+	 char    paramString[MAX_LINE_LENGTH];
+	 double* trackPtr;
+
+	 ensembleParameters(vary, paramString);
+	 TokenString* TS = new TokenString(scriptFileName, EXTRA_PARAM_STRING, paramString, argc, argv);
+	 TS->get_int_param("verbose", &VERBOSE);
+	 if (VERBOSE) fprintf(stderr, "***** Running in ODE ensemble mode *****\n");
+	 prepareEnsembleScript(*TS);
 
- char fname[1024];
+	 EnsembleObj* Ensemble = new EnsembleObj(*TS, vary);
+	 Ensemble->Run();
 
- try {
+	 for (int step = 0; step < vary.steps; step++) {
+		 vary.step();
+		 Ensemble->load(step);
+		 for (int i = 0; i < result.size; i++) {
+			 if ((trackPtr = Ensemble->Sim->ResolveID(vary.trackIDs[i]))) result[i] = *trackPtr;
+			 else  TS->errorMessage(TS->token_index(vary.trackIDs[i]), 0, "Cannot track an undefined variable");
+		 }
+		 TS->printResults(Ensemble->Sim);
+		 vary.draw();
+	 }
+#ifndef _NO_GLUT_
+	 if (vary.plots->gl_on) {
+		 GluPlotArray = vary.plots;
+		 glutMainLoop();
+	 }
+#endif
+	 delete Ensemble;
+	 delete TS;
+	 OutputThread::stop();
+ }
+
+
+ //**************************************************************************************************
+ //  One step of the "for" loops (or the only run, if there are none) on the parsed script TS;
+ //  returns STEP_DONE if the step is to be drawn, STEP_CONTINUE or STEP_EXIT otherwise
+ //**************************************************************************************************
+
+ int runStep(TokenString *TS, LoopObj &vary, VectorObj &result) {
+
+	 if (TS->token_count("exit"))     { if (VERBOSE) fprintf(stderr, "\n > Exit command: breaking execution <\n ");     return STEP_EXIT; }
+	 if (TS->token_count("continue")) { if (VERBOSE) fprintf(stderr, "\n > Continue command: breaking execution <\n "); return STEP_CONTINUE; }
+	 TS->get_int_param("verbose", &VERBOSE);
+	 SimulationObj* Simulation;
+	 double* trackPtr;
+
+	 if (!TS->token_count("Run")) {                      //######## CALCULATOR MODE #########
+		 if (VERBOSE) fprintf(stderr, "***** No simulation runs specified; running in calculator mode *****\n");
+		 if (vary())
+			 for (int i = 0; i < result.size; i++)  result[i] = TS->get_double(getTrackVar(*TS, i));
+		 TS->printResults(0);
+	 }
+	 else {                                             //####### NOT CALCULATOR MODE ######
+		 if (!(TS->token_count("Ca.D") || TS->token_count("grid")) || equal(TS->get_string("mode"), "ODE")) {
+			 if (VERBOSE) fprintf(stderr, "***** Running in ODE-only mode *****\n");
+			 Simulation = new ODESimulationObj(*TS);     //#######  ODE solver mode: ########
+		 }
+		 else Simulation = new SimulationObj(*TS);       //########  FULL PDE MODE  #########
+		 TS->get_int_param("Number_Of_Iterations_Per_PDE_Step", &Number_Of_Iterations_Per_PDE_Step);
+		 Simulation->Run();                              //#### RUN THE DIFFERENCE SCHEME ####
+		 if (vary())
+			 for (int i = 0; i < result.size; i++) {
+				 if ((trackPtr = Simulation->ResolveID(vary.trackIDs[i]))) result[i] = *trackPtr;
+				 else  TS->errorMessage(TS->token_index(vary.trackIDs[i]), 0, "Cannot track an undefined variable");
+			 }
+		 TS->printResults(Simulation);
+#ifndef _NO_GLUT_
+		 if (Simulation->Plots->gl_on && Simulation->Plots->plot_num)  glutMainLoop();
+#endif
+		 delete Simulation;
+		 OutputThread::stop();                           // throws an error of the plot output, if any
+	 }
+	 return STEP_DONE;
+ }
+
+ //**************************************************************************************************
+
+ static void finishOutput() {   // the buffered and queued plot output up to the error
+	 PointWriter::flushAll();
+	 try { OutputThread::stop(); }
+	 catch (char *str) { delete [] str; }
+ }
+
+ void reportError(char *str) {
+	 finishOutput();
+	 if ( !equal(str,"") ) {
+		 fprintf(stderr, "\n\n*** Error: %s\n", str);
+		 fflush(stderr); 
+		 delete [] str;
+	 }
+ }
+
+ void reportError(int i) {
+	 finishOutput();
+	 fprintf(stderr, "\n\n*** CalC: breaking execution on exception #%d ***\n", i); 
+	 perror(" System error (if any): ");
+	 fflush(stderr);
+ }
+
+ //**************************************************************************************************
+ //  Parallel sweep ("-j N"): the steps run in up to N worker processes, each parsing the script 
+ //  with its own loop variable bindings and random seed; the steps are collected in order, and 
+ //  their output copied and their results drawn as in the serial loop of main()
+ //**************************************************************************************************
 
-	 if (argc >1) strcpy(scriptFileName, argv[1]);
-	 else {
-		 FILE* f = fopen("DefaultScript.txt", "r");
-		 if (f) {
-			 fclose(f);
-			 strcpy(scriptFileName, "DefaultScript.txt");
-		 } else {
-			 header();
-			 fprintf(stderr, "\n\n Enter the CalC script file name: ");
-			 fflush(stderr);
-			 scanf("%s", fname);
-			 size_t i = strlen(argv[0]);
-			 while (argv[0][i] != '/' && argv[0][i] != '\\' && i > 0) i--;
-			 strncpy(scriptFileName, argv[0], i + 1);
-			 scriptFileName[i + 1] = 0;
-			 fprintf(stderr, "\n Full path = %s \n", scriptFileName);
-			 strcat(scriptFileName, fname);
-			 fprintf(stderr, " File name = %s \n\n", scriptFileName);
+ void runParallel(LoopObj &vary, VectorObj &result, int jobs, long seed, long first, int argc, char **argv) {
+
+	 SweepJobs Jobs(jobs, result.size);
+	 long next = first, step = first;
+
+	 if (VERBOSE > 4) fprintf(stderr, "\n***** Running %ld sweep steps in %d worker processes *****\n", vary.steps, jobs);
+
+	 while (step < vary.steps) {
+		 if (next < vary.steps && Jobs.canStart(next, step)) {
+			 if (Jobs.start(next)) {                      // worker process
+				 int status = STEP_ERROR;
+				 try {
+					 char bindings[MAX_LINE_LENGTH];
+					 vary.bindings(next, bindings);
+					 seedRandom(seed + next);
+					 TokenString* TS = new TokenString(scriptFileName, EXTRA_PARAM_STRING, bindings, argc, argv);
+					 status = runStep(TS, vary, result);
+				 }
+				 catch (char *str) { reportError(str); }
+				 catch (int i)     { reportError(i); }
+				 Jobs.finish(status, result());
+			 }
+			 next++;
 		 }
+		 else if (Jobs.finished(step)) {
+			 vary.step();
+			 int status = Jobs.collect(step++, result());
+			 if (status != STEP_ERROR) vary.record(status);
+			 if (status == STEP_DONE) vary.draw();
+			 if (status == STEP_EXIT || status == STEP_ERROR) break;
+		 }
+		 else Jobs.wait();
 	 }
+ }
+
+
+ //**************************************************************************************************
+ //                                           M A I N
+ //**************************************************************************************************
+
+
+ //**************************************************************************************************
+ //  Runs the script "fname" (argv[2], argv[3], ... being its arguments $1, $2, ...) with all its
+ //  "for" loop steps; returns 1 on error, 0 otherwise. The state of the simulation is thread-local,
+ //  so several scripts may be run concurrently on different threads (the plot method should be mute,
+ //  and the scripts should write to different files). With "resume", the steps recorded in the 
+ //  journal of an interrupted sweep are not run again (see LoopObj::openJournal)
+ //**************************************************************************************************
+
+ int runScript(const char *fname, int jobs, bool resume, int argc, char **argv) {
+
+ int error = 0;
+
+ try {
+
+	 strcpy(scriptFileName, fname);
 
 	 TokenString* TS;
 	 TS = new TokenString(scriptFileName, EXTRA_PARAM_STRING, "", argc, argv);
@@ -163,67 +311,107 @@ void header() {
 	 LoopObj   vary(*TS, &result);
 	 long seed = long(time(NULL));
 	 seed = TS->get_long_param("seed");
-	 srand(seed);
+	 seedRandom(seed);
+	 bool ensemble = isEnsemble(*TS, vary);
 	 delete TS;
 
+	 if (jobs > 1 && !ensemble && vary.steps > 1 && (vary.plots->method != METHOD_MUTE || !SweepJobs::available())) {
+		 if (VERBOSE) fprintf(stderr, "\n### Parallel sweeps require the default (mute) plot method: running the steps serially\n");
+		 jobs = 1;
+	 }
+
 	 // ++++++++++++++++++++++++++++ MAIN LOOP ++++++++++++++++++++++++++++
 
-	 for (int step = 0; step < vary.steps; step++) {
+	 TokenString* Script = 0;   // the script is parsed once; each step only rebinds the loop variables
+	 long first = ensemble ? 0 : vary.openJournal(scriptFileName, resume, argc, argv);
+
+	 if (ensemble) runEnsemble(vary, result, argc, argv);
+	 else if (jobs > 1 && vary.steps - first > 1) runParallel(vary, result, jobs, seed, first, argc, argv);
+	 else
+	 for (long step = first; step < vary.steps; step++) {
 		 vary.step();
-		 TS = new TokenString(scriptFileName, EXTRA_PARAM_STRING, vary.loopVarString, argc, argv);
-		 if (TS->token_count("exit"))     { if (VERBOSE) fprintf(stderr, "\n > Exit command: breaking execution <\n ");     delete TS; break; }
-		 if (TS->token_count("continue")) { if (VERBOSE) fprintf(stderr, "\n > Continue command: breaking execution <\n "); delete TS; continue; }
-		 TS->get_int_param("verbose", &VERBOSE);
-		 SimulationObj* Simulation;
-		 double* trackPtr;
-
-		 if (!TS->token_count("Run")) {                      //######## CALCULATOR MODE #########
-			 if (VERBOSE) fprintf(stderr, "***** No simulation runs specified; running in calculator mode *****\n");
-			 if (vary())
-				 for (int i = 0; i < result.size; i++)  result[i] = TS->get_double(getTrackVar(*TS, i));
-			 TS->printResults(0);
-		 }
-		 else {                                             //####### NOT CALCULATOR MODE ######
-			 if (!(TS->token_count("Ca.D") || TS->token_count("grid")) || equal(TS->get_string("mode"), "ODE")) {
-				 if (VERBOSE) fprintf(stderr, "***** Running in ODE-only mode *****\n");
-				 Simulation = new ODESimulationObj(*TS);     //#######  ODE solver mode: ########
-			 }
-			 else Simulation = new SimulationObj(*TS);       //########  FULL PDE MODE  #########
-			 TS->get_int_param("Number_Of_Iterations_Per_PDE_Step", &Number_Of_Iterations_Per_PDE_Step);
-			 Simulation->Run();                              //#### RUN THE DIFFERENCE SCHEME ####
-			 if (vary())
-				 for (int i = 0; i < result.size; i++) {
-					 if ((trackPtr = Simulation->ResolveID(vary.trackIDs[i]))) result[i] = *trackPtr;
-					 else  TS->errorMessage(TS->token_index(vary.trackIDs[i]), 0, "Cannot track an undefined variable");
-				 }
-			 TS->printResults(Simulation);
+		 if (jobs) seedRandom(seed + step);
+		 if (!Script) Script = new TokenString(scriptFileName, EXTRA_PARAM_STRING, vary.loopVarString, argc, argv);
+		 if (Script->stepDependent) { TS = Script; Script = 0; }   // "if" or "echo" statements: parse at each step
+		 else TS = new TokenString(*Script, EXTRA_PARAM_STRING, vary.loopVarString, argc, argv);
+
+		 int status = runStep(TS, vary, result);
+		 vary.record(status);
+		 if (status == STEP_DONE) {
+			 vary.draw();
 #ifndef _NO_GLUT_
-			 if (Simulation->Plots->gl_on && Simulation->Plots->plot_num)  glutMainLoop();
+			 if (vary.plots->gl_on && step == vary.steps - 1) {
+				 GluPlotArray = vary.plots;
+				 glutMainLoop();
+			 }
 #endif
-			 delete Simulation;
 		 }
-
-		 vary.draw();
-#ifndef _NO_GLUT_
-		 if (vary.plots->gl_on && step == vary.steps - 1) {
-			 GluPlotArray = vary.plots;
-			 glutMainLoop();
-		 }
-#endif
 		 delete TS;
+		 if (status == STEP_EXIT) break;
 
 	 } // ****************************** Loop over steps
 
+	 if (Script) delete Script;
+	 vary.closeJournal();     // the sweep is completed
+
+ }
+ catch (char *str) { reportError(str); error = 1; }
+ catch (int i)     { reportError(i);   error = 1; }
+
+ SimulationObj::releaseGeometry();
+ return error;
+ }
+
+ //**************************************************************************************************
+
+ int main(int argc, char **argv) {
+
+ char fname[1024], path[2048];
+ int  jobs = sweepJobs(argc, argv);   // "-j N": parallel sweep, with a deterministic seed for each step
+ bool resume = sweepResume(argc, argv);  // "--resume": skip the steps completed by an interrupted sweep
+
+ if (argc > 2 && equal(argv[1], "--ascii"))   // converts a binary point plot file (see output.h)
+	 try { return pointsToAscii(argv[2], (argc > 3) ? argv[3] : "stdout"); }
+	 catch (char *str) { reportError(str); return 1; }
+
+ if (argc > 2 && equal(argv[1], "--unpack"))  // converts a packed binary field plot file (see packed.h)
+	 try {
+		 char out[1024];
+		 snprintf(out, 1023, "%s.raw", argv[2]);
+		 return unpackFile(argv[2], (argc > 3) ? argv[3] : out);
+	 }
+	 catch (char *str) { reportError(str); return 1; }
+
+ if (argc > 2 && equal(argv[1], "--monitor")) // prints a plot stream (see stream.h)
+	 try { return monitorStream(argv[2], (argc > 3) ? atoi(argv[3]) : -1); }
+	 catch (char *str) { reportError(str); return 1; }
+
+ if (argc > 2 && equal(argv[1], "--snapshots")) // reads and checks a snapshot ring (see snapshot.h)
+	 try { return readSnapshots(argv[2], (argc > 3) ? atoi(argv[3]) : -1); }
+	 catch (char *str) { reportError(str); return 1; }
+
+ if (argc >1) strcpy(path, argv[1]);
+ else {
+	 FILE* f = fopen("DefaultScript.txt", "r");
+	 if (f) {
+		 fclose(f);
+		 strcpy(path, "DefaultScript.txt");
+	 } else {
+		 header();
+		 fprintf(stderr, "\n\n Enter the CalC script file name: ");
+		 fflush(stderr);
+		 scanf("%s", fname);
+		 size_t i = strlen(argv[0]);
+		 while (argv[0][i] != '/' && argv[0][i] != '\\' && i > 0) i--;
+		 strncpy(path, argv[0], i + 1);
+		 path[i + 1] = 0;
+		 fprintf(stderr, "\n Full path = %s \n", path);
+		 strcat(path, fname);
+		 fprintf(stderr, " File name = %s \n\n", path);
+	 }
  }
- catch (char *str) { if ( !equal(str,"") ) {
-                        fprintf(stderr, "\n\n*** Error: %s\n", str);
-			fflush(stderr); 
-                        delete [] str;  }
-                   }
 
- catch (int i) { fprintf(stderr, "\n\n*** CalC: breaking execution on exception #%d ***\n", i); 
-                 perror(" System error (if any): ");
-                 fflush(stderr); }
+ runScript(path, jobs, resume, argc, argv);
 
  if (VERBOSE > 3) {  fprintf(stderr, "\n\n*** Enter any string to exit CalC ***\n"); 
 		     fflush(stderr);
@@ -747,122 +935,84 @@ double get_sim_time(TokenString &params)
 //**************************************************************************
 
 
-void setFieldByFunction(TokenString &TS, long p, double *Field, const char *errStr) {
+#define FIELD_CHUNK (64 * EXPRESSION_BLOCK)  // grid nodes per batch evaluation call
+
+// Evaluates expression at token "p" over the entire grid, storing the result either in the
+// double array "Field" or (if non-zero) in the boolean array "isTrue" as ( value > 0 ).
+// Nodes are processed in chunks, for which the coordinate arrays are filled in advance and passed 
+// to the batch evaluator ExpressionObj::EvaluateBatch(); "threads = n" spreads each chunk over n threads
+
+void evaluateOnGrid(TokenString &TS, long p, double *Field, bool *isTrue, const char *errStr) {
 
   int xsize = FieldObj::Grid->xsize;  double *xcoord = FieldObj::Grid->xcoord;
   int ysize = FieldObj::Grid->ysize;  double *ycoord = FieldObj::Grid->ycoord;
   int zsize = FieldObj::Grid->zsize;  double *zcoord = FieldObj::Grid->zcoord;
 
-  int  ix, iy, iz;
-  long l = 0;
+  int  ix = 0, iy = 0, iz = 0, threads = 1;
+  long i, l, n, size = xsize;
   double x, y, z;
+  double *bindPtr[3] = { &x, &y, &z };
+  const double *bindArr[3];
   ExpressionObj *T = 0;
 
-  switch (DIMENSIONALITY) {
+  TS.get_int_param("threads", &threads);
 
+  switch (DIMENSIONALITY) {
   case 1:
     T = new ExpressionObj(TS, p, makeMessage("%s (function of %s)", errStr, LABEL_DIM1), 0, 0, &x, LABEL_DIM1); 
-    for (ix = 0; ix < xsize; ix++)  {
-          x = xcoord[ix];
-          Field[l++] = T->Evaluate();
-    }
     break;  
-
   case 2:
     T = new ExpressionObj(TS, p, 
             makeMessage("%s (function of %s, %s)", errStr, LABEL_DIM1, LABEL_DIM2), 0, 0, &x, LABEL_DIM1, &y, LABEL_DIM2); 
-    for (iy = 0; iy < ysize; iy++) {
-        y = ycoord[iy];
-        for (ix = 0; ix < xsize; ix++)  {
-          x = xcoord[ix];
-          Field[l++] = T->Evaluate();
-	}
-    }
+    size *= ysize;
     break;  
- 
   case 3:
     T = new ExpressionObj(TS, p, 
          makeMessage("%s (function of %s, %s, %s)", errStr, LABEL_DIM1, LABEL_DIM2, LABEL_DIM3), 
          0, 0, &x, LABEL_DIM1, &y, LABEL_DIM2, &z, LABEL_DIM3); 
-    for (iz = 0; iz < zsize; iz++) {
-      z = zcoord[iz];
-      for (iy = 0; iy < ysize; iy++) {
-        y = ycoord[iy];
-        for (ix = 0; ix < xsize; ix++)  {
-          x = xcoord[ix];
-          Field[l++] = T->Evaluate();
-	}
-      }
-    }
+    size *= ysize * zsize;
     break;  
- }
-
- if (T && VERBOSE) T->print(stderr); 
- if (T) delete T;
- return;
-}
-
-//**************************************************************************
+  default: return;
+  }
 
+  long    chunk  = (size < FIELD_CHUNK) ? size : FIELD_CHUNK;
+  double *coords = new double[DIMENSIONALITY * chunk];
+  double *values = isTrue ? new double[chunk] : 0;
 
-void setFieldByFunction(TokenString &TS, long p, bool *Field, const char *errStr) {
+  for (l = 0; l < DIMENSIONALITY; l++) bindArr[l] = coords + l * chunk;
 
-  int xsize = FieldObj::Grid->xsize;  double *xcoord = FieldObj::Grid->xcoord;
-  int ysize = FieldObj::Grid->ysize;  double *ycoord = FieldObj::Grid->ycoord;
-  int zsize = FieldObj::Grid->zsize;  double *zcoord = FieldObj::Grid->zcoord;
+  for (l = 0; l < size; l += n) {
+    n = (size - l < chunk) ? size - l : chunk;
+    for (i = 0; i < n; i++) {    // x runs fastest, as in the field storage order
+      coords[i] = xcoord[ix];
+      if (DIMENSIONALITY > 1) coords[chunk + i] = ycoord[iy];
+      if (DIMENSIONALITY > 2) coords[2 * chunk + i] = zcoord[iz];
+      if (++ix == xsize) { ix = 0; if (++iy == ysize) { iy = 0; iz++; } }
+    }
+    if (isTrue) {
+      T->EvaluateBatch(n, values, DIMENSIONALITY, bindPtr, bindArr, threads);
+      for (i = 0; i < n; i++) isTrue[l + i] = (values[i] > 0);
+    }
+    else T->EvaluateBatch(n, Field + l, DIMENSIONALITY, bindPtr, bindArr, threads);
+  }
 
-  int  ix, iy, iz;
-  long l = 0;
-  double x, y, z;
-  ExpressionObj *T = 0;
+  delete [] coords;
+  if (values) delete [] values;
 
-  switch (DIMENSIONALITY) {
+  if (VERBOSE) { T->print(stderr); if (isTrue) fprintf(stderr, "\n"); }
+  delete T;
+}
 
-  case 1:
-    T = new ExpressionObj(TS, p, makeMessage("%s (function of %s)", errStr, LABEL_DIM1), 0, 0, &x, LABEL_DIM1); 
-    for (ix = 0; ix < xsize; ix++)  {
-          x = xcoord[ix];
-          Field[l++] = T->Evaluate() > 0;
-    }
-    break;  
+//**************************************************************************
 
-  case 2:
-    T = new ExpressionObj(TS, p, 
-            makeMessage("%s (function of %s, %s)", errStr, LABEL_DIM1, LABEL_DIM2), 0, 0, &x, LABEL_DIM1, &y, LABEL_DIM2); 
-    for (iy = 0; iy < ysize; iy++) {
-        y = ycoord[iy];
-        for (ix = 0; ix < xsize; ix++)  {
-          x = xcoord[ix];
-          Field[l++] = T->Evaluate() > 0;
-	}
-    }
-    break;  
- 
-  case 3:
-    T = new ExpressionObj(TS, p, 
-         makeMessage("%s (function of %s, %s, %s)", errStr, LABEL_DIM1, LABEL_DIM2, LABEL_DIM3), 
-         0, 0, &x, LABEL_DIM1, &y, LABEL_DIM2, &z, LABEL_DIM3); 
+void setFieldByFunction(TokenString &TS, long p, double *Field, const char *errStr) {
+  evaluateOnGrid(TS, p, Field, 0, errStr);
+}
 
-	for (iz = 0; iz < zsize; iz++) 
-	{
-		z = zcoord[iz]; 
-		for (iy = 0; iy < ysize; iy++) 
-		{
-			y = ycoord[iy]; 
-			for (ix = 0; ix < xsize; ix++)  
-			{
-				x = xcoord[ix];
-				double val = T->Evaluate();
-				Field[l++] = (val > 0);
-			}
-		}
-	}
-	break;  
- }
+//**************************************************************************
 
-  if (T && VERBOSE) { T->print(stderr); fprintf(stderr, "\n"); }
- if (T) delete T;
- return;
+void setFieldByFunction(TokenString &TS, long p, bool *Field, const char *errStr) {
+  evaluateOnGrid(TS, p, 0, Field, errStr);
 }
 
 //**************************************************************************
@@ -42,8 +42,8 @@
 #include "grid.h"
 #include "box.h"
 
-class GridObj *VolumeObjClass::Grid = 0;
-class GridObj *RegionObj::Grid = 0;
+thread_local class GridObj *VolumeObjClass::Grid = 0;
+thread_local class GridObj *RegionObj::Grid = 0;
 
 extern void setFieldByFunction(TokenString &TS, long p, bool    *Diff, const char *errStr);
 
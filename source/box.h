@@ -62,7 +62,7 @@ public:
   bool   *isInside;
   long   tokenPosition;
 
-  static GridObj *Grid;
+  static thread_local GridObj *Grid;
   static void bindToGrid(GridObj &grid) { Grid = &grid; }
   void   computeFormulas(TokenString &pars);
 
@@ -92,6 +92,11 @@ public:
 
   VolumeObjClass &operator=(const VolumeObjClass &B) { set(B); return *this; }
 
+  bool same(const VolumeObjClass &B) const   // same shape (formula volumes are never considered the same)
+    { return volumeType != 'f' && volumeType == B.volumeType && isObstacle == B.isObstacle &&
+             p1 == B.p1 && p2 == B.p2 && p3 == B.p3 && p4 == B.p4 && p5 == B.p5 && p6 == B.p6 &&
+             xmin == B.xmin && xmax == B.xmax && ymin == B.ymin && ymax == B.ymax && zmin == B.zmin && zmax == B.zmax; }
+
   int inside(int, int, int);
 };
 
@@ -115,7 +120,7 @@ public:
 
  double XMax, XMin, YMax, YMin, ZMax, ZMin;
 
- static GridObj *Grid;
+ static thread_local GridObj *Grid;
  static void bindToGrid(GridObj &grid) { Grid = &grid; VolumeObjClass::bindToGrid(grid); }
 
  VolumeObjClass    *enclosures;
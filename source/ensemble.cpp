@@ -0,0 +1,471 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                            ensemble.cpp
+ *
+ *  Ensemble ODE mode: the parameter sweep of the "for" loops integrated as a
+ *  single batch (class EnsembleObj, see ensemble.h)
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>  // for compatibility with Visual C++
+#include <string.h>
+#include <stdarg.h>
+#include "vector.h"
+#include "syntax.h"
+#include "box.h"
+#include "grid.h"
+#include "field.h"
+#include "table.h"
+#include "peak.h"
+#include "markov.h"
+#include "interpol.h"
+#include "simulation.h"
+#include "gate.h"
+#include "fplot.h"
+#include "loop.h"
+#include "ensemble.h"
+
+extern void   getRun( TokenString &TS, int i, bool *adaptive, double *time=0, double *accuracy=0,
+					  double *dtMax=0, double *dt=0, double *dtStretch=0, double *ODEaccuracy=0);
+
+//*******************************************************************************************
+//  The ensemble mode is used if requested by "ODE.ensemble = on", for a sweep of an
+//  ODE-only simulation
+//*******************************************************************************************
+
+bool isEnsemble(TokenString &TS, LoopObj &vary) {
+
+  if ( !vary() || !TS.Assert("ODE.ensemble", "on") || !TS.token_count("Run") ) return false;
+  if ( TS.token_count("exit") || TS.token_count("continue") || vary.values ) return false;   // adaptive sweeps run step by step
+
+  return !( TS.token_count("Ca.D") || TS.token_count("grid") ) || equal(TS.get_string("mode"), "ODE");
+}
+
+//*******************************************************************************************
+//  Script line declaring the loop variables as ensemble parameters, with the values
+//  of the first ensemble member
+//*******************************************************************************************
+
+void ensembleParameters(LoopObj &vary, char *s) {
+
+  char temp[MAX_TOKEN_LENGTH];
+
+  strcpy(s, "");
+  for (int i = 0; i < vary(); i++) {
+    snprintf(temp, MAX_TOKEN_LENGTH - 1, "ensemble.parameter %s %.17g ; ", vary.ids[i], vary.value(0, i) );
+    if ( strlen(s) + strlen(temp) >= MAX_LINE_LENGTH - 64 ) throw makeMessage("Too many ensemble parameters");
+    strcat(s, temp);
+  }
+}
+
+//*******************************************************************************************
+//  The "for" statements would define the loop variables as constants, and the plots are
+//  not produced for the individual ensemble members: remove these statements
+//*******************************************************************************************
+
+void prepareEnsembleScript(TokenString &TS) {
+
+  const char *remove[2] = { LOOP_TOKEN, "plot" };
+
+  for (int k = 0; k < 2; k++)
+    while ( TS.token_count(remove[k]) ) {
+      long p0 = TS.token_index(remove[k], 1);
+      long p1 = TS.lastInLine(p0);
+      if ( p1 + 1 < TS.token_num && TS.equal(p1 + 1, CARR_RET_TOKEN) ) p1++;
+      TS.deleteToken(p0, p1);
+    }
+}
+
+//*******************************************************************************************
+
+EnsembleObj::EnsembleObj(TokenString &TS, LoopObj &vary)
+{
+  int  i, j, m;
+  long pos;
+
+  if ( TS.token_count("equilibrate") ) throw makeMessage("ODE.ensemble: \"equilibrate\" is not supported in the ensemble mode");
+  if ( TS.token_count("Import", &pos) ) TS.errorMessage(pos, 0, "\"Import\" is not supported in the ensemble mode");
+
+  Sim   = new ODESimulationObj(TS);
+  Gates = Sim->Gates;
+
+  if ( Gates->tables->table_num || Gates->switches->number || Gates->locations->interpol_num )
+    throw makeMessage("ODE.ensemble: tables, Markov kinetic schemes and interpolated variables are not supported in the ensemble mode");
+
+  size      = int(vary.steps);
+  var_num   = Gates->var_num;
+  ident_num = Gates->ident_num;
+  param_num = Gates->param_num;
+  peak_num  = Gates->maxima->peak_num;
+  nbind     = var_num + ident_num + param_num + 1 + 2 * peak_num;
+
+  for (i = 0; i < var_num + ident_num; i++)
+    if ( Gates->formulas[i]->isVolatile() )
+      throw makeMessage("ODE.ensemble: random number generator calls are not supported in the ensemble mode:\n { %s }",
+                        Gates->formulas[i]->formula);
+
+  dt0      = 1.0;
+  accuracy = 1e-6;
+  TS.get_param("ODE.dt0",      &dt0);
+  TS.get_param("ODE.accuracy", &accuracy);
+
+  long n = long(size) * (var_num > 0 ? var_num : 1);
+
+  Y  = new double[n];  Y0 = new double[n];  Ys = new double[n];  V1 = new double[n];
+  for (i = 0; i < 6; i++) K[i] = new double[n];
+  I  = new double[long(size) * ident_num + 1];
+  P  = new double[long(size) * param_num + 1];
+  T  = new double[size];  T0 = new double[size];  Ts = new double[size];
+  dt = new double[size];  Tend = new double[size];
+  active = new char[size]; accepted = new char[size];
+
+  n = long(size) * peak_num + 1;
+  peak    = new double[n];  peakTime  = new double[n];  started  = new char[n];
+  peak0   = new double[n];  peakTime0 = new double[n];  started0 = new char[n];
+  peakKind  = new char[peak_num + 1];
+  peakIndex = new int [peak_num + 1];
+
+  bindPtr = new double *[nbind];
+  bindArr = new const double *[nbind];
+
+  //************ model variables bound to the member arrays, in the order used by bind()
+
+  j = 0;
+  for (i = 0; i < var_num;   i++) bindPtr[j++] = (*Gates->var)()   + i;
+  for (i = 0; i < ident_num; i++) bindPtr[j++] = (*Gates->ident)() + i;
+  for (i = 0; i < param_num; i++) bindPtr[j++] = (*Gates->param)() + i;
+  bindPtr[j++] = &Gates->Time;
+  for (i = 0; i < peak_num;  i++) { bindPtr[j++] = &Gates->maxima->array[i]->peak;
+                                    bindPtr[j++] = &Gates->maxima->array[i]->peakTime; }
+
+  //************ parameter values of each member
+
+  for (i = 0; i < param_num; i++) {
+    for (j = 0; j < vary(); j++) if ( equal(Gates->param_id[i], vary.ids[j]) ) break;
+    if ( j == vary() ) throw makeMessage("ODE.ensemble: \"%s\" is not a loop variable", Gates->param_id[i]);
+    for (m = 0; m < size; m++) P[i * size + m] = vary.value(m, j);
+  }
+
+  //************ initial state, common to all members
+
+  for (i = 0; i < var_num; i++)
+    for (m = 0; m < size; m++) Y[i * size + m] = (*Gates->var)[i];
+  for (m = 0; m < size; m++) { T[m] = Gates->Time; active[m] = 1; }
+
+  for (j = 0; j < peak_num; j++) {
+    PeakTrackObj *pk = Gates->maxima->array[j];
+    double *ptr = pk->pointer;
+
+    if ( pk->tptr != &Gates->Time )
+      throw makeMessage("ODE.ensemble: cannot track the extremum of \"%s\" in the ensemble mode", pk->varName);
+
+    if      ( ptr >= (*Gates->var)()   && ptr < (*Gates->var)()   + var_num )
+            { peakKind[j] = 'v'; peakIndex[j] = int(ptr - (*Gates->var)()); }
+    else if ( ptr >= (*Gates->ident)() && ptr < (*Gates->ident)() + ident_num )
+            { peakKind[j] = 'i'; peakIndex[j] = int(ptr - (*Gates->ident)()); }
+    else if ( param_num && ptr >= (*Gates->param)() && ptr < (*Gates->param)() + param_num )
+            { peakKind[j] = 'p'; peakIndex[j] = int(ptr - (*Gates->param)()); }
+    else throw makeMessage("ODE.ensemble: cannot track the extremum of \"%s\" in the ensemble mode", pk->varName);
+
+    bool inside = ( Gates->Time >= pk->T1 && Gates->Time <= pk->T2 );  // the model was evaluated with
+    for (m = 0; m < size; m++) {                                        // the first member's parameters
+      peak    [j * size + m] = pk->peak;
+      peakTime[j * size + m] = pk->peakTime;
+      started [j * size + m] = inside ? 0 : char(pk->startFlag);
+    }
+  }
+
+  // the model object is evaluated twice on construction (KineticObj and Equilibrate)
+  Evaluate(T, Y, active);
+  Evaluate(T, Y, active);
+
+  if (VERBOSE) fprintf(stderr, "\n### ODE ensemble: %d members, %d parameter(s)\n", size, param_num);
+}
+
+//*******************************************************************************************
+
+EnsembleObj::~EnsembleObj()
+{
+  delete Sim;
+
+  delete [] Y;  delete [] Y0;  delete [] Ys;  delete [] V1;
+  for (int i = 0; i < 6; i++) delete [] K[i];
+  delete [] I;  delete [] P;
+  delete [] T;  delete [] T0;  delete [] Ts;  delete [] dt;  delete [] Tend;
+  delete [] active;  delete [] accepted;
+  delete [] peak;  delete [] peakTime;  delete [] started;
+  delete [] peak0; delete [] peakTime0; delete [] started0;
+  delete [] peakKind;  delete [] peakIndex;
+  delete [] bindPtr;   delete [] bindArr;
+}
+
+//*******************************************************************************************
+//  Member arrays for the block of members starting at m0
+//*******************************************************************************************
+
+void EnsembleObj::bind(const double *t, const double *y, int m0)
+{
+  int i, k = 0;
+
+  for (i = 0; i < var_num;   i++) bindArr[k++] = y + long(i) * size + m0;
+  for (i = 0; i < ident_num; i++) bindArr[k++] = I + long(i) * size + m0;
+  for (i = 0; i < param_num; i++) bindArr[k++] = P + long(i) * size + m0;
+  bindArr[k++] = t + m0;
+  for (i = 0; i < peak_num;  i++) { bindArr[k++] = peak     + long(i) * size + m0;
+                                    bindArr[k++] = peakTime + long(i) * size + m0; }
+}
+
+//*******************************************************************************************
+
+void EnsembleObj::evaluateIdent(const double *t, const double *y)
+{
+  for (int m0 = 0; m0 < size; m0 += EXPRESSION_BLOCK) {
+    int n = (size - m0 < EXPRESSION_BLOCK) ? size - m0 : EXPRESSION_BLOCK;
+    bind(t, y, m0);
+    for (int i = 0; i < ident_num; i++)
+      Gates->formulas[i]->EvaluateBlock(n, I + long(i) * size + m0, nbind, bindPtr, bindArr);
+  }
+}
+
+//*******************************************************************************************
+//  PeakTrackObj::Evaluate() for each member selected by the mask
+//*******************************************************************************************
+
+void EnsembleObj::evaluatePeaks(const double *t, const double *y, const char *mask)
+{
+  for (int j = 0; j < peak_num; j++) {
+    PeakTrackObj *pk = Gates->maxima->array[j];
+    const double *x = ( peakKind[j] == 'v' ) ? y : ( peakKind[j] == 'i' ) ? I : P;
+    x += long(peakIndex[j]) * size;
+
+    for (int m = 0; m < size; m++) {
+      if ( !mask[m] || t[m] < pk->T1 || t[m] > pk->T2 ) continue;
+      long k = long(j) * size + m;
+      if ( !started[k] ) { started[k] = 1; peak[k] = x[m]; peakTime[k] = t[m]; }
+      else if ( pk->isMax ) { if ( x[m] >= peak[k] ) { peak[k] = x[m]; peakTime[k] = t[m]; } }
+           else  if ( x[m] <= peak[k] ) { peak[k] = x[m]; peakTime[k] = t[m]; }
+    }
+  }
+}
+
+//*******************************************************************************************
+
+void EnsembleObj::Evaluate(const double *t, const double *y, const char *mask)
+{
+  evaluateIdent(t, y);
+  evaluatePeaks(t, y, mask);
+  evaluateIdent(t, y);  // In case aux depend on max/min
+}
+
+//*******************************************************************************************
+
+void EnsembleObj::derivative(const double *t, const double *y, double *dydt, const char *mask)
+{
+  Evaluate(t, y, mask);
+
+  for (int m0 = 0; m0 < size; m0 += EXPRESSION_BLOCK) {
+    int n = (size - m0 < EXPRESSION_BLOCK) ? size - m0 : EXPRESSION_BLOCK;
+    bind(t, y, m0);
+    for (int i = 0; i < var_num; i++)
+      Gates->formulas[i + ident_num]->EvaluateBlock(n, dydt + long(i) * size + m0, nbind, bindPtr, bindArr);
+  }
+}
+
+//*******************************************************************************************
+//  Cash-Karp scheme of KineticObj::RungeKuttaAdaptive(), with a separate time step for each
+//  member. The members that have completed the run (or that rejected the step) keep their
+//  state, so that all members are evaluated together at each stage.
+//*******************************************************************************************
+
+void EnsembleObj::RungeKuttaAdaptive(double Tr, double eps, double ceiling, double dtInit)
+{
+  static double safety = 0.95;
+  static const double a2 = 0.2, a3 = 0.3, a4 = 0.6, a5 = 1.0, a6 = 0.875;
+
+  static const double b21 = 0.2;
+  static const double b31 = 3.0 / 40.0, b32 = 9.0/40.0;
+  static const double b41 = 0.3, b42 = -0.9, b43 = 1.2;
+  static const double b51 = -11.0/54.0, b52 = 2.5, b53 = -70.0/27.0, b54 = 35.0/27.0;
+  static const double b61 = 1631.0/55296.0, b62 = 175.0/512.0, b63 = 575.0/13824.0, b64 = 44275.0/110592.0,
+					  b65 = 253.0/4096.0;
+
+  static const double c1  = 37.0 / 378.0,     c3 = 250.0 / 621.0, c4 = 125.0 / 594.0, c6 = 512.0 / 1771.0;
+  static const double cc1 = 2825.0 / 27648.0, cc3 = 18575.0 / 48384.0, cc4 = 13525.0 / 55296.0, cc5 = 277.0/14336.0,
+                      cc6 = 0.25;
+
+  double *k1 = K[0], *k2 = K[1], *k3 = K[2], *k4 = K[3], *k5 = K[4], *k6 = K[5];
+  int    i, m, left = 0;
+  long   k;
+
+  if ( Tr <= 0 ) return;
+  if ( dtInit <= 0 ) dtInit = Tr;
+
+  for (m = 0; m < size; m++) {
+    dt[m] = dtInit;
+    Tend[m] = T[m] + Tr;
+    active[m] = 1;
+    if ( ceiling ) {
+      if ( T[m] >= ceiling ) active[m] = 0;
+      else if ( Tend[m] > ceiling ) Tend[m] = ceiling;
+    }
+    if ( !var_num && active[m] ) T[m] = Tend[m];
+    left += active[m];
+  }
+
+  if ( !var_num ) { Evaluate(T, Y, active); return; }
+
+  while ( left )
+   {
+   for (m = 0; m < size; m++) {
+     if ( !active[m] ) continue;
+     if ( T[m] + dt[m] > Tend[m] )  dt[m] = Tend[m] - T[m];
+     T0[m] = T[m];
+     for (i = 0; i < var_num; i++)  { k = long(i) * size + m; Y0[k] = Y[k]; }
+     for (i = 0; i < peak_num; i++) { k = long(i) * size + m;
+                                      peak0[k] = peak[k]; peakTime0[k] = peakTime[k]; started0[k] = started[k]; }
+   }
+
+   for (k = 0; k < long(var_num) * size; k++) Ys[k] = Y[k];
+   for (m = 0; m < size; m++) Ts[m] = T[m];
+
+   derivative(T, Y, k1, active);
+
+   for (m = 0; m < size; m++) if ( active[m] ) {
+     for (i = 0; i < var_num; i++) { k = long(i) * size + m; Ys[k] = Y0[k] + dt[m] * (b21 * k1[k]); }
+     Ts[m] = T0[m] + a2 * dt[m]; }
+   derivative(Ts, Ys, k2, active);
+
+   for (m = 0; m < size; m++) if ( active[m] ) {
+     for (i = 0; i < var_num; i++) { k = long(i) * size + m; Ys[k] = Y0[k] + dt[m] * (b31 * k1[k] + b32 * k2[k]); }
+     Ts[m] = T0[m] + a3 * dt[m]; }
+   derivative(Ts, Ys, k3, active);
+
+   for (m = 0; m < size; m++) if ( active[m] ) {
+     for (i = 0; i < var_num; i++) { k = long(i) * size + m;
+                                     Ys[k] = Y0[k] + dt[m] * (b41 * k1[k] + b42 * k2[k] + b43 * k3[k]); }
+     Ts[m] = T0[m] + a4 * dt[m]; }
+   derivative(Ts, Ys, k4, active);
+
+   for (m = 0; m < size; m++) if ( active[m] ) {
+     for (i = 0; i < var_num; i++) { k = long(i) * size + m;
+                                     Ys[k] = Y0[k] + dt[m] * (b51 * k1[k] + b52 * k2[k] + b53 * k3[k] + b54 * k4[k]); }
+     Ts[m] = T0[m] + a5 * dt[m]; }
+   derivative(Ts, Ys, k5, active);
+
+   for (m = 0; m < size; m++) if ( active[m] ) {
+     for (i = 0; i < var_num; i++) { k = long(i) * size + m;
+                                     Ys[k] = Y0[k] + dt[m] * (b61 * k1[k] + b62 * k2[k] + b63 * k3[k] + b64 * k4[k] + b65 * k5[k]); }
+     Ts[m] = T0[m] + a6 * dt[m]; }
+   derivative(Ts, Ys, k6, active);
+
+   //************ error estimate and time step update for each member
+
+   for (m = 0; m < size; m++) {
+     accepted[m] = 0;
+     if ( !active[m] ) continue;
+
+     double L1norm = 0.0, temp, delta, dthold;
+     for (i = 0; i < var_num; i++) {
+       k = long(i) * size + m;
+       V1[k] = c1 * k1[k] + c3 * k3[k] + c4 * k4[k] + c6 * k6[k];
+       temp  = fabs( (cc1 * k1[k] + cc3 * k3[k] + cc4 * k4[k] + cc5 * k5[k] + cc6 * k6[k]) - V1[k] );
+       if ( _isnan(temp) ) { L1norm = temp; break; }
+       if ( temp > L1norm ) L1norm = temp;
+     }
+     delta = dt[m] * L1norm;
+
+     if ( delta > eps || !_finite(L1norm) ) {  // accuracy condition not satisfied: restore the member state
+       T[m] = T0[m];
+       for (i = 0; i < var_num; i++)  { k = long(i) * size + m; Y[k] = Y0[k]; }
+       for (i = 0; i < peak_num; i++) { k = long(i) * size + m;
+                                        peak[k] = peak0[k]; peakTime[k] = peakTime0[k]; started[k] = started0[k]; }
+       dthold = 0.1 * dt[m];
+       if ( !_finite(L1norm) ) dt[m] /= 5.0;
+       else dt[m] *= safety * pow(delta / eps, -0.25);
+       if (dt[m] < dthold) dt[m] = dthold;
+       while (T[m] + dt[m] <= T[m])  dt[m] *= 2.0;
+     }
+     else {
+       T[m] = T0[m] + dt[m];
+       for (i = 0; i < var_num; i++) { k = long(i) * size + m; Y[k] = Y0[k] + V1[k] * dt[m]; }
+       accepted[m] = 1;
+       dthold = 5.0 * dt[m];
+       if (delta > 0) dt[m] *= safety * pow(delta / eps, -0.2);
+       if (dt[m] > dthold) dt[m] = dthold;
+     }
+   }
+
+   Evaluate(T, Y, accepted);   // ensure that all variables are evaluated at the current time
+
+   for (m = 0; m < size; m++)
+     if ( active[m] && !( (Tend[m] - T[m]) / (T[m] + Tend[m] + 1e-12) > 1e-12 ) ) { active[m] = 0; left--; }
+   }
+}
+
+//*******************************************************************************************
+
+void EnsembleObj::Run()
+{
+  double time = 0;
+  bool   flag;
+
+  if (VERBOSE) fprintf(stderr,"\n\n#### Running the ODE ensemble: total simulation time = %g\n", Sim->totalSimTime);
+
+  for (int i = 1; i <= Sim->Params->token_count("Run"); i++) {
+
+    getRun(*Sim->Params, i, &flag, &time, &accuracy, &dt0);
+
+    if (VERBOSE) fprintf(stderr," ### ODE Run #%d: time = %g, accuracy = %g, initial time-step = %g\n",
+            i, time, accuracy, dt0);
+
+    RungeKuttaAdaptive(time, accuracy, Sim->totalSimTime, dt0);
+  }
+}
+
+//*******************************************************************************************
+
+void EnsembleObj::load(int m)
+{
+  int i;
+
+  for (i = 0; i < var_num;   i++) (*Gates->var)[i]   = Y[long(i) * size + m];
+  for (i = 0; i < ident_num; i++) (*Gates->ident)[i] = I[long(i) * size + m];
+  for (i = 0; i < param_num; i++) (*Gates->param)[i] = P[long(i) * size + m];
+  Gates->Time = T[m];
+
+  for (i = 0; i < peak_num; i++) {
+    PeakTrackObj *pk = Gates->maxima->array[i];
+    pk->peak      = peak    [long(i) * size + m];
+    pk->peakTime  = peakTime[long(i) * size + m];
+    pk->startFlag = ( started[long(i) * size + m] != 0 );
+  }
+}
+
+//*******************************************************************************************
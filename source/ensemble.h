@@ -0,0 +1,86 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             ensemble.h
+ *
+ *  Ensemble ODE mode ("ODE.ensemble = on"): all the parameter sets of the
+ *  "for" loops are integrated together, using a single KineticObj model in
+ *  which the loop variables are ensemble parameters (resolved by address).
+ *  The state of all ensemble members is held in structure-of-arrays layout,
+ *  element [i * size + m] being variable i of member m, and the formulas are
+ *  evaluated for all members at once by ExpressionObj::EvaluateBlock.
+ *  Each member has its own Cash-Karp adaptive time step, as in
+ *  KineticObj::RungeKuttaAdaptive(), whose results it reproduces.
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_ENSEMBLE_H_included
+#define CALC_ENSEMBLE_H_included
+
+//*************************************************************************************
+
+class EnsembleObj
+{
+  int     size;                         // number of ensemble members
+  int     var_num, ident_num, param_num, peak_num, nbind;
+  double  dt0, accuracy;                // persist between the runs, as in ODESimulationObj
+
+  double  *Y, *Y0, *Ys, *I, *P;         // state, saved state, stage state, identities, parameters
+  double  *K[6], *V1;                   // Runge-Kutta stages and the 5th order increment
+  double  *T, *T0, *Ts, *dt, *Tend;     // time, saved time, stage time, time step, end of run
+  char    *active, *accepted;
+
+  double  *peak, *peakTime, *peak0, *peakTime0;   // min/max tracking, [p * size + m]
+  char    *started, *started0;
+  char    *peakKind;                    // 'v', 'i' or 'p': the tracked variable is an ODE variable,
+  int     *peakIndex;                   //  an identity or a parameter, with the given index
+
+  double  **bindPtr;                    // addresses of the model variables bound to member arrays
+  const double **bindArr;
+
+  class KineticObj *Gates;
+
+  void  bind(const double *t, const double *y, int m0);
+  void  evaluateIdent(const double *t, const double *y);
+  void  evaluatePeaks(const double *t, const double *y, const char *mask);
+  void  Evaluate  (const double *t, const double *y, const char *mask);
+  void  derivative(const double *t, const double *y, double *dydt, const char *mask);
+  void  RungeKuttaAdaptive(double T, double eps, double ceiling, double dt0);
+
+ public:
+
+  class SimulationObj *Sim;
+
+  EnsembleObj(class TokenString &TS, class LoopObj &vary);
+ ~EnsembleObj();
+
+  void Run();
+  void load(int m);   // copy the state of member m into the model, for tracking and printing
+};
+
+bool isEnsemble(class TokenString &TS, class LoopObj &vary);
+void ensembleParameters(class LoopObj &vary, char *s);
+void prepareEnsembleScript(class TokenString &TS);
+
+//*************************************************************************************
+
+#endif
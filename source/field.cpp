@@ -52,39 +52,42 @@ extern void setFieldByFunction(TokenString &, long, double *, const char *errStr
 
 const double pi = atan(1.0) * 4;
 
-double (*integrate)(double, double, double, int) = &gaussian;
+thread_local double (*integrate)(double, double, double, int) = &gaussian;
 
 //****************************************************************************
 //                      INITIALIZING STATIC MEMBERS:
 //****************************************************************************
 
-class RegionObj      *FieldObj::Region  = 0;
-class GridObj        *FieldObj::Grid    = 0;
-class BCarrayObj     *FieldObj::BCarray = 0;
+thread_local class RegionObj      *FieldObj::Region  = 0;
+thread_local class GridObj        *FieldObj::Grid    = 0;
+thread_local class BCarrayObj     *FieldObj::BCarray = 0;
 
-char   FieldObj::SAME_CURRENT = 1;
+thread_local char   FieldObj::SAME_CURRENT = 1;
 
-int    FieldObj::xsize   = 0,    FieldObj::ysize   = 0,  FieldObj::zsize  = 0;
-long   FieldObj::Size    = 0,    FieldObj::xysize  = 0;
+thread_local int    FieldObj::xsize   = 0,    FieldObj::ysize   = 0,  FieldObj::zsize  = 0;
+thread_local long   FieldObj::Size    = 0,    FieldObj::xysize  = 0;
 
-double *FieldObj::xgrid  = 0,   *FieldObj::ygrid   = 0, *FieldObj::zgrid  = 0;
-double *FieldObj::xcoord = 0,   *FieldObj::ycoord  = 0, *FieldObj::zcoord = 0;
+thread_local double *FieldObj::xgrid  = 0,   *FieldObj::ygrid   = 0, *FieldObj::zgrid  = 0;
+thread_local double *FieldObj::xcoord = 0,   *FieldObj::ycoord  = 0, *FieldObj::zcoord = 0;
 
-double *FieldObj::dxplus = 0,   *FieldObj::dxminus = 0, *FieldObj::dvx = 0;
-double *FieldObj::dyplus = 0,   *FieldObj::dyminus = 0, *FieldObj::dvy = 0;
-double *FieldObj::dzplus = 0,   *FieldObj::dzminus = 0, *FieldObj::dvz = 0;
+thread_local double *FieldObj::dxplus = 0,   *FieldObj::dxminus = 0, *FieldObj::dvx = 0;
+thread_local double *FieldObj::dyplus = 0,   *FieldObj::dyminus = 0, *FieldObj::dvy = 0;
+thread_local double *FieldObj::dzplus = 0,   *FieldObj::dzminus = 0, *FieldObj::dvz = 0;
   
-double *FieldObj::bc_deriv = 0, *FieldObj::bc_lin = 0,  *FieldObj::bc_coef = 0, *FieldObj::bc_const = 0;
-double *FieldObj::bc_Kn    = 0, *FieldObj::bc_pow  = 0, *FieldObj::bc_pump = 0;
-double *FieldObj::bc_Kn2   = 0, *FieldObj::bc_pow2 = 0, *FieldObj::bc_pump2 = 0;
+thread_local double *FieldObj::bc_deriv = 0, *FieldObj::bc_lin = 0,  *FieldObj::bc_coef = 0, *FieldObj::bc_const = 0;
+thread_local double *FieldObj::bc_Kn    = 0, *FieldObj::bc_pow  = 0, *FieldObj::bc_pump = 0;
+thread_local double *FieldObj::bc_Kn2   = 0, *FieldObj::bc_pow2 = 0, *FieldObj::bc_pump2 = 0;
 
-char  **FieldObj::bc_id       = 0;
-int     FieldObj::bc_type_num = 0;
+thread_local char  **FieldObj::bc_id       = 0;
+thread_local int     FieldObj::bc_type_num = 0;
 
-double *FieldObj::right  = 0, *FieldObj::diag   = 0, *FieldObj::sup    = 0,  *FieldObj::sub = 0;
+thread_local double *FieldObj::right  = 0, *FieldObj::diag   = 0, *FieldObj::sup    = 0,  *FieldObj::sub = 0;
 
-struct TermStruct *Currents   = 0;
-class  ExpressionObj *Current = 0;
+thread_local struct BoundaryCache *FieldObj::boundaryCache = 0;
+thread_local int   FieldObj::boundaryCacheNum = 0;
+
+thread_local struct TermStruct *Currents   = 0;
+thread_local class  ExpressionObj *Current = 0;
 
 //*************************************************************************
 //*                T R I D I A G O N A L   S Y S T E M
@@ -349,7 +352,11 @@ FieldObj::FieldObj(TokenString &params, const char *id) : VectorObj(Size)
     }
   catch(char *str) { params.errorMessage( params.token_index(id, "bc", i) + 1, str); }
 
-  init_boundary();
+  if ( !reuse_boundary() ) {
+    bool *zero = new bool[size];
+    init_boundary(zero);
+    save_boundary(zero);
+  }
 
   //******************************************************************
 
@@ -922,13 +929,14 @@ double newAverage, volume, source_adjust;
 
   ***************************************************************/
 
-void FieldObj::init_boundary()    {
+void FieldObj::init_boundary(bool *zero)    {
 
 	long      i;
 	int       p, boxid;
 	int       ix, iy, iz;
 
 	for (i = 0; i < size; i++) ptype[i] =  _INSIDE_;   // default: point inside
+	if (zero) for (i = 0; i < size; i++) zero[i] = false;
 
 	for (i = 0; i < size; i++)
 	{
@@ -941,6 +949,7 @@ void FieldObj::init_boundary()    {
 		{
 			ptype[i] = _OUTSIDE_; 
 			elem[i] = 0.0;
+			if (zero) zero[i] = true;
 		}
 		else if (p & SURF_MASK)           // point on the surface
 		{
@@ -1027,7 +1036,86 @@ void FieldObj::init_boundary()    {
 	}
 }
 
+//************************************************************************
+//  Node types of the previous simulation: reused if the field has the
+//  same boundary conditions and obstacles (the geometry and the grid
+//  being those of the previous simulation, see SimulationObj)
+//************************************************************************
+
+bool FieldObj::reuse_boundary()
+{
+	int bcNum = Region->get_surface_num() + 2 * DIMENSIONALITY * fieldObstNum;
+	int k, i;
+
+	for (k = 0; k < boundaryCacheNum; k++)
+		if ( equal(boundaryCache[k].ID, ID) ) break;
+	if (k == boundaryCacheNum) return false;
+
+	BoundaryCache &B = boundaryCache[k];
+	if (B.bcNum != bcNum || B.obstNum != fieldObstNum) return false;
+	for (i = 0; i < bcNum; i++)        if (B.bccond[i] != bccond[i]) return false;
+	for (i = 0; i < fieldObstNum; i++) if ( !B.obst[i].same(fieldObstArray[i]) ) return false;
+
+	for (long l = 0; l < size; l++) {
+		ptype[l] = B.ptype[l];
+		if (B.zero[l]) elem[l] = 0.0;
+	}
+	if (VERBOSE) fprintf(stderr, "    %s: boundary unchanged, reusing the node types of the previous simulation\n", ID);
+	return true;
+}
+
+//************************************************************************
+
+void FieldObj::save_boundary(bool *zero)
+{
+	int k, i;
+
+	for (k = 0; k < boundaryCacheNum; k++)
+		if ( equal(boundaryCache[k].ID, ID) ) break;
+
+	if (k == boundaryCacheNum) {
+		BoundaryCache *cache = new BoundaryCache[boundaryCacheNum + 1];
+		for (i = 0; i < boundaryCacheNum; i++) cache[i] = boundaryCache[i];
+		if (boundaryCache) delete [] boundaryCache;
+		boundaryCache = cache;
+		boundaryCacheNum++;
+		boundaryCache[k].ID = StrCpy(ID);
+	}
+	else {
+		delete [] boundaryCache[k].bccond;
+		delete [] boundaryCache[k].obst;
+		delete [] boundaryCache[k].ptype;
+		delete [] boundaryCache[k].zero;
+	}
+
+	BoundaryCache &B = boundaryCache[k];
+	B.bcNum   = Region->get_surface_num() + 2 * DIMENSIONALITY * fieldObstNum;
+	B.obstNum = fieldObstNum;
+	B.bccond  = new int[B.bcNum];
+	B.obst    = new VolumeObjClass[fieldObstNum + 1];
+	B.ptype   = new long[size];
+	B.zero    = zero;
+	for (i = 0; i < B.bcNum; i++)        B.bccond[i] = bccond[i];
+	for (i = 0; i < fieldObstNum; i++)   B.obst[i].set(fieldObstArray[i]);
+	for (long l = 0; l < size; l++)      B.ptype[l]  = ptype[l];
+}
+
+//************************************************************************
 
+void FieldObj::release_boundaries()
+{
+	for (int k = 0; k < boundaryCacheNum; k++) {
+		BoundaryCache &B = boundaryCache[k];
+		delete [] B.ID;
+		delete [] B.bccond;
+		delete [] B.obst;
+		delete [] B.ptype;
+		delete [] B.zero;
+	}
+	if (boundaryCache) delete [] boundaryCache;
+	boundaryCache    = 0;
+	boundaryCacheNum = 0;
+}
 
 //***********************************************************************************
 //*******************************  3D AVERAGES  ************************************* 
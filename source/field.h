@@ -55,11 +55,21 @@ typedef int  (*BufferMethod)(class BufferObj &, VectorObj &, class FieldObj &,
 double gaussian(double, double, double, int);
 double square(double, double, double, int);
 
-extern int GEOMETRY;
-extern int DIMENSIONALITY;
+extern thread_local int GEOMETRY;
+extern thread_local int DIMENSIONALITY;
 
 double calcium_gain( FieldObj *Ca, BufferArray *Bufs);
 
+struct BoundaryCache     // node types of a field, kept for the next simulation
+{
+  char           *ID;
+  int            bcNum, obstNum;
+  int            *bccond;
+  VolumeObjClass *obst;
+  long           *ptype;
+  bool           *zero;  // nodes outside of the domain, where the concentration is set to zero
+};
+
 
 //****************************************************************************
 //*                         C L A S S   F I E L D
@@ -72,11 +82,11 @@ protected:
 
   //static  double (*integrate)(double, double, double, int);
 
-  static  double *dxplus, *dxminus, *dvx;
-  static  double *dyplus, *dyminus, *dvy;
-  static  double *dzplus, *dzminus, *dvz;
+  static thread_local  double *dxplus, *dxminus, *dvx;
+  static thread_local  double *dyplus, *dyminus, *dvy;
+  static thread_local  double *dzplus, *dzminus, *dvz;
 
-  static  double *right, *diag, *sup, *sub;
+  static thread_local  double *right, *diag, *sup, *sub;
 
   void    tridiag(int n);
 
@@ -87,22 +97,22 @@ protected:
 
 public:
 
-  static  double* bc_deriv, * bc_lin,  * bc_coef, * bc_const;
-  static  double* bc_pump,  * bc_pow,  * bc_Kn;
-  static  double* bc_pump2, * bc_pow2, * bc_Kn2;
+  static thread_local  double* bc_deriv, * bc_lin,  * bc_coef, * bc_const;
+  static thread_local  double* bc_pump,  * bc_pow,  * bc_Kn;
+  static thread_local  double* bc_pump2, * bc_pow2, * bc_Kn2;
 
-  static  char   **bc_id;
-  static  int    bc_type_num;
+  static thread_local  char   **bc_id;
+  static thread_local  int    bc_type_num;
 
-  static  int   xsize, ysize, zsize;
-  static  long  Size, xysize;
+  static thread_local  int   xsize, ysize, zsize;
+  static thread_local  long  Size, xysize;
 
-  static  double *xgrid, *ygrid, *zgrid;
-  static  double *xcoord, *ycoord, *zcoord;
+  static thread_local  double *xgrid, *ygrid, *zgrid;
+  static thread_local  double *xcoord, *ycoord, *zcoord;
 
-  static class RegionObj     *Region;
-  static class GridObj       *Grid;
-  static class BCarrayObj    *BCarray;
+  static thread_local class RegionObj     *Region;
+  static thread_local class GridObj       *Grid;
+  static thread_local class BCarrayObj    *BCarray;
 
   static RegionObj *get_region() { return Region; }
   static void setStaticData(RegionObj &r, GridObj &GO, BCarrayObj &BCA);
@@ -113,7 +123,7 @@ public:
   struct TermStruct *Currents;
   class ExpressionObj *Current;
 
-  static  char SAME_CURRENT;
+  static thread_local  char SAME_CURRENT;
 
   void getCurrents(TokenString &, int simID, VarList *VL, double *);
   void evaluateCurrents();
@@ -154,7 +164,18 @@ public:
   int point_type(int x, int y, int z) { return Region->point_type(x, y, z, fieldObstNum, fieldObstArray); }
   // int point_type(long ind)            { return Region->point_type(ind,     fieldObstNum, fieldObstArray); }
 
-  void   init_boundary();
+  void   init_boundary(bool *zero = 0);
+
+  // The node types computed by init_boundary() are kept for the fields of the next simulation
+  // (the next step of the "for" loops): a field with the same ID, boundary conditions and
+  // obstacles reuses them, as long as the geometry and the grid are reused as well
+
+  static thread_local struct BoundaryCache *boundaryCache;
+  static thread_local int boundaryCacheNum;
+
+  bool   reuse_boundary();
+  void   save_boundary(bool *zero);
+  static void release_boundaries();
   signed long location_to_index(double, double, double, bool);
 
   void set_source(int, double, double, double, double, double, double);
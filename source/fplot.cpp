@@ -51,15 +51,20 @@
 #include "gate.h"
 #include "fplot.h"
 #include "simulation.h"
+#include "output.h"
+#include "packed.h"
+#include "stream.h"
+#include "snapshot.h"
 
 int    XmgrPlot::XMGR_STEPS         = 400;
-int    PlotObj::UPDATE_STEPS        = 600;
-int    PlotObj::UPDATE_STEPS_1D     = 200;
-int    PlotObj::UPDATE_STEPS_2D     = 200;
-int    PlotObj::UPDATE_STEPS_BINARY = 40;
-double PlotObj::UPDATE_ACCURACY     = 0.002; 
+thread_local int    PlotObj::UPDATE_STEPS        = 600;
+thread_local int    PlotObj::UPDATE_STEPS_1D     = 200;
+thread_local int    PlotObj::UPDATE_STEPS_2D     = 200;
+thread_local int    PlotObj::UPDATE_STEPS_BINARY = 40;
+thread_local double PlotObj::UPDATE_ACCURACY     = 0.002; 
+thread_local double PlotObj::UPDATE_TOLERANCE    = 0.0;
 
-extern char* globalLabelX;
+extern thread_local char* globalLabelX;
 
 #ifndef _NO_GLUT_
 
@@ -86,8 +91,8 @@ GLubyte* GlPlotObj::ColorRed   = NULL;
 GLubyte* GlPlotObj::ColorGreen = NULL;
 GLubyte* GlPlotObj::ColorBlue  = NULL;
 
-extern PlotArray* GluPlotArray;
-extern char scriptFileName[2048];
+extern thread_local PlotArray* GluPlotArray;
+extern thread_local char scriptFileName[2048];
 extern char* versionStr;
 
 //**************************************************************************************************
@@ -635,6 +640,9 @@ void    StateDump::draw()
    Sim->Export(fileName);
    };
 
+const double *StateDump::clock() { return &Sim->Gates->Time; }
+double        StateDump::due()   { return complete ? DBL_MAX : exportTime; }
+
 //*************************************************************************************
 //                M U T E    P L O T   D R A W
 //*************************************************************************************
@@ -647,46 +655,133 @@ MutePointPlot::MutePointPlot(double *ptr, double *tptr, char islog,  double maxT
     x_temp = x_value = -1e12;
     Time = tptr;
     f_temp = 0.0;
+    dense  = false;
     strcpy(fileName,fname);
-    file = fopenAssure(fname, "w", "plot", win_title);
+    file   = fopenAssure(fname, PointWriter::FORMAT ? "wb" : "w", "plot", win_title);
+    writer = new PointWriter(file, PointWriter::FORMAT);
 
-	bufferSize = long(UPDATE_STEPS * 1.5);
 	counter = 0;
-	Tbuffer = new double[bufferSize];
-	Ybuffer = new double[bufferSize];
+	Tbuffer = new double[ROLLBACK_SAMPLES];
+	Obuffer = new long long[ROLLBACK_SAMPLES];
+
+	tolerance = (UPDATE_TOLERANCE > 0.0) ? UPDATE_TOLERANCE : 0.0;
+	doors  = tolerance ? new PointDoor[ROLLBACK_SAMPLES] : 0;
+	closed = tolerance ? new PointDoor[ROLLBACK_SAMPLES] : 0;
+	seen   = 0;
+	memset(&door, 0, sizeof(door));
+    }
+
+MutePointPlot::~MutePointPlot()
+    {
+    if ( seen && door.tl > door.ta ) {   // the last sample drawn ends the last segment
+      double s = (door.fl - door.fa) / (door.tl - door.ta);
+      if (s < door.lo) s = door.lo; else if (s > door.hi) s = door.hi;
+      pushValue(door.tl, door.fa + s * (door.tl - door.ta));
+    }
+    delete writer;    // writes the buffered samples
+    fclose(file);
+    delete [] Tbuffer; delete [] Obuffer; delete [] doors; delete [] closed;
     }
 
 //*************************************************************************************
 
 void   MutePointPlot::pushValue(double t, double y)  {
 
-	fprintf(file, "%.10g %.10g \n", t, y);
-	Tbuffer[counter] = t;
-	Ybuffer[counter] = y;
+	long k = counter % ROLLBACK_SAMPLES;
+	Tbuffer[k] = t;
+	Obuffer[k] = writer->position();
+	writer->push(t, y);
 	counter ++;
+}
+
+//*************************************************************************************
+//  The swinging door (see fplot.h): when no line from the anchor passes within the
+//  tolerance of the new sample and of those before it, the segment is ended at the
+//  last sample, by the value of the line within the door nearest to it (which is then
+//  within the tolerance of that sample as well), and a new segment starts from there
+//*************************************************************************************
 
-	if (counter == bufferSize)  {
-		long bufferSizeNew = bufferSize + 100;
-		double *newT = new double [bufferSizeNew];
-		double *newY = new double [bufferSizeNew];
+void   MutePointPlot::compress(double t, double f)  {
 
-		if (VERBOSE > 5) fprintf(stderr, " >> Buffer size exceeded in MutePointPlot %s: increasing buffer size: %ld ==> %ld\n", fileName, bufferSize, bufferSizeNew);
-		
-		for (long i = 0; i < bufferSize; i++) 
-		{
-			newT[i] = Tbuffer[i];
-			newY[i] = Ybuffer[i];
+	if (!seen) {
+		closed[counter % ROLLBACK_SAMPLES].lo =  DBL_MAX;
+		closed[counter % ROLLBACK_SAMPLES].hi = -DBL_MAX;
+		pushValue(t, f);
+		door.ta = door.tl = t;
+		door.fa = door.fl = f;
+		door.lo = -DBL_MAX;  door.hi = DBL_MAX;
+	}
+	else if (t > door.ta) {
+		double dt = t - door.ta;
+		double lo = (f - tolerance - door.fa) / dt, hi = (f + tolerance - door.fa) / dt;
+		if (lo < door.lo) lo = door.lo;
+		if (hi > door.hi) hi = door.hi;
+		if (lo > hi) {                 // the door closes
+			closed[counter % ROLLBACK_SAMPLES] = door;
+			double s = (door.fl - door.fa) / (door.tl - door.ta);
+			if (s < door.lo) s = door.lo; else if (s > door.hi) s = door.hi;
+			door.fa += s * (door.tl - door.ta);
+			door.ta  = door.tl;
+			pushValue(door.ta, door.fa);
+			dt = t - door.ta;
+			if (dt <= 0.0) { seen = 0;  compress(t, f);  return; }   // at the end of a reopened segment
+			lo = (f - tolerance - door.fa) / dt;  hi = (f + tolerance - door.fa) / dt;
 		}
-		delete [] Tbuffer; delete [] Ybuffer;
-		Tbuffer = newT;  Ybuffer = newY;
-		bufferSize = bufferSizeNew;
+		door.lo = lo;  door.hi = hi;
+		door.tl = t;   door.fl = f;
 	}
+	else return;    // no later than the anchor
+	doors[seen++ % ROLLBACK_SAMPLES] = door;
+}
+
+//*************************************************************************************
+//  A back-step of a compressed plot resumes from the door after the last sample drawn
+//  before time t, and drops the samples written after its anchor (these are fewer than
+//  the samples drawn since, so their offsets are all kept)
+
+bool   MutePointPlot::restoreDoor(double t)  {
+
+	long k = seen, first = (seen > ROLLBACK_SAMPLES) ? seen - ROLLBACK_SAMPLES : 0;
+	while (k > first && doors[(k - 1) % ROLLBACK_SAMPLES].tl >= t) k--;
+	if (k == first) return false;
+
+	door = doors[(k - 1) % ROLLBACK_SAMPLES];
+	seen = k;
+	long j = counter, jfirst = (counter > ROLLBACK_SAMPLES) ? counter - ROLLBACK_SAMPLES : 0;
+	while (j > jfirst && Tbuffer[(j - 1) % ROLLBACK_SAMPLES] > door.ta) j--;
+	if (j < counter) writer->truncate(Obuffer[j % ROLLBACK_SAMPLES]);
+	counter = j;
+	return true;
+}
+
+//*************************************************************************************
+//  A back-step beyond the kept doors, once the samples written from time t on are
+//  dropped: the segment from the last sample kept is resumed with the door d of the
+//  segment across t (closed by the first sample dropped, or still open, or read back
+//  as the line between the two samples of the file around t), whose slopes are within
+//  eps of all the samples drawn since its anchor, and so of those before t; it is made
+//  to end at t, where the drawing resumes
+
+bool   MutePointPlot::reopenDoor(const PointDoor &d, double t)  {
+
+	if ( !(d.lo <= d.hi && d.ta < d.tl && d.ta < t) ) return false;   // no door (NAN), or a sample
+	                                                                  //  which starts a segment
+	door = d;
+	double s = (door.fl - door.fa) / (door.tl - door.ta);
+	if (s < door.lo) s = door.lo; else if (s > door.hi) s = door.hi;
+	door.tl = t;
+	door.fl = door.fa + s * (t - door.ta);
+	doors[0] = door;
+	seen = 1;
+	return true;
 }
 
 //*************************************************************************************
 
 void    MutePointPlot::draw()    // file remains open for the duration of simulation
    {
+   if ( dense && x_value > -1e12 ) return;  // only the initial point, the rest are dense-output samples
+
    double   f = get_value();
    if      (f > fmax) fmax = f; 
    else if (f < fmin) fmin = f;
@@ -694,15 +789,31 @@ void    MutePointPlot::draw()    // file remains open for the duration of simula
    if ( *Time < x_value && file != (FILE *)stdout  && file != (FILE *)stderr ) {  // do a back step
 
 	 if (VERBOSE > 5) fprintf(stderr, " >> Instability recovery: back step in MutePointPlot %s, time: %g ==> %g\n", fileName, x_value, *Time);
-	 rewind(file);
-     long cnt, cntOld = counter;
-	 counter = 0;
-
-	 for (cnt = 0; cnt < cntOld; cnt++)
-		 if (Tbuffer[cnt] < *Time)  pushValue(Tbuffer[cnt], Ybuffer[cnt]);
-		 else break;
+	 if ( !tolerance || !restoreDoor(*Time) ) {
+		 long k = counter, first = (counter > ROLLBACK_SAMPLES) ? counter - ROLLBACK_SAMPLES : 0;
+		 while (k > first && Tbuffer[(k - 1) % ROLLBACK_SAMPLES] >= *Time) k--;
+
+		 PointDoor across = door;         // the door of the segment across the back-step time
+		 if (!seen) { across.lo = DBL_MAX;  across.hi = -DBL_MAX; }
+		 if (k > first || (counter && !first && Obuffer[0] == writer->start())) {   // the samples from #k on are dropped
+			 if (k < counter) {
+				 writer->truncate(Obuffer[k % ROLLBACK_SAMPLES]);
+				 if (tolerance) across = closed[k % ROLLBACK_SAMPLES];
+			 }
+			 counter = k;
+		 }
+		 else {                           // beyond the kept samples: the file is read back
+			 double last[2] = { NAN, 0.0 }, next[2] = { NAN, 0.0 };
+			 writer->truncate( writer->locate(fileName, *Time, last, next) );
+			 counter = 0;
+			 across.ta = last[0];  across.fa = last[1];
+			 across.tl = next[0];  across.fl = next[1];
+			 across.lo = across.hi = (next[1] - last[1]) / (next[0] - last[0]);
+		 }
+		 if ( !tolerance || !reopenDoor(across, *Time) ) seen = 0;   // a compressed plot starts a new segment here
+	 }
    }                // end of back-step
-   else {
+   else if (!tolerance) {
        bool redrawFlag = ( int( *Time * tscale ) == int( x_value * tscale) )      ? false : true;
        bool newFlag    = ( fabs(f - f_value) <= (fmax - fmin) * UPDATE_ACCURACY ) ? false : true;
        bool tempFlag   = ( fabs(f - f_temp)  <= (fmax - fmin) * UPDATE_ACCURACY ) ? false : true;
@@ -713,14 +824,235 @@ void    MutePointPlot::draw()    // file remains open for the duration of simula
 
    f_value = f_temp = f;
    x_value = x_temp = *Time; 
-   pushValue(*Time, get_value() );
-   fflush(file); 
+   if (tolerance) compress(*Time, f);
+   else           pushValue(*Time, get_value() );
    }
 
+//*************************************************************************************
 
+void    MutePointPlot::sample()  // called at the dense-output times of the ODE integrator,
+   {                             // and at the end of each Run (unless it is a dense-output time)
+   if ( !dense || *Time - x_value <= 1e-12 * fabs(*Time) ) return;
+
+   double   f = get_value();
+   if      (f > fmax) fmax = f; 
+   else if (f < fmin) fmin = f;
+
+   f_value = f_temp = f;
+   x_value = x_temp = *Time; 
+   if (tolerance) compress(*Time, f);
+   else           pushValue(*Time, f);
+   }
+
+//*************************************************************************************
+//  Snapshot of the plot (see prefix.h): the samples are the bytes of the file written
+//  since the start of the simulation, which replace those of the importing plot
+//*************************************************************************************
+
+bool    MutePointPlot::exportState(FILE *f)
+   {
+   if (file == stdout || file == stderr) return false;   // cannot be read back
+
+   double state[13] = { fmin, fmax, f_value, x_value, f_temp, x_temp,
+                        door.ta, door.fa, door.lo, door.hi, door.tl, door.fl, double(seen ? 1 : 0) };
+   writeState(f, state, sizeof(state));
+   writer->exportSamples(f, fileName);
+   return true;
+   }
+
+void    MutePointPlot::importState(FILE *f)
+   {
+   double state[13];
+   readState(f, state, sizeof(state));
+   writer->importSamples(f);
+   counter = 0;
+
+   fmin    = state[0]; fmax    = state[1];
+   f_value = state[2]; x_value = state[3];
+   f_temp  = state[4]; x_temp  = state[5];
+
+   seen = 0;          // the segment in progress goes on; the earlier doors are not kept
+   if (tolerance && state[12]) {
+     door.ta = state[6];  door.fa = state[7];
+     door.lo = state[8];  door.hi = state[9];
+     door.tl = state[10]; door.fl = state[11];
+     doors[seen++] = door;
+   }
+   }
+
+//*************************************************************************************
+//  The window of the binary and 2D mute plots
+//*************************************************************************************
+
+FieldWindow::FieldWindow()
+{
+	int n[3] = { FieldObj::xsize, FieldObj::ysize, FieldObj::zsize };
+	for (int d = 0; d < 3; d++) { lo[d] = 0;  hi[d] = (d < DIMENSIONALITY) ? n[d] - 1 : 0; }
+	stride = 1;
+}
+
+bool FieldWindow::whole() const
+{
+	FieldWindow all;
+	for (int d = 0; d < 3; d++) if (lo[d] != all.lo[d] || hi[d] != all.hi[d]) return false;
+	return stride == 1;
+}
+
+//**********************************************
+//  "roi x0 x1 [y0 y1 [z0 z1]]" keeps the nodes whose coordinates are within the given
+//  ranges, and "stride n" every n-th node from the first one kept
+
+int FieldWindow::read(TokenString &TS, long pos)
+{
+	const double *grid[3]  = { FieldObj::xcoord, FieldObj::ycoord, FieldObj::zcoord };
+	const char   *label[3] = { LABEL_DIM1, LABEL_DIM2, LABEL_DIM3 };
+	long p = pos;
+
+	while (true) {
+		if ( equal(TS[p + 1], "roi") ) {
+			p++;
+			for (int d = 0; d < DIMENSIONALITY; d++) {
+				if ( isLineEnd(TS[p + 1]) || isLineEnd(TS[p + 2]) )
+					throw makeMessage("Expected %d pairs of coordinates after \"roi\"", DIMENSIONALITY);
+				double c0 = TS.get_double(++p), c1 = TS.get_double(++p);
+				if (c0 > c1) { double c = c0; c0 = c1; c1 = c; }
+				FieldWindow all;
+				lo[d] = all.lo[d];  hi[d] = all.hi[d];
+				while (lo[d] <= all.hi[d] && grid[d][lo[d]] < c0) lo[d]++;
+				while (hi[d] >= lo[d]     && grid[d][hi[d]] > c1) hi[d]--;
+				if (lo[d] > hi[d]) throw makeMessage("The region of interest %g..%g holds no nodes along %s", c0, c1, label[d]);
+			}
+		}
+		else if ( equal(TS[p + 1], "stride") ) {
+			p++;
+			if ( isLineEnd(TS[p + 1]) ) throw makeMessage("Expected the number of nodes after \"stride\"");
+			stride = TS.get_int(++p);
+			if (stride < 1) throw makeMessage("The stride of a plot should be positive, not %d", stride);
+		}
+		else break;
+	}
+	return int(p - pos);
+}
 
 //**********************************************
 
+void FieldWindow::coords(int d, double *c) const
+{
+	const double *grid = (d == 0) ? FieldObj::xcoord : (d == 1) ? FieldObj::ycoord : FieldObj::zcoord;
+	for (int i = 0; i < size(d); i++) c[i] = grid[lo[d] + i * stride];
+}
+
+void FieldWindow::gather(const double *field, double *w) const
+{
+	long xs = FieldObj::xsize, xys = FieldObj::xysize;
+	for (int iz = lo[2]; iz <= hi[2]; iz += stride)
+		for (int iy = lo[1]; iy <= hi[1]; iy += stride) {
+			const double *row = field + iz * xys + iy * xs;
+			if (stride == 1) { memcpy(w, row + lo[0], size(0) * sizeof(double));  w += size(0); }
+			else for (int ix = lo[0]; ix <= hi[0]; ix += stride) *(w++) = row[ix];
+		}
+}
+
+void FieldWindow::describe(char *s, size_t n) const
+{
+	if ( whole() ) return;
+	char t[256];
+	size_t k = snprintf(t, 255, ", nodes ");
+	for (int d = 0; d < DIMENSIONALITY; d++) k += snprintf(t + k, 255 - k, "%s%d..%d", d ? " x " : "", lo[d], hi[d]);
+	if (stride > 1) snprintf(t + k, 255 - k, " by %d", stride);
+	strncat(s, t, n - strlen(s) - 1);
+}
+
+//**********************************************
+
+void  FieldDump::draw()  {
+
+	if (field->Time < exportTime) { complete = false; return; }
+	if ( complete ) return;
+	complete = true;
+
+	FileJob *job = new FileJob(fileName, "wb", sizeof(long) + field->size * sizeof(double), "Vector export");
+	job->add(&field->size, sizeof(long));
+	job->add(field->elem,  field->size * sizeof(double));
+	OutputThread::post(job);
+}
+
+double FieldDump::due() { return complete ? DBL_MAX : exportTime; }
+
+//**********************************************
+
+void  FieldDumpT::header(FILE *ff) {
+
+	int    size[3];
+	double *coord[3];
+	for (int d = 0; d < 3; d++) {
+		size[d]  = window.size(d);
+		coord[d] = new double[size[d]];
+		window.coords(d, coord[d]);
+	}
+
+	packing = 0;
+	if (PackedWriter::VALUES) {
+		packing = new PackedLayout;
+		packing->geometry = GEOMETRY;
+		for (int d = 0; d < 3; d++) packing->size[d] = size[d];
+		packing->brick    = PackedWriter::BRICK;
+		packing->values   = PackedWriter::VALUES;
+		packing->error    = (PackedWriter::VALUES < 0) ? PackedWriter::ERROR : 0.0;
+		PackedWriter::header(ff, *packing, (const double **)coord);
+	}
+	else {
+		fwrite( (void *)(&GEOMETRY), sizeof(int), 1, ff);
+		for (int d = 0; d < DIMENSIONALITY; d++) fwrite( (void *)(&size[d]), sizeof(int),    1,       ff);
+		for (int d = 0; d < DIMENSIONALITY; d++) fwrite( (void *)(coord[d]), sizeof(double), size[d], ff);
+	}
+	for (int d = 0; d < 3; d++) delete [] coord[d];
+}
+
+FieldDumpT::~FieldDumpT() {
+
+	dump();
+	delete [] frameTime;
+	delete [] part;
+	delete packing;
+}
+
+//**********************************************
+
+void  FieldDumpT::dump() {
+
+	if (frames == maxFrames) {
+		double *t = new double[2 * maxFrames];
+		for (long i = 0; i < frames; i++) t[i] = frameTime[i];
+		delete [] frameTime;
+		frameTime  = t;
+		maxFrames *= 2;
+	}
+	long long offset = headerSize + frames * frameSize;
+	frameTime[frames++] = field->Time;
+
+	const double *values = field->elem;
+	if (part) { window.gather(field->elem, part); values = part; }
+
+	if (packing) {   // compressed on the output thread, which also indexes the frame
+		PackedWriter::post(fileName, indexName, *packing, field->Time, values);
+		return;
+	}
+	FileJob *job = new FileJob(fileName, "ab", frameSize, "continuous field dump");
+	job->add(&field->Time, sizeof(double));
+	job->add(values,       window.count() * sizeof(double));
+	OutputThread::post(job);
+
+	job = new FileJob(indexName, "ab", sizeof(double) + sizeof(long long), "continuous field dump index");
+	job->add(&field->Time, sizeof(double));
+	job->add(&offset,      sizeof(long long));
+	OutputThread::post(job);
+}
+
+//**********************************************
+//  A back-step keeps the frames preceding the new time, found by a binary search
+//  over the frame times, and truncates the file and its index after them
+
 void  FieldDumpT::draw()  {
 
 	if (field->Time >= oldTime) {
@@ -734,76 +1066,103 @@ void  FieldDumpT::draw()  {
 
 		 if (VERBOSE > 5) fprintf(stderr, " >> Instability recovery: back step in FieldDump %s, time: %g ==> %g\n", fileName, oldTime, field->Time);
 		 oldTime = field->Time;
-		 
-		 long seed = long(time(NULL) + oldTime*10000 + newTime * 10000);
-		 srand(seed);
-
-		 char tempFileName[512];     
-	     snprintf(tempFileName, 511, "plotTempBinFile%ld", long(rand()*1000000000) );
-
-		 double tempTime;
-		 double *buffer;
-		 buffer = new double[field->size + 1];
-
-		 FILE *temp = fopenAssure(tempFileName, "wb", "plot",  win_title);
-		 file       = fopenAssure(fileName,     "rb", "plot",  win_title);
-
-		 header(temp);
-		 chuckHeader(file, buffer);
 
-		 while (!feof(file)) {
-		   fread ( (void *)&tempTime, sizeof(double), 1,           file);
-		   fread ( (void *)buffer,    sizeof(double), field->size, file);
-		   if (feof(file) || tempTime >= oldTime) break;
-		   fwrite( (void *)&tempTime, sizeof(double), 1,           temp);
-	       fwrite( (void *)buffer,    sizeof(double), field->size, temp);
+		 long lo = 0, hi = frames;          // the first frame at or after the new time
+		 while (lo < hi) {
+			 long mid = (lo + hi) / 2;
+			 if (frameTime[mid] < oldTime) lo = mid + 1; else hi = mid;
 		 }
-		 fclose(temp); fclose(file);
-		 
-		 temp = fopenAssure(fileName,     "wb", "plot",  win_title);
-		 file = fopenAssure(tempFileName, "rb", "plot",  win_title);
-		 header(temp);
-		 chuckHeader(file, buffer);
-
-		 while (!feof(file)) {
-			   fread ( (void *)&tempTime, sizeof(double), 1,           file);
-			   fread ( (void *)buffer,    sizeof(double), field->size, file);
-			   if (feof(file) ) break;
-			   fwrite( (void *)&tempTime, sizeof(double), 1,           temp);
-			   fwrite( (void *)buffer,    sizeof(double), field->size, temp);
+		 frames = lo;
+		 if (packing) PackedWriter::trim(fileName, indexName, frames);
+		 else {
+			 OutputThread::post( new TruncateJob(fileName,  headerSize + frames * frameSize) );
+			 OutputThread::post( new TruncateJob(indexName, frames * (long long)(sizeof(double) + sizeof(long long))) );
 		 }
-		 fclose(temp); fclose(file); remove(tempFileName);
-		 delete [] buffer; 
 
 		 dump();
 	} // end back-step
 }
 	 
 	 
+//*************************************************************************************
+//  A row of a 1D plot, formatted and written to its file on the output thread; the
+//  file and the coordinates belong to the plot, which waits for the thread before
+//  it closes the file
 //*************************************************************************************
 
-void  MutePlot1D::pushRow(double t, double *f, int cols)
-{	
-	if (counter >= bufferSize) {
-		if (VERBOSE > 5) fprintf(stderr, "*** Warning: too many writes to MutePlot1D %s (time=%g, count %ld); overwriting last values\n", win_title, t, counter);
-		counter--;
+class RowJob : public OutputJob
+{
+	FILE   *file;
+	double t;
+	const double *coord;
+	long   num;
+	int    cols;
+	long long *start; // receives the offset of the row in the file
+
+public:
+
+	RowJob(FILE *f, double time, const double *x, const double *values, long n, int columns, long long *offset) :
+	  OutputJob(n * sizeof(double)), file(f), t(time), coord(x), num(n), cols(columns), start(offset)
+	  {  memcpy(data, values, n * sizeof(double));  }
+
+	void write() {
+		const double *f = (const double *)data;
+		*start = ftell64(file);
+		for (long i = 0; i < num; i++) {
+			if (cols == 2)
+				 fprintf(file,"%.6g  %.9g \n", coord[i], f[i]);
+			else fprintf(file,"%.6g  %.6g  %.9g \n", t, coord[i], f[i]);
+		}
+		fprintf(file,"\n");
+		fflush(file);
 	}
+};
+
+//*************************************************************************************
+
+MutePlot1D::~MutePlot1D() {
+
+	OutputThread::wait(false);
+	delete [] Tbuffer;  delete [] Obuffer;
+	if (file) fclose(file);
+}
+
+//*************************************************************************************
 
-	Tbuffer[counter] = t;
+void  MutePlot1D::pushRow(double t, double *f, int cols)
+{	
+	long k = counter % ROLLBACK_SAMPLES;
+	Tbuffer[k] = t;
 	if (file == 0)  file = fopenAssure(fileName, "w", "plot", win_title);
 
+	OutputThread::post( new RowJob(file, t, coord, f, num, cols, Obuffer + k) );
+	counter++;
+}
 
-       for (int i = 0; i < num; i++) 
-	   {
-			Ybuffer[counter * num + i] = f[i];
-			if (cols == 2)
-				 fprintf(file,"%.6g  %.9g \n", coord[i], f[i]);
-			else fprintf(file,"%.6g  %.6g  %.9g \n", t, coord[i], f[i]);
-	   }
+//*************************************************************************************
+//  Reads the rows back from the file (a back-step beyond the kept rows); "last" gets
+//  the time of the last row before t, if there is one
+//*************************************************************************************
+
+long long MutePlot1D::locate(double t, double *last)
+{
+	char line[256];
+	long long offset = 0;
+	bool first  = true;
 
-	fprintf(file,"\n");
 	fflush(file);
-	counter++;
+	t -= 1e-5 * fabs(t);          // the times are printed with 6 digits
+	FILE *f = fopenAssure(fileName, "rb", "reading back", win_title);
+	while ( fgets(line, sizeof(line), f) ) {
+		if (line[0] == '\n' || line[0] == '\r') { offset = ftell64(f); first = true; continue; }
+		if (!first) continue;
+		double time = atof(line);
+		if (time >= t) break;
+		*last = time;
+		first = false;
+	}
+	fclose(f);
+	return offset;
 }
 
 //*************************************************************************************
@@ -826,12 +1185,19 @@ void MutePlot1D::draw() {
    else if ( t < x_value && !equal(fileName,"stdout")  && !equal(fileName,"stderr") ) 
    {  // do a back step
 	 if (VERBOSE > 5) fprintf(stderr, " >> Instability recovery: back step in file plot %s, time: %g ==> %g\n", fileName, x_value, t);
-	 long cnt, cntOld = counter;
-	 counter = 0;
-	 rewind(file);
-	 for (cnt = 0; cnt < cntOld; cnt++)
-		 if (Tbuffer[cnt] < t) pushRow(x_value = Tbuffer[cnt], Ybuffer + cnt * num, 3);
-		 else break;
+	 OutputThread::wait();         // the offsets of the rows are known
+	 long k = counter, first = (counter > ROLLBACK_SAMPLES) ? counter - ROLLBACK_SAMPLES : 0;
+	 while (k > first && Tbuffer[(k - 1) % ROLLBACK_SAMPLES] >= t) k--;
+
+	 if (k > first || (counter && !first && Obuffer[0] == 0)) {    // the rows from #k on are dropped
+		 if (k < counter) truncateFile(file, Obuffer[k % ROLLBACK_SAMPLES]);
+		 if (k > 0) x_value = Tbuffer[(k - 1) % ROLLBACK_SAMPLES];
+		 counter = k;
+	 }
+	 else {
+		 truncateFile(file, locate(t, &x_value));
+		 counter = 0;
+	 }
    }    // if no back-step is required:
    else if ( int(t * tscale) > int(x_value * tscale) )
        {
@@ -844,6 +1210,98 @@ void MutePlot1D::draw() {
 
 }
 
+//*************************************************************************************
+//  The first time at which draw() writes a row: the tests of draw() are repeated on
+//  the neighbouring doubles, so that the time is exact rather than rounded
+//*************************************************************************************
+
+double MutePlot1D::due() {
+
+   if (UPDATE_STEPS_1D == 1) {
+     if ( complete ) return DBL_MAX;
+     double t = exportTime - 1e-20;
+     while (!(t + 1e-20 < exportTime)) t = nextafter(t, -DBL_MAX);
+     while (  t + 1e-20 < exportTime ) t = nextafter(t,  DBL_MAX);
+     return t;
+   }
+
+   int    k = int(x_value * tscale);
+   double t = (k + 1.0) / tscale;
+   while (int(t * tscale) >  k) t = nextafter(t, -DBL_MAX);
+   while (int(t * tscale) <= k) t = nextafter(t,  DBL_MAX);
+   return t;
+}
+
+//*************************************************************************************
+
+bool MutePlot1D::exportState(FILE *f) {
+
+   if ( equal(fileName,"stdout") || equal(fileName,"stderr") ) return false;   // cannot be read back
+
+   OutputThread::wait();
+   long long end = 0;
+   if (file) { fflush(file); end = ftell64(file); }
+   writeState(f, &x_value,  sizeof(double));
+   writeState(f, &complete, sizeof(bool));
+   exportFile(f, fileName, 0, end);
+   return true;
+}
+
+void MutePlot1D::importState(FILE *f) {
+
+   readState(f, &x_value,  sizeof(double));
+   readState(f, &complete, sizeof(bool));
+   OutputThread::wait();
+   importFile(f, file, fileName, 0);
+   counter = 0;
+}
+
+//*************************************************************************************
+//  A plane of a 2D plot: the coordinates are followed by the values, and the
+//  file is written on the output thread
+//*************************************************************************************
+
+class PlaneJob : public OutputJob
+{
+	char fileName[512], title[512];
+	long num1, num2;
+
+public:
+
+	PlaneJob(const char *fname, const char *WinTitle, long n1, long n2) :
+	  OutputJob((n1 + n2 + n1 * n2) * sizeof(double)), num1(n1), num2(n2)
+	  {  strcpy(fileName, fname);  strcpy(title, WinTitle);  }
+
+	void write() {
+		const double *x = (const double *)data, *y = x + num1, *f = y + num2;
+		FILE *file = fopenAssure(fileName, "w", "plot", title);
+		for (int j = 0; j < num2; j++) {
+			for (int i = 0; i < num1; i++) fprintf(file,"%.6g %.6g %.9g \n", x[i], y[j], f[j * num1 + i]);
+			fprintf(file,"\n");
+		}
+		if (file != stdout && file != stderr) fclose(file);
+	}
+};
+
+void MutePlot2D::draw()
+{  
+	if (field->Time < exportTime) { complete = false; return; }
+	if ( complete ) return;
+	complete = true;
+
+	int      n1 = window.size(axis1), n2 = window.size(axis2), s = window.stride;
+	int      i0 = window.lo[axis1],   j0 = window.lo[axis2];
+	PlaneJob *job = new PlaneJob(fileName, win_title, n1, n2);
+	double   *x = (double *)job->data, *y = x + n1, *f = y + n2;
+	for (int i = 0; i < n1; i++) x[i] = coord1[i0 + i * s];
+	for (int j = 0; j < n2; j++) y[j] = coord2[j0 + j * s];
+	for (int j = 0; j < n2; j++)
+		for (int i = 0; i < n1; i++) f[j * n1 + i] = get_value(field_index + (j0 + j * s) * incr2 + (i0 + i * s) * incr1);
+	OutputThread::post(job);
+}
+
+double MutePlot2D::due() { return complete ? DBL_MAX : exportTime; }
+
 //*************************************************************************************
 //                   G L   F I E L D    P L O T   1 D  
 //*************************************************************************************
@@ -922,6 +1380,7 @@ FieldPlot2D::FieldPlot2D(FieldObj *f, char islog, const char *dir, double coord)
             coord1= FieldObj::ycoord; coord2 = FieldObj::zcoord;
             incr1 = FieldObj::xsize;  incr2  = FieldObj::xysize; 
             num1  = FieldObj::ysize;  num2   = FieldObj::zsize;
+            axis1 = 1;                axis2  = 2;
 			for (iy = 0; iy < field->ysize && si == -1; iy++)
 				for (iz = 0; iz < field->zsize && si == -1; iz++)
 					si = field->location_to_index(coord, coord1[iy], coord2[iz], 0);
@@ -938,6 +1397,7 @@ FieldPlot2D::FieldPlot2D(FieldObj *f, char islog, const char *dir, double coord)
             coord1 = FieldObj::xcoord;  coord2 = FieldObj::zcoord;
             incr1  = 1;                 incr2  = FieldObj::xysize; 
             num1   = FieldObj::xsize;   num2   = FieldObj::zsize;
+            axis1  = 0;                 axis2  = 2;
             for (ix = 0; ix < field->xsize && si == -1; ix++)
 				for (iz = 0; iz < field->zsize && si == -1; iz++)
 					si = field->location_to_index(coord1[ix], coord, coord2[iz], 0);
@@ -954,6 +1414,7 @@ FieldPlot2D::FieldPlot2D(FieldObj *f, char islog, const char *dir, double coord)
             coord1 = FieldObj::xcoord; coord2 = FieldObj::ycoord;
             incr1  = 1;                incr2  = FieldObj::xsize; 
             num1   = FieldObj::xsize;  num2   = FieldObj::ysize;
+            axis1  = 0;                axis2  = 1;
             for (ix = 0; ix < field->xsize && si == -1; ix++)
 				for (iy = 0; iy < field->ysize && si == -1; iy++)
 					si = field->location_to_index(coord1[ix], coord2[iy], coord, 0);
@@ -1962,6 +2423,103 @@ int    grid;
   }
 
 
+//*************************************************************************************
+//                       S T R E A M   P L O T S   (see stream.h)
+//*************************************************************************************
+
+StreamPlot::StreamPlot(PlotSink *s, const double *clock, int steps, double total)
+{
+	sink   = s;
+	id     = 0;
+	time   = clock;
+	tscale = double(steps) / (total > 0.0 ? total : 1.0);
+	sent   = -1.0 / tscale;     // the first frame is sent at the start
+}
+
+bool StreamPlot::ready()
+{
+	double t = *time;
+	if (t >= sent && floor(t * tscale) <= floor(sent * tscale)) return false;
+	sent = t;
+	return true;
+}
+
+double StreamPlot::nextFrame()    // exact, as in MutePlot1D::due()
+{
+	double k = floor(sent * tscale), t = (k + 1.0) / tscale;
+	while (floor(t * tscale) >  k) t = nextafter(t, -DBL_MAX);
+	while (floor(t * tscale) <= k) t = nextafter(t,  DBL_MAX);
+	return t;
+}
+
+//*************************************************************************************
+
+StreamPointPlot::StreamPointPlot(PlotSink *s, double *ptr, double *tptr, char islog, double T, const char *WinTitle) :
+	PlotObj(ptr, islog), StreamPlot(s, tptr, UPDATE_STEPS, T)
+{
+	char title[512];
+	snprintf(title, 511, "%s%s", islog ? "log " : "", WinTitle);
+	id = sink->title(title, 1);
+	snprintf(win_title, 511, "%.490s (streamed)", title);
+}
+
+void StreamPointPlot::draw()
+{
+	if ( !ready() || !sink->listening() ) return;
+	double v = get_value();
+	sink->send(id, sent, &v, 1);
+}
+
+//*************************************************************************************
+
+StreamPlot1D::StreamPlot1D(PlotSink *s, FieldObj *f, char islog, const char *dir, double coord1, double coord2, double T) :
+	FieldPlot1D(f, islog, dir, coord1, coord2), StreamPlot(s, &f->Time, UPDATE_STEPS_1D, T)
+{
+	char title[512];
+	snprintf(title, 511, "%s%.500s", islog ? "log " : "", win_title);
+	id = sink->title(title, int(num));
+	sink->axis(id, 0, coord, int(num));
+	values = new double[num];
+	snprintf(win_title, 511, "%.490s (streamed)", title);
+}
+
+void StreamPlot1D::draw()
+{
+	if ( !ready() || !sink->listening() ) return;
+	long ind = field_index;
+	for (int i = 0; i < num; i++, ind += incr) values[i] = get_value(ind);
+	sink->send(id, sent, values, int(num));
+}
+
+//*************************************************************************************
+
+StreamPlot2D::StreamPlot2D(PlotSink *s, FieldObj *f, char islog, const char *dir, double coord, double T,
+	const FieldWindow &w) : FieldPlot2D(f, islog, dir, coord), StreamPlot(s, &f->Time, UPDATE_STEPS_2D, T), window(w)
+{
+	int  n1 = window.size(axis1), n2 = window.size(axis2);
+	char title[512];
+	snprintf(title, 511, "%s%.500s", islog ? "log " : "", win_title);
+	window.describe(title, 512);
+	id = sink->title(title, n1 * n2);
+
+	values = new double[long(n1) * n2];
+	for (int i = 0; i < n1; i++) values[i] = coord1[window.lo[axis1] + i * window.stride];
+	sink->axis(id, 0, values, n1);
+	for (int j = 0; j < n2; j++) values[j] = coord2[window.lo[axis2] + j * window.stride];
+	sink->axis(id, 1, values, n2);
+	snprintf(win_title, 511, "%.490s (streamed)", title);
+}
+
+void StreamPlot2D::draw()
+{
+	if ( !ready() || !sink->listening() ) return;
+	int n1 = window.size(axis1), n2 = window.size(axis2), s = window.stride;
+	int i0 = window.lo[axis1],   j0 = window.lo[axis2];
+	for (int j = 0; j < n2; j++)
+		for (int i = 0; i < n1; i++) values[j * n1 + i] = get_value(field_index + (j0 + j * s) * incr2 + (i0 + i * s) * incr1);
+	sink->send(id, sent, values, n1 * n2);
+}
+
   //*************************************************************************************
   //   T O K E N - S T R I N G   C O N S T R U C T O R   F O R   P L O T   A R R A Y
   //*************************************************************************************
@@ -1982,11 +2540,12 @@ int    grid;
 	  int n2D   = TS.token2_count("plot", "2D") + TS.token2_count("plot", "2D.log");
 
 	  int npoint = Total - mutes - n1D - n2D;
+	  int streams = 0;
 
 	  char smethod[10];
 	  strcpy(smethod, "");
 
-	  if (TS.token_count(LOOP_TOKEN)) {
+	  if (TS.token_count(LOOP_TOKEN) || TS.token_count("sweep.table")) {
 		  graphs = 0;
 		  method = METHOD_MUTE;
 	  }
@@ -2017,6 +2576,30 @@ int    grid;
 		  }
 #endif
 		  else method = METHOD_MUTE;
+
+		  if (TS.token_count("plot.stream") || TS.token_count("plot.shm")) {   // the point, 1D and 2D plots are streamed as well (see stream.h, snapshot.h)
+			  char path[MAX_STRING_LENGTH] = "";
+			  for (int i = 1; i <= TS.token_count("plot"); i++) {
+				  long pos = TS.token_index("plot", i) + 1;
+				  if (!equal_(TS[pos], "1D") && !equal_(TS[pos], "2D") && !equal_(TS[pos], "dump") &&
+					  !equal_(TS[pos], "binary") && !equal_(TS[pos], "mute"))
+					  streams += TS.tokens_to_eol(pos);
+			  }
+			  streams += n1D + n2D;
+			  if (TS.token_count("plot.stream")) {
+				  TS.get_string_param("plot.stream", path);
+				  try { sink[sinks++] = new StreamSink(path); }
+				  catch (char *str) { TS.errorMessage(TS.token_index("plot.stream", 1), str, "Cannot open the plot stream"); }
+			  }
+			  if (TS.token_count("plot.shm")) {
+				  int slots = 64;
+				  TS.get_int_param("plot.shm.slots", &slots);
+				  TS.get_string_param("plot.shm", path);
+				  try { sink[sinks++] = new SnapshotRing(path, slots); }
+				  catch (char *str) { TS.errorMessage(TS.token_index("plot.shm", 1), str, "Cannot set up the snapshot ring"); }
+			  }
+			  streams *= sinks;
+		  }
 	  }
 
 	  if (TS.token_count("plot.print")) {
@@ -2032,9 +2615,12 @@ int    grid;
 				  mutes += TS.tokens_to_eol(pos);
 	  }
 
-	  int total = graphs + mutes;
+	  int total = graphs + mutes + streams;
 
-	  if (VERBOSE)
+	  if (VERBOSE && streams)
+		  fprintf(stderr, "\n### Setting up %d plots (%d %s graphs plus %d disc dumps and %d streamed):\n",
+			  total, graphs, smethod, mutes, streams);
+	  else if (VERBOSE)
 		  fprintf(stderr, "\n### Setting up %d plots (%d %s graphs plus %d disc dumps):\n",
 			  total, graphs, smethod, mutes);
 
@@ -2054,7 +2640,12 @@ int    grid;
 
 	  count = plot_num = 0;
 	  gl_on = 0;
+	  denseDt = 0;
 	  array = NULL;
+	  sinks = 0;
+	  polled = heap = drawing = 0;
+	  dueTime = 0;
+	  planned = false;
 
 	  TokenString *params = SO.Params;
 	  plot_num = get_plot_num( *params );
@@ -2067,6 +2658,10 @@ int    grid;
 	  params->get_int_param("plot.steps.1D",        &PlotObj::UPDATE_STEPS_1D);
 	  params->get_int_param("plot.steps.2D",        &PlotObj::UPDATE_STEPS_2D);
 	  params->    get_param("plot.update.accuracy", &PlotObj::UPDATE_ACCURACY);
+	  params->    get_param("plot.tolerance",       &PlotObj::UPDATE_TOLERANCE);
+	  PointWriter::setFormat(*params);
+	  OutputThread::setMode(*params);
+	  PackedWriter::setFormat(*params);
 
 	  strcpy(fileName,"");
 	  strcpy(prefix,"temp");
@@ -2137,6 +2732,9 @@ int    grid;
 						  else snprintf(fileName, 2047, "%s%s", prefix, VarID);
 						  array[count++] = new MutePointPlot(kin_ptr, time_ptr, log_plot, SimTime, fileName, VarID);
 					  }
+					  if (time_ptr && !equal(ptype, "mute"))
+						  for (int k = 0; k < sinks; k++)
+							  array[count++] = new StreamPointPlot(sink[k], kin_ptr, time_ptr, log_plot, SimTime, VarID);
 				  }  //@@@@@@@@@@@@@@@@@  END SET CYCLE OVER POINT PLOT SETS @@@@@@@@@@@@@@@@@@@
 
 			  }
@@ -2154,6 +2752,8 @@ int    grid;
 
 				  if (equal_(ptype, "2D")) {
 					  if (DIMENSIONALITY < 2) throw StrCpy("Cannot make a 2D plot of a 1-dimensional field");
+					  FieldWindow window;   // "roi" and "stride" options of the mute plot
+					  POS += window.read(*params, POS);
 					  strcpy(dir, "z"); // default direction for 2D plots in 2D geometry 
 					  coord1 = 0.0;
 					  if (DIMENSIONALITY > 2) POS += params->trail_pars(POS, 'S', dir, 'd', &coord1, 'E');
@@ -2164,7 +2764,7 @@ int    grid;
 							  params->trail_pars(POS, 'd', &tt, 'e'); //'s', fileName, 'E');
 							  params->line_string(POS + 1, fileName);
 						  }
-						  array[count] = new MutePlot2D(field, log_plot, dir, coord1, tt, fileName);
+						  array[count] = new MutePlot2D(field, log_plot, dir, coord1, tt, fileName, window);
 						  if (!equal(ptype, "2D.mute")) {
 							  snprintf(fileName, 2047, "%s%s", prefix, array[count]->win_title);
 							  strcpy(((MutePlot2D*)array[count])->fileName, fileName);
@@ -2186,6 +2786,9 @@ int    grid;
 						  params->trail_pars(POS, 'd', &theta, 'd', &factor, 'i', &bins, 'E');
 						  array[count++] = new Xmgr2Dplot(field, log_plot, dir, coord1, SimTime, theta, factor, bins);
 					  }
+					  if (equal(ptype, "2D"))
+						  for (int k = 0; k < sinks; k++)
+							  array[count++] = new StreamPlot2D(sink[k], field, log_plot, dir, coord1, SimTime, window);
 				  }
 				  else if (equal(ptype, "dump"))
 				  {
@@ -2196,9 +2799,11 @@ int    grid;
 				  }
 				  else if (equal(ptype, "binary"))
 				  {
+					  FieldWindow window;
+					  POS += window.read(*params, POS);
 					  params->line_string(POS + 1, fileName);
 					  //params->trail_pars(POS, 's', fileName);
-					  array[count++] = new FieldDumpT(field, SimTime, fileName);
+					  array[count++] = new FieldDumpT(field, SimTime, fileName, window);
 				  }
 				  else if (equal_(ptype, "1D"))
 				  {
@@ -2231,6 +2836,9 @@ int    grid;
 						  }
 						  count++;
 					  }
+					  if (equal(ptype, "1D"))
+						  for (int k = 0; k < sinks; k++)
+							  array[count++] = new StreamPlot1D(sink[k], field, log_plot, dir, coord1, coord2, SimTime);
 				  } // endif 1D plot
 				  else
 				  {         // ignore some plots depending on plot_method
@@ -2259,17 +2867,123 @@ int    grid;
 	  if (gl_on) GluPlotArray = this;
 #endif
 
+	  for (int k = 0; k < sinks; k++)      // the titles of the streamed plots are all known now
+		  try { sink[k]->start(); }
+		  catch (char* str) { params->errorMessage( params->token_index("plot.shm", 1), str, "Cannot set up the snapshot ring"); }
+
 	  // ****************   end loop over plot number
   }
 
 //*************************************************************************************
 //*************************************************************************************
   
+//*************************************************************************************
+//  The schedule of the plots (see PlotObj::clock): a binary heap of the plot numbers,
+//  by their due times
+//*************************************************************************************
+
+void PlotArray::plan()
+{
+	delete [] polled;  delete [] heap;  delete [] drawing;  delete [] dueTime;
+	polled  = new int[count + 1];
+	heap    = new int[count + 1];
+	drawing = new int[count + 1];
+	dueTime = new double[count + 1];
+	polledNum = heapNum = 0;
+	reference = 0;
+
+	for (int i = 0; i < count; i++)
+		if ( !array[i]->clock() ) polled[polledNum++] = i;
+		else {
+			if (!reference) reference = array[i]->clock();
+			heap[heapNum++] = i;   // drawn, and queued, by the first draw_all()
+		}
+	lastTime = DBL_MAX;
+	planned  = true;
+}
+
+void PlotArray::push(int plot)
+{
+	int k = heapNum++;
+	while (k > 0 && dueTime[heap[(k - 1) / 2]] > dueTime[plot]) { heap[k] = heap[(k - 1) / 2]; k = (k - 1) / 2; }
+	heap[k] = plot;
+}
+
+int PlotArray::pop()
+{
+	int top = heap[0], last = heap[--heapNum], k = 0;
+	while (2 * k + 1 < heapNum) {
+		int c = 2 * k + 1;
+		if (c + 1 < heapNum && dueTime[heap[c + 1]] < dueTime[heap[c]]) c++;
+		if (dueTime[heap[c]] >= dueTime[last]) break;
+		heap[k] = heap[c];
+		k = c;
+	}
+	if (heapNum) heap[k] = last;
+	return top;
+}
+
+double PlotArray::due()
+{
+	if (!planned) plan();
+	return (heapNum && lastTime < DBL_MAX) ? dueTime[heap[0]] : DBL_MAX;
+}
+
+//*************************************************************************************
+//  The due plots are drawn in the order of the array, along with the polled ones. The
+//  clocks of the scheduled plots (the times of the fields and of the ODEs) may differ
+//  by rounding, so the heap is taken with a margin, and each plot is checked by its own
+
+void PlotArray::draw_all()
+{
+	if (!count) return;
+	if (!planned) plan();
+
+	int n = 0;
+	bool all = false;
+	if (reference) {
+		double t = *reference;
+		if (t < lastTime) {              // the first call, or a back-step
+			for (int k = 0; k < heapNum; k++) drawing[n++] = heap[k];
+			heapNum = 0;
+			all = true;
+		}
+		else {
+			double margin = 1e-9 * fabs(t);
+			while (heapNum && dueTime[heap[0]] <= t + margin) drawing[n++] = pop();
+		}
+		lastTime = t;
+	}
+	for (int j = 1; j < n; j++) {         // in increasing order
+		int p = drawing[j], k = j;
+		for ( ; k > 0 && drawing[k - 1] > p; k--) drawing[k] = drawing[k - 1];
+		drawing[k] = p;
+	}
+
+	int i = 0, j = 0;
+	while (i < polledNum || j < n) {
+		if (j == n || (i < polledNum && polled[i] < drawing[j])) array[polled[i++]]->draw();
+		else {
+			int p = drawing[j++];
+			if ( all || dueTime[p] <= *array[p]->clock() ) array[p]->draw();
+		}
+	}
+	for (j = 0; j < n; j++) {
+		dueTime[drawing[j]] = array[drawing[j]]->due();
+		push(drawing[j]);
+	}
+}
+
+//*************************************************************************************
+
 PlotArray::~PlotArray()  { 
 
-  if (!count) return;
+  delete [] polled;  delete [] heap;  delete [] drawing;  delete [] dueTime;
+  if (!count) { for (int k = 0; k < sinks; k++) delete sink[k];  return; }
   for (int i = 0; i < count; i++) delete array[i]; 
   delete [] array;
+  for (int k = 0; k < sinks; k++) delete sink[k];
+  OutputThread::wait(false);   // an error of the output thread is thrown by OutputThread::stop()
 }
 
 //*************************************************************************************
@@ -53,6 +53,8 @@
 #define METHOD_XMGR 1
 #define METHOD_MUTE 2
 
+#define ROLLBACK_SAMPLES 1024   // the last samples (rows) of a mute plot whose file offsets are kept for a back-step
+
 #define XMGR_DIVISIONS 6
 
 #define xmgr_dxmargin 0.12
@@ -119,11 +121,12 @@ class PlotObj
 protected:
 public:
 
-  static int    UPDATE_STEPS;
-  static int    UPDATE_STEPS_1D;
-  static int    UPDATE_STEPS_2D;
-  static int    UPDATE_STEPS_BINARY;
-  static double UPDATE_ACCURACY;
+  static thread_local int    UPDATE_STEPS;
+  static thread_local int    UPDATE_STEPS_1D;
+  static thread_local int    UPDATE_STEPS_2D;
+  static thread_local int    UPDATE_STEPS_BINARY;
+  static thread_local double UPDATE_ACCURACY;
+  static thread_local double UPDATE_TOLERANCE;   // "plot.tolerance" of the mute point plots (0 = off)
   
   char    win_title[512];
   char    log_plot;
@@ -145,6 +148,18 @@ public:
 
   virtual void draw() = 0;
   virtual void redraw() = 0;
+  virtual void sample() { }               // record a dense-output sample (see PlotArray::denseDt)
+  virtual void setDense(bool) { }
+
+  // A plot with a clock is drawn only when the clock reaches the time returned by due(),
+  // at which draw() next has something to do (or on a back-step, see PlotArray::draw_all);
+  // a plot without one is drawn at every step
+
+  virtual const double *clock() { return 0; }
+  virtual double due() { return 0.0; }
+
+  virtual bool exportState(FILE *) { return false; }  // snapshot of the plot at the end of a "Run" (see
+  virtual void importState(FILE *) { }                //  prefix.h); false if the plot does not support it
 
   virtual double get_value(long ind = 0)
    {
@@ -184,6 +199,10 @@ public:
 
  void    draw();
  void    redraw() { draw(); }
+ bool    exportState(FILE *) { return !complete || exportTime <= 0.0; }  // a dump written during the run is not replayed
+
+ const double *clock();
+ double  due();
 };
 
 //*******************************************************************************
@@ -285,6 +304,18 @@ public:
 //*******************************************************************************
 //               C L A S S   M U T E   P O I N T   P L O T
 //*******************************************************************************
+//  With "plot.tolerance = eps", the samples are compressed by a swinging door: a
+//  sample is written only when the line from the last one written can no longer
+//  pass within eps of all the samples since, so that the piecewise-linear curve
+//  through the samples written is within eps of every sample drawn (of its log10
+//  for a log plot). This replaces the "plot.update" rules for these plots
+
+struct PointDoor
+{
+  double ta, fa;    // the last sample written (the anchor)
+  double lo, hi;    // the slopes of the lines from the anchor within eps of the samples since
+  double tl, fl;    // the last of these samples
+};
 
 class MutePointPlot : public PlotObj
 {
@@ -295,8 +326,22 @@ protected:
   double tscale;
   char   fileName[512];
   double x_temp, f_temp;
-  long   counter, bufferSize;
-  double *Tbuffer, *Ybuffer;
+  long   counter;   // the samples pushed since the start, or since a back-step beyond the kept ones
+                    //  (these reach the start of the file if the offset of the first one is its start)
+  double *Tbuffer;  // the times and the file offsets of the last ROLLBACK_SAMPLES samples
+  long long *Obuffer;
+  bool   dense;     // if true, values are recorded by sample() only, at the dense-output times
+  class  PointWriter *writer;   // buffered file output (see output.h)
+  double tolerance; // 0 if the samples are not compressed
+  PointDoor door;
+  PointDoor *doors; // the door after each of the last ROLLBACK_SAMPLES samples drawn, for a back-step
+  PointDoor *closed;// the door closed by each of the last ROLLBACK_SAMPLES samples written (lo > hi
+                    //  if the sample starts a segment), indexed as Tbuffer
+  long   seen;      // the samples drawn since the start, or since a back-step beyond the kept doors
+
+  void   compress(double t, double f);
+  bool   restoreDoor(double t);   // false if the back-step goes beyond the kept doors
+  bool   reopenDoor(const PointDoor &d, double t);   // false if d is no door of a segment across t
 
 public:
 
@@ -305,11 +350,15 @@ public:
  MutePointPlot(double *ptr, double *tptr, char islog,  double t, 
                const char *fname = "", const char *WinTitle = "");
 
- ~MutePointPlot() { fclose(file); delete [] Tbuffer; delete [] Ybuffer; };
+ ~MutePointPlot();
 
  void    draw();
- void    redraw() { draw(); }  // removed x_value = 0 (don't redo the file writes!)
+ void    redraw() { if (dense) sample(); else draw(); }  // dense: the point at the end of a Run
+ void    sample();
+ void    setDense(bool flag) { dense = flag; }
  void    pushValue(double t, double y);
+ bool    exportState(FILE *f);
+ void    importState(FILE *f);
 };
 
 
@@ -355,74 +404,96 @@ public:
 
  // ~FieldDump() { }
 
- void    draw()  {
-   if (field->Time < exportTime) { complete = false; return; }
-   if ( complete ) return;
-   complete = true;
-   field->Export(fileName);
-   };
+ void    draw();    // the field is written as by VectorObj::Export(), on the output thread
 
  void    redraw() { draw(); }
+ bool    exportState(FILE *) { return !complete || exportTime <= 0.0; }  // a dump written during the run is not replayed
+
+ const double *clock() { return &field->Time; }
+ double  due();
+};
+//*******************************************************************************
+
+//  The nodes written by the binary and 2D mute plots: "roi x0 x1 [y0 y1 [z0 z1]]" (in the
+//  units of the grid, following the field in the plot statement) keeps the nodes within
+//  a box, and "stride n" every n-th node of it along each dimension
+
+struct FieldWindow
+{
+  int  lo[3], hi[3], stride;        // the node ranges, inclusive
+
+  FieldWindow();                    // all the nodes of the grid
+  int  size(int d) const { return (hi[d] - lo[d]) / stride + 1; }
+  long count() const     { return long(size(0)) * size(1) * size(2); }
+  bool whole() const;
+
+  int  read(class TokenString &, long pos);   // the options following token #pos; returns their token count
+  void coords(int d, double *c) const;        // the coordinates of the kept nodes along dimension d
+  void gather(const double *field, double *w) const;
+  void describe(char *s, size_t n) const;     // appended to a plot title
 };
+
 //*******************************************************************************
 
+//  The frames (the time, followed by the field) are appended to the file after the header;
+//  the index file "<fileName>.idx" holds the time and the byte offset of each frame, as a
+//  double and a 64-bit integer, so that a back-step truncates both files after the last
+//  frame preceding the new time, and a reader may seek to a frame by its time. With
+//  "plot.binary.pack", the frames are packed into bricks and compressed (see packed.h).
+//  The header and the frames hold only the nodes of the window (see FieldWindow)
+
+struct PackedLayout;
+
 class FieldDumpT : public FieldPlotObj
 {
 protected:
 
   double timeBetweenSaves;
   double oldTime, newTime;
-  char   fileName[512];
+  char   fileName[512], indexName[520];
+  long long headerSize, frameSize; // in bytes
+  long   frames, maxFrames;
+  double *frameTime;
+  PackedLayout *packing;          // 0 for the raw frames
+  FieldWindow  window;
+  double *part;                   // the window of the field, or 0 if it is whole
 
 public:
 
  FILE   *file;
 
- FieldDumpT(FieldObj *f, double total, const char *fname = 0, const char *WinTitle = 0) : FieldPlotObj(f, 0, WinTitle)
+ FieldDumpT(FieldObj *f, double total, const char *fname = 0, const FieldWindow &w = FieldWindow(), const char *WinTitle = 0) :
+	 FieldPlotObj(f, 0, WinTitle), window(w)
     {
 		strcpy(fileName, fname);
+		snprintf(indexName, 519, "%s.idx", fileName);
 		snprintf(win_title, 511, "%s (binary plot into file %s)", field->ID, fileName);
+		window.describe(win_title, 512);
+		part = window.whole() ? 0 : new double[window.count()];
 		timeBetweenSaves = total / double(UPDATE_STEPS_BINARY);
 		oldTime  = field->Time;
 		newTime  = oldTime + timeBetweenSaves;
         FILE *ff = fopenAssure(fileName, "wb", "continuous field dump", "header initialization");
         header(ff);
+		headerSize = ftell(ff);
+		fclose(ff);
+		ff = fopenAssure(indexName, "wb", "continuous field dump", "index");
 		fclose(ff);
+
+		frameSize = (long long)(sizeof(double)) * (window.count() + 1);
+		frames    = 0;
+		maxFrames = UPDATE_STEPS_BINARY + 2;
+		frameTime = new double[maxFrames];
 		dump();
     }
    
    //**********************************************
 
-	 void  header(FILE *ff) {
-								fwrite( (void *)(&GEOMETRY),     sizeof(int),   1, ff);
-								fwrite( (void *)(&field->xsize), sizeof(int),   1, ff);
-		if (DIMENSIONALITY > 1)	fwrite( (void *)(&field->ysize), sizeof(int),   1, ff);
-		if (DIMENSIONALITY > 2) fwrite( (void *)(&field->zsize), sizeof(int),   1, ff);
-
-								fwrite( (void *)(field->xcoord), sizeof(double), field->xsize, ff);
-		if (DIMENSIONALITY > 1)	fwrite( (void *)(field->ycoord), sizeof(double), field->ysize, ff);
-		if (DIMENSIONALITY > 2) fwrite( (void *)(field->zcoord), sizeof(double), field->zsize, ff);
-	 }
-
-   //**********************************************
+	 void  header(FILE *ff);   // sets up the packing of the frames, if any
 
-	 void  chuckHeader(FILE *ff, void *buffer) {
-								fread( (void *)buffer, sizeof(int),    DIMENSIONALITY + 1, ff);
-								fread( (void *)buffer, sizeof(double), field->xsize,       ff);
-		if (DIMENSIONALITY > 1)	fread( (void *)buffer, sizeof(double), field->ysize,       ff);
-		if (DIMENSIONALITY > 2) fread( (void *)buffer, sizeof(double), field->zsize,       ff);
-	 }
-	   
    //**********************************************
 
-	 void  dump() {
-	   FILE *ff = fopenAssure(fileName, "ab", "continuous field dump", "binary write");
-
-	   fwrite( (void *)&field->Time, sizeof(double), 1,           ff);
-	   fwrite( (void *) field->elem, sizeof(double), field->size, ff);
-
-	   fclose(ff);
-	 }
+	 void  dump();     // appends the field to the file on the output thread (see output.h)
 
  //**********************************************
 
@@ -430,9 +501,12 @@ public:
   
  //**********************************************
 
-  ~FieldDumpT() { dump(); }
+  ~FieldDumpT();
  
   void    redraw() { draw(); }
+
+  const double *clock() { return &field->Time; }
+  double  due() { return newTime; }
 };
 
 //*******************************************************************************
@@ -467,8 +541,9 @@ public:
  double tscale;
  bool   complete;
 
- long   counter, bufferSize;
- double *Tbuffer,  *Ybuffer;
+ long   counter;    // as in MutePointPlot, with the offsets of the rows written by the output thread
+ double *Tbuffer;
+ long long *Obuffer;
 
  MutePlot1D(FieldObj *f, char islog, const char *dir, double coord1, double coord2, double T,
             const char *fname = 0) : FieldPlot1D(f, islog, dir, coord1, coord2)  
@@ -480,17 +555,22 @@ public:
    strcpy(fileName, fname);
    file = 0;
 
-   bufferSize = UPDATE_STEPS_1D;
-   Tbuffer = new double[UPDATE_STEPS_1D + 1];
-   Ybuffer = new double[num * (UPDATE_STEPS_1D + 1)];
+   Tbuffer = new double[ROLLBACK_SAMPLES];
+   Obuffer = new long long[ROLLBACK_SAMPLES];
    counter = 0;
  };
 
- ~MutePlot1D() { delete [] Tbuffer;  delete [] Ybuffer;  if (file) fclose(file);  };
+ ~MutePlot1D();
 
  void    draw();
  void    pushRow(double t, double *F, int columns = 3);
+ long long locate(double t, double *last);   // the offset of the first row at or after t
  void    redraw() { /* x_value = 0.0; */ draw(); }; 
+ bool    exportState(FILE *f);
+ void    importState(FILE *f);
+
+ const double *clock() { return &field->Time; }
+ double  due();
 
 };
 
@@ -525,6 +605,7 @@ class FieldPlot2D : public FieldPlotObj
 protected:
 
   long    incr1, incr2, num1, num2;
+  int     axis1, axis2;          // the dimensions along the plane
   double  *grid1, *grid2;
   double  *coord1, *coord2;
   char    *axisLabelX, *axisLabelY;
@@ -546,9 +627,10 @@ public:
 	bool   complete;
 	double exportTime;
 	char   fileName[512];
+	FieldWindow window;     // the nodes written, along axis1 and axis2
 
-	MutePlot2D(FieldObj *f, char islog, const char *dir, double coord, double T, const char *fname = 0) :
-	FieldPlot2D(f, islog, dir, coord)
+	MutePlot2D(FieldObj *f, char islog, const char *dir, double coord, double T, const char *fname = 0,
+	           const FieldWindow &w = FieldWindow()) : FieldPlot2D(f, islog, dir, coord), window(w)
 	{
 		exportTime = T;
 		complete = 0;
@@ -557,24 +639,12 @@ public:
 
 	~MutePlot2D() {  };
 
-	void    draw() 
-	{  
-		if (field->Time < exportTime) { complete = false; return; }
-		if ( complete ) return;
-		complete = true;
-		long ind = field_index;
-		FILE *file = fopenAssure(fileName, "w", "plot", win_title);
-		for (int j = 0; j < num2; j++) {
-			for (int i = 0; i < num1; i++) {
-				ind = field_index + j * incr2 + i * incr1;
-				fprintf(file,"%.6g %.6g %.9g \n", coord1[i], coord2[j], get_value(ind));
-			}
-			fprintf(file,"\n");
-		}
-		fclose(file);
-	}
+	void    draw();   // the plane is written on the output thread (see output.h)
 
 	void    redraw() { draw(); }; 
+
+	const double *clock() { return &field->Time; }
+	double  due();
 };
 
 //*******************************************************************************
@@ -738,20 +808,122 @@ public:
 
 };
 
+//*******************************************************************************
+//                  C L A S S E S   S T R E A M   P L O T
+//*******************************************************************************
+//  The plots sent to "plot.stream" (see stream.h) or "plot.shm" (see snapshot.h): a
+//  frame is sent each time the clock passes the next of "steps" equal intervals of
+//  the run, and on a back-step
+
+class StreamPlot
+{
+protected:
+
+  class PlotSink *sink;
+  int    id;
+  double tscale;
+  double sent;            // the time of the last frame
+  const double *time;
+
+  bool   ready();         // true if a frame is due (the time of the frame is then taken)
+  double nextFrame();
+
+public:
+
+  StreamPlot(PlotSink *s, const double *clock, int steps, double total);
+};
+
+//*******************************************************************************
+
+class StreamPointPlot : public PlotObj, public StreamPlot
+{
+public:
+
+ StreamPointPlot(PlotSink *s, double *ptr, double *tptr, char islog, double T, const char *WinTitle = "");
+
+ void    draw();
+ void    redraw() { draw(); }
+
+ const double *clock() { return time; }
+ double  due()         { return nextFrame(); }
+};
+
+//*******************************************************************************
+
+class StreamPlot1D : public FieldPlot1D, public StreamPlot
+{
+protected:
+
+  double *values;
+
+public:
+
+ StreamPlot1D(PlotSink *s, FieldObj *f, char islog, const char *dir, double coord1, double coord2, double T);
+ ~StreamPlot1D() { delete [] values; }
+
+ void    draw();
+ void    redraw() { draw(); }
+
+ const double *clock() { return time; }
+ double  due()         { return nextFrame(); }
+};
+
+//*******************************************************************************
+
+class StreamPlot2D : public FieldPlot2D, public StreamPlot
+{
+protected:
+
+  FieldWindow window;     // the nodes sent, along axis1 and axis2
+  double *values;
+
+public:
+
+ StreamPlot2D(PlotSink *s, FieldObj *f, char islog, const char *dir, double coord, double T,
+              const FieldWindow &w = FieldWindow());
+ ~StreamPlot2D() { delete [] values; }
+
+ void    draw();
+ void    redraw() { draw(); }
+
+ const double *clock() { return time; }
+ double  due()         { return nextFrame(); }
+};
+
 //*******************************************************************************
 //                      C L A S S   P L O T   A R R A Y
 //*******************************************************************************
 
+//  draw_all() draws the plots without a clock (see PlotObj::clock) at every call, and the
+//  others when they are due: their due times are kept in a heap, so that only its head
+//  is checked at each step. A back-step (the clock of the first scheduled plot going
+//  backwards) draws all of them, as the plots roll their output back themselves
+
 class PlotArray
 {
 protected:
 
+	int     *polled, polledNum;     // the plots drawn at every step, in increasing order
+	int     *heap, heapNum;         // the scheduled plots, by their due times
+	int     *drawing;
+	double  *dueTime;
+	const double *reference;        // the clock of the first scheduled plot
+	double  lastTime;               // its value at the last draw_all(); DBL_MAX draws every plot
+	bool    planned;
+
+	void    plan();
+	void    push(int);
+	int     pop();
+
 public:
 
 	PlotObj** array;
 	int     plot_num;
 	int     count;
 	char    gl_on, method;
+	double  denseDt;   // interval between dense-output samples of point plots (0 = off)
+	class PlotSink *sink[2];    // "plot.stream" (see stream.h) and "plot.shm" (see snapshot.h)
+	int     sinks;
 
 	PlotArray(class SimulationObj&);
 
@@ -759,9 +931,13 @@ public:
 
 	PlotArray(int n) {
 		array = NULL;
-		count = 0; gl_on = 0;
+		count = 0; gl_on = 0; denseDt = 0;
+		sinks = 0;
 		plot_num = n;
 		if (n) array = new PlotObj * [n];
+		polled = heap = drawing = 0;
+		dueTime = 0;
+		planned = false;
 	}
 	~PlotArray();
 
@@ -769,18 +945,37 @@ public:
 		if (count >= plot_num)
 			throw makeMessage("in PlotArray: cannot set plot #%d: total number = %d", count, plot_num);
 		else array[count++] = plot;
+		planned = false;
 	}
 
 	void draw_plot(int n)   { if (n < count) array[n]->draw(); }
 	void redraw_plot(int n) { if (n < count) array[n]->redraw(); }
 
-	void draw_all() {
-		if (count) for (int i = 0; i < count; i++) array[i]->draw();
-	}
+	void draw_all();
+	double due();     // the time of the next scheduled plot (DBL_MAX if none)
 	
 	void redraw_all() {
 		if (count) for (int i = 0; i < count; i++) array[i]->redraw();
 	}
+
+	void sample_all() {
+		if (count) for (int i = 0; i < count; i++) array[i]->sample();
+	}
+
+	void setDense(double dt) {
+		denseDt = dt;
+		for (int i = 0; i < count; i++) array[i]->setDense(dt > 0);
+	}
+
+	bool exportState(FILE *f) {
+		for (int i = 0; i < count; i++) if ( !array[i]->exportState(f) ) return false;
+		return true;
+	}
+
+	void importState(FILE *f) {
+		for (int i = 0; i < count; i++) array[i]->importState(f);
+		planned = false;     // the due times are recomputed
+	}
 };
 
 //*****************************************************************************
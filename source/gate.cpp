@@ -59,6 +59,8 @@
 #include "simulation.h"
 #include "fplot.h"
 #include "gate.h"
+#include "native.h"
+#include "optimize.h"
 
 //**************************************************************************
 
@@ -87,9 +89,15 @@
     delete [] ident_id;
     delete [] formulas;
 
+    for (i=0; i < param_num; i++) delete [] param_id[i];
+    delete param;
+    delete [] param_id;
+
     delete switches;
     delete locations;
     delete tables;
+    if (native) delete native;
+    if (optimized) delete optimized;
  }
 
 //**************************************************************************
@@ -123,6 +131,28 @@ void KineticObj::init_ODE_AUX(TokenString *Param)
   }
 
 //**************************************************************************
+//  Ensemble parameters ("ensemble.parameter name value" statements, inserted
+//  by EnsembleObj in place of the "for" loops) are resolved as variables, so 
+//  that the formulas refer to them by address rather than by value
+//**************************************************************************
+
+void KineticObj::setParameters(TokenString *Param)
+  {
+    long pos;
+
+    param_num = Param->token_count("ensemble.parameter");
+    param     = new VectorObj(param_num);
+    param_id  = new char *[param_num];
+
+    for (int i = 0; i < param_num; i++) {
+      pos = Param->token_index("ensemble.parameter", i+1);
+      Param->checkName(pos + 1, "ensemble parameter");
+      param_id[i]  = Param->StrCpy(pos + 1);
+      (*param)[i]  = ExpressionObj(*Param, pos + 2, "Bad ensemble parameter value").Evaluate();
+    }
+  }
+
+//**************************************************************************
 
 
 void KineticObj::sortAUX(class TokenString *Param, long *exprStart)
@@ -243,6 +273,9 @@ void KineticObj::setODEexpressions(class SimulationObj *Sim, long *exprStart)
 KineticObj::KineticObj(class SimulationObj *Sim)
 {
    TokenString *Param = Sim->Params;
+
+  native = 0;
+  optimized = 0;
  
   if (Sim->Ca) {
     Param->addToken("_Charge"); Param->addToken("`");
@@ -252,6 +285,7 @@ KineticObj::KineticObj(class SimulationObj *Sim)
   else Ca = 0;
 
   init_ODE_AUX(Param);                 
+  setParameters(Param);
   long *exprStart = new long[var_num + ident_num]; 
 
   Time = 0.0;
@@ -272,6 +306,14 @@ KineticObj::KineticObj(class SimulationObj *Sim)
   switches -> set_matrices(*Param, Sim);
   switches -> Evaluate(0.0);
 
+  if ( Param->Assert("ODE.compile", "native") ) {
+    native = new NativeKinetics(formulas, ident_num, var_num);
+    if ( !native->ok ) { delete native; native = 0; }
+  }
+
+  if ( !native && Param->Assert("ODE.optimize", "on") )
+    optimized = new OptimizedKinetics(formulas, ident_num, var_num, ident->elem, Ca == 0);
+
   Evaluate();
   Equilibrate(Param);
 };
@@ -318,7 +360,6 @@ void KineticObj::Equilibrate(TokenString *Param) {
 void KineticObj::Evaluate()
  { 
  VectorObj dvar(var_num);
- int i;
 
  if (!eq_flag)
    {
@@ -326,14 +367,25 @@ void KineticObj::Evaluate()
    tables->Evaluate(Time);
    }
 
- for (i = 0; i < ident_num; i++)    ident->elem[i] = formulas[i]->Evaluate();
+ evaluateIdent();
  maxima -> Evaluate();
- for (i = 0; i < ident_num; i++)    ident->elem[i] = formulas[i]->Evaluate();  // In case aux depend on max/min
+ evaluateIdent();  // In case aux depend on max/min
  //if (Ca) Ca->evaluateCurrents(); // Fix the bootstrap in the order of object declaration vs. evaluation
  }
 
 //**************************************************************************
 
+void KineticObj::evaluateIdent()
+ {
+ if ( native && native->evalIdent(ident->elem) == 0 ) return;
+ if ( optimized ) { optimized->evalIdent(ident->elem); return; }
+
+ // Interpreted evaluation; also reports the error if the compiled code returned a non-finite value
+ for (int i = 0; i < ident_num; i++)  ident->elem[i] = formulas[i]->Evaluate();
+ }
+
+//**************************************************************************
+
 void KineticObj::print()
  { 
  VectorObj dvar(var_num);
@@ -343,6 +395,49 @@ void KineticObj::print()
  fprintf(stderr, "\n\n Identities: "); for (i = 0; i < ident_num; i++)  fprintf(stderr, "%s=%g ", this->ident_id[i], this->ident->elem[i]);
  }
 
+//**************************************************************************
+//  Complete state of the variables, for the snapshots of the simulation at the
+//  end of a "Run" (see prefix.h). The auxiliary variables are stored as well,
+//  so that the imported state does not have to be re-evaluated. The Markov
+//  switches are not included: scripts with Markov channels are not cached
+//**************************************************************************
+
+void KineticObj::exportState(FILE *f)
+ {
+ writeState(f, &Time, sizeof(double));
+ writeState(f, var->elem,   var_num   * sizeof(double));
+ writeState(f, ident->elem, ident_num * sizeof(double));
+
+ for (int i = 0; i < tables->table_num; i++) {
+   writeState(f, &tables->array[i]->index, sizeof(long));
+   writeState(f, &tables->array[i]->value, sizeof(double));
+   }
+ for (int i = 0; i < maxima->peak_num; i++) {
+   writeState(f, &maxima->array[i]->peak,      sizeof(double));
+   writeState(f, &maxima->array[i]->peakTime,  sizeof(double));
+   writeState(f, &maxima->array[i]->startFlag, sizeof(bool));
+   }
+ for (int i = 0; i < locations->interpol_num; i++) locations->array[i]->exportState(f);
+ }
+
+void KineticObj::importState(FILE *f)
+ {
+ readState(f, &Time, sizeof(double));
+ readState(f, var->elem,   var_num   * sizeof(double));
+ readState(f, ident->elem, ident_num * sizeof(double));
+
+ for (int i = 0; i < tables->table_num; i++) {
+   readState(f, &tables->array[i]->index, sizeof(long));
+   readState(f, &tables->array[i]->value, sizeof(double));
+   }
+ for (int i = 0; i < maxima->peak_num; i++) {
+   readState(f, &maxima->array[i]->peak,      sizeof(double));
+   readState(f, &maxima->array[i]->peakTime,  sizeof(double));
+   readState(f, &maxima->array[i]->startFlag, sizeof(bool));
+   }
+ for (int i = 0; i < locations->interpol_num; i++) locations->array[i]->importState(f);
+ }
+
 //**************************************************************************
 
 VectorObj KineticObj::derivative()
@@ -352,6 +447,8 @@ VectorObj KineticObj::derivative()
  Evaluate();
  if (Ca && !eq_flag) Ca->evaluateCurrents();
 
+ if ( native && native->evalDeriv(dvar()) == 0 ) return dvar;
+ if ( optimized ) { optimized->evalDeriv(dvar()); return dvar; }
  for (int i = 0; i < var_num;   i++) dvar[i] = formulas[i+ident_num]->Evaluate();
 
  return dvar;
@@ -405,15 +502,20 @@ double KineticObj::RungeKuttaAdaptive(double T, double eps, class PlotArray *plo
 
  VectorObj v1(var_num), dv(var_num); 
  VectorObj k1(var_num), k2(var_num), k3(var_num), k4(var_num), k5(var_num), k6(var_num);
+ VectorObj k1next(var_num);
 
  double delta, L1norm;
+ bool   dense = ( plots && plots->denseDt > 0 && !eq_flag );
+ bool   k1known = false;   // derivative at the start of the step is known from the dense output
+ const VectorObj *stages[7] = { &k1, &k2, &k3, &k4, &k5, &k6, &k1next };
 
  do
    {
    if ( Time + dt > T )  dt = T - Time;
    saveState(1);
 
-   k1 = derivative();
+   if (k1known) { k1 = k1next; k1known = false; }
+   else k1 = derivative();
    *var = *varOld[1] + dt * (b21 * k1 );
    Time = TimeOld[1] + a2 * dt;
    k2 = derivative();
@@ -461,6 +563,11 @@ double KineticObj::RungeKuttaAdaptive(double T, double eps, class PlotArray *plo
      *var = *varOld[1] + v1 * dt;
      Evaluate();   // ensure that all variables are evaluated at the current time 
      //switches->Evaluate(Time);
+     if (dense) {
+       k1next  = derivative();   // also the first stage of the next step
+       k1known = true;
+       denseOutput(plots, *varOld[1], stages, TimeOld[1], dt);
+     }
      if (plots) plots->draw_all();
      if (VERBOSE > 7) fprintf(stderr, "# RK step: delta=%.3e < eps=%.3e time=%g dt=%.3g->", delta, eps, Time, dt);
      dthold = 5.0 * dt;
@@ -491,6 +598,53 @@ double KineticObj::RungeKuttaAdaptive(double T, double eps, class PlotArray *plo
  return Time;
 }
 
+//*****************************************************************************
+//  Dense output: samples the point plots at the multiples of plots->denseDt 
+//  within the step [t0, t0 + dt] just accepted, so that the plot resolution 
+//  does not constrain the integrator step. The continuous extension of the 
+//  Cash-Karp step is of 4th order, y(t0 + th dt) = y0 + dt Sum b_i(th) k_i, 
+//  with the stages k1..k6 and k7 = f(t0 + dt, y1) (the first stage of the 
+//  next step); the quartic weights b_i(th) satisfy the eight 4th-order 
+//  conditions, give the 5th-order solution y1 at th = 1, and the derivatives
+//  f(y0) and f(y1) at the ends, so that the samples are C1 across the steps
+//*****************************************************************************
+
+void KineticObj::denseOutput(class PlotArray *plots, VectorObj &y0, const VectorObj **stage, double t0, double dt)
+{
+  double Dt = plots->denseDt, t1 = t0 + dt;
+  long   k  = long( floor(t0 / Dt + 1e-9) ) + 1;
+  double ts = k * Dt;
+
+  if ( ts > t1 * (1 + 1e-12) ) return;
+
+  VectorObj ya(var_num);
+  ya = y0;     // y0 may be the state saved at level 1, overwritten below
+  saveState(1);
+
+  const VectorObj &k1 = *stage[0], &k3 = *stage[2], &k4 = *stage[3], &k5 = *stage[4], &k6 = *stage[5], 
+                  &k7 = *stage[6];   // b2 = 0
+
+  for ( ; ts <= t1 * (1 + 1e-12); ts = (++k) * Dt) {
+    double th = (ts - t0) / dt;
+    if (th > 1.0) th = 1.0;
+    double t2 = th * th;
+    double b1 = th * ( 1.0 + th * ( -65.0/21.0 + th * ( 677.0/189.0 - 25.0/18.0 * th ) ) );
+    double b3 = t2 * ( 2500.0/483.0 + th * ( -38000.0/4347.0 + 250.0/63.0 * th ) );
+    double b4 = t2 * ( -125.0/44.0 + th * ( 3875.0/594.0 - 125.0/36.0 * th ) );
+    double b5 = t2 * ( -45.0/28.0 + th * ( 45.0/14.0 - 45.0/28.0 * th ) );
+    double b6 = t2 * ( 1536.0/1771.0 - 1024.0/1771.0 * th );
+    double b7 = t2 * ( 1.5 + th * ( -4.0 + 2.5 * th ) );
+    for (int i = 0; i < var_num; i++)
+      (*var)[i] = ya[i] + dt * ( b1 * k1[i] + b3 * k3[i] + b4 * k4[i] + b5 * k5[i] + b6 * k6[i] + b7 * k7[i] );
+    Time = ts;
+    Evaluate();
+    plots->sample_all();
+  }
+
+  recoverState(1);
+  Evaluate();
+}
+
 //*****************************************************************************
 
 double *KineticObj::ResolveID(const char *svar, double **t) {
@@ -513,6 +667,10 @@ double *KineticObj::ResolveID(const char *svar, double **t) {
           if (equal(svar, ident_id[j])) 
             return  (*ident)() + j;
 
+    for (j = 0; j < param_num; j++)
+      if (equal(svar, param_id[j])) 
+        return (*param)() + j;
+
     for (j = 0; j < tables->table_num; j++)
 	 if (equal(svar, tables->array[j]->ID ) )
            return &(tables->array[j]->value);
@@ -553,6 +711,9 @@ const char *KineticObj::ResolvePtr(double *ptr) {
         for (j = 0; j < ident->get_size(); j++)
 			if ( ptr == ((*ident)() + j) ) return ident_id[j];
 
+      for (j = 0; j < param_num; j++)
+			if ( ptr == ((*param)() + j) ) return param_id[j];
+
       for (j = 0; j < tables->table_num; j++)
 		 if ( ptr == &(tables->array[j]->value) ) return tables->array[j]->ID;
 
@@ -52,10 +52,13 @@ class KineticObj : public VarList
 
   VectorObj       *var, *varOld[2];
   VectorObj       *ident;
+  VectorObj       *param;      // ensemble parameters: constant in time, set for each ensemble member
   int             var_num;
   int             ident_num;
+  int             param_num;
   char            **var_id;
   char            **ident_id;
+  char            **param_id;
   ExpressionObj   **formulas;
   FieldObj        *Ca;
 
@@ -63,6 +66,8 @@ class KineticObj : public VarList
   PeakTrackArray  *maxima;
   InterpolArray   *locations;
   MarkovArray     *switches;
+  class NativeKinetics *native;   // compiled formulas ("ODE.compile = native"), or 0
+  class OptimizedKinetics *optimized;   // optimized formulas ("ODE.optimize = on"), or 0
   
   double Time, TimeOld[2];
 
@@ -71,6 +76,7 @@ class KineticObj : public VarList
   KineticObj(class SimulationObj *);
 
   void init_ODE_AUX(TokenString *);
+  void setParameters(TokenString *);
 
   void sortAUX(TokenString *, long *exrStart);
 
@@ -81,12 +87,14 @@ class KineticObj : public VarList
   void setODEexpressions(class SimulationObj *Sim, long *exprStart);
 
   void Evaluate();
+  void evaluateIdent();
   void Equilibrate(TokenString *);
   void print();
 
   VectorObj derivative();                      // returns dt satisfying accuracy eps
   double    RungeKuttaAdaptive(double T, double eps, class PlotArray *plots = 0, class RunStatusString *rss=0,
                                double total = 0.0, double dt = 0.0, long max_steps = 40000);   
+  void      denseOutput(class PlotArray *plots, VectorObj &y0, const VectorObj **stage, double t0, double dt);
 
   char      eq_flag;
 
@@ -98,6 +106,9 @@ class KineticObj : public VarList
   void recoverState(int level = 0) { *var = *varOld[level]; Time = TimeOld[level]; 
      switches->recoverState(level); tables->recoverState(level); maxima->recoverState(level); locations->recoverState(); }
 
+  void exportState(FILE *f);   // the complete state, for the snapshots of the simulation (see prefix.h)
+  void importState(FILE *f);
+
   double     *ResolveID(const char *, double **t=0);
   const char *ResolvePtr(double *ptr);
 };
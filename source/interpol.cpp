@@ -71,6 +71,21 @@ double InterpolObj::Evaluate(double t)
 
 //**************************************************************************
 
+void InterpolObj::exportState(FILE *f)
+   {
+   double state[5] = { oldres, newres, oldtime, newtime, result };
+   writeState(f, state, sizeof(state));
+   }
+
+void InterpolObj::importState(FILE *f)
+   {
+   double state[5];
+   readState(f, state, sizeof(state));
+   oldres = state[0]; newres = state[1]; oldtime = state[2]; newtime = state[3]; result = state[4];
+   }
+
+//**************************************************************************
+
 void InterpolObj::reset()
    {
    if (average) return;
@@ -143,8 +158,10 @@ InterpolObj::InterpolObj(TokenString &Param, long p0, FieldObj *FO)
 		   }
    }
  
+   Param.sealed     = true;                       // the address is kept: token_ptr[] may not move
    token_ptr_source = &(Param.token_ptr[p0-1]);   // restore at destruction time
    token_ptr_target = Param.token_ptr[p0-1];      //  
+   tokens = &Param;
    Param.deleteToken(p0, pLast + 1);
 
    oldtime = newtime = *tptr;   
@@ -153,6 +170,7 @@ InterpolObj::InterpolObj(TokenString &Param, long p0, FieldObj *FO)
                     oldres = newres = result;
 					ID = StrCpy( xyz );
 					Param.token_ptr[p0-1] = ID;   // *** hijack the token pointer
+					Param.reindex();
                     return;
    }
 
@@ -219,6 +237,7 @@ InterpolObj::InterpolObj(TokenString &Param, long p0, FieldObj *FO)
 
    ID = StrCpy( xyz );
    Param.token_ptr[p0-1] = ID;   // *** hijack the token pointer
+   Param.reindex();
 
    result = 0.0;
    for (int i = 0; i < nPointers; i++) result += *pointers[i] * (factors[i] /= factorSum);
@@ -52,6 +52,7 @@ protected:
   double oldres0, newres0, oldtime0, newtime0;
 
   char   **token_ptr_source, *token_ptr_target;  // restore 
+  TokenString *tokens;                            //  and re-index
 
 public:
 
@@ -59,11 +60,11 @@ public:
  double result;
  char   *ID;
 
- InterpolObj() { ID = 0; pointers = 0; }
+ InterpolObj() { ID = 0; pointers = 0; tokens = 0; }
  
  InterpolObj(TokenString &Param, long p, FieldObj *);
 
- ~InterpolObj() { if (!average) *token_ptr_source = token_ptr_target;
+ ~InterpolObj() { if (!average) { *token_ptr_source = token_ptr_target; tokens->reindex(); }
 				  if (pointers) delete [] pointers;
                   if (ID)       delete [] ID; }
 
@@ -72,6 +73,9 @@ public:
 
  void saveState()    { oldres0 = oldres; newres0 = newres;  oldtime0 = oldtime; newtime0 = newtime; }
  void recoverState() { oldres  = oldres0; newres = newres0; oldtime = oldtime0; newtime  = newtime0; }
+
+ void exportState(FILE *f);   // for the snapshots of the simulation (see prefix.h)
+ void importState(FILE *f);
 };
 
 //@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -5,7 +5,8 @@
  *
  *                                loop.cpp
  *
- *  LoopObj variable contains data for the (nested) "for" loop script statement
+ *  LoopObj variable contains data for the (nested) "for" loop script statement,
+ *  or for the rows of a parameter table ("sweep.table = file")
  *
  ******************************************************************************
  
@@ -46,8 +47,20 @@
 #include "gate.h"
 #include "fplot.h"
 #include "loop.h"
+#include "sweep.h"
 
-extern char* globalLabelX;
+#include <time.h>
+
+#ifdef _WIN32
+  #include <io.h>
+  #define ftruncate(fd, size) _chsize(fd, long(size))
+  #define fileno _fileno
+#else
+  #include <unistd.h>
+  #include <fcntl.h>
+#endif
+
+extern thread_local char* globalLabelX;
 
 //**********************************************************************************************
 
@@ -73,9 +86,59 @@ long getTrackVar(TokenString &TS, int n, int *iGraph, int *iSets) {  // n = 0..t
   throw makeMessage("Could not find track variable number %d", n);
 }
 
+//**********************************************************************************************
+//  Parameter table: a header line with the names of the parameters, followed by a line of their
+//  values per step. The fields are separated by commas, semicolons, tabs or spaces; empty lines
+//  and lines starting with "%" or "#" are skipped
+//**********************************************************************************************
+
+static bool tableLine(FILE *f, char *s) {     // reads the next line that is not empty or a comment
+  while ( fgets(s, MAX_LINE_LENGTH, f) ) {
+    char *p = s + strspn(s, " \t\r\n");
+    if (*p && *p != '%' && *p != '#') return true;
+  }
+  return false;
+}
+
+static int tableFields(char *s, char **fields, int max) {   // splits the line in place
+  const char *sep = ",; \t\r\n";
+  int n = 0;
+  while (n < max) {
+    s += strspn(s, sep);
+    if (!*s) break;
+    fields[n++] = s;
+    s += strcspn(s, sep);
+    if (*s) *s++ = 0;
+  }
+  return n;
+}
+
+static void tableBinding(char *s, const char *id, double v) {  // the shortest form reproducing v
+  snprintf(s, 1023, "%s = %.15g", id, v);
+  if ( atof(strchr(s, '=') + 1) != v ) snprintf(s, 1023, "%s = %.17g", id, v);
+}
+
+//**********************************************************************************************
+
+int getLoopVarNum(TokenString &TS) {
+
+  if ( !TS.token_count("sweep.table") ) return TS.token_count(LOOP_TOKEN);
+  if ( TS.token_count(LOOP_TOKEN) ) throw makeMessage("\"for\" loops cannot be combined with a parameter table (\"sweep.table\")");
+
+  char fname[MAX_STRING_LENGTH], s[MAX_LINE_LENGTH], *fields[MAX_TABLE_COLUMNS + 1];
+  TS.get_string_param("sweep.table", fname);
+  FILE *f = fopenAssure(fname, "r", "reading", "the parameter table");
+  int n = tableLine(f, s) ? tableFields(s, fields, MAX_TABLE_COLUMNS + 1) : 0;
+  fclose(f);
+
+  if (!n) throw makeMessage("Parameter table %s: no parameter names", fname);
+  if (n > MAX_TABLE_COLUMNS) throw makeMessage("Parameter table %s: more than %d parameters", fname, MAX_TABLE_COLUMNS);
+  return n;
+}
+
 //**********************************************************************************************
 
-LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOKEN) ), 
+LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( getLoopVarNum(TS) ), 
 						    var(num), var0(num), dvar(num),
                             index(new int[num]), limit(new int[num]), 
                             ids(new char *[num]),  tp(new char[num])
@@ -84,6 +147,19 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
   fCount  = 0.0;
   started = false;
   steps   = 1;
+  journal = 0;
+  journalName = 0;
+  journaled = TS.Assert("sweep.journal", "on");
+  synced  = 0;
+  table   = 0;
+  tableName = 0;
+  results = 0;
+  values  = cells = 0;
+  cellNum = 0;
+  order   = 0;
+  budget  = 0;
+  tolerance = 0.0;
+  adaptiveName = 0;
 
   if (!num) {
       plots = new PlotArray(0);
@@ -100,6 +176,8 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
 
   for (i = 0; i < res->size; i++) trackIDs[i] = TS.StrCpy( getTrackVar(TS, i) );
   
+  if ( TS.token_count("sweep.table") ) readTable(TS);
+  else
   for (i = 0; i < num; i++) 
   try    {       
       ids[i] = TS.StrCpy( TS.token_index(LOOP_TOKEN, i+1) + 1 ); 
@@ -110,9 +188,9 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
       dv = ExpressionObj(TS, TS.token_index("step", i+1) + 1, 
                              "Error in the \"for\" loop: bad \"step\" expression").Evaluate();
 
-      if (  ( fabs(v0 - int(v0+0.5)) < 1.0e-6 ) && 
-            ( fabs(v1 - int(v1+0.5)) < 1.0e-6 ) &&  
-            ( fabs(dv - int(dv+0.5)) < 1.0e-6 )  )   tp[i] = 'i'; else tp[i] = 'd';
+      if (  ( fabs(v0 - floor(v0+0.5)) < 1.0e-6 ) && 
+            ( fabs(v1 - floor(v1+0.5)) < 1.0e-6 ) &&  
+            ( fabs(dv - floor(dv+0.5)) < 1.0e-6 )  )   tp[i] = 'i'; else tp[i] = 'd';
 
       var.elem[i] = var0.elem[i] = v0;
       dvar.elem[i] = dv;
@@ -130,7 +208,9 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
                                       makeMessage("ERROR %d: Bad \"for\" loop statement", ERR));
                     }
 
-  PlotObj::UPDATE_STEPS = steps;
+  if ( TS.token_count("sweep.adaptive") ) setAdaptive(TS);
+  PlotObj::UPDATE_STEPS = values ? budget : steps;
+  TS.get_param("plot.tolerance", &PlotObj::UPDATE_TOLERANCE);
 
   if ( TS.token2_count("plot.method","xmgr") || TS.token3_count("plot.method","=","xmgr") ) {
      plots = new PlotArray(result->size + TS.token_count("track"));
@@ -153,7 +233,7 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
  
   double* xPtr, xMax; // the pointer to x-label variable for all "track" graphs, and its max value
 
-  if (num == 1) {
+  if (num == 1 && !table) {
       globalLabelX = StrCpy(ids[0]);
       xPtr = var();
       xMax = v0 + (limit[0] - 1) * fabs(dvar[0]);
@@ -161,7 +241,7 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
   else {
       globalLabelX = StrCpy("iteration");
       xPtr = &fCount;
-      xMax = double(steps);
+      xMax = double(values ? budget : steps);
   }
 
   long pos;
@@ -203,6 +283,15 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
    int i;
    if (!num) return;
 
+   if (journal) fclose(journal);   // the journal of an unfinished sweep is kept
+   if (journalName) delete [] journalName;
+   if (results) fclose(results);
+   if (table) delete [] table;
+   if (tableName) delete [] tableName;
+   if (values) delete [] values;
+   if (cells) delete [] cells;
+   if (order) delete [] order;
+   if (adaptiveName) delete [] adaptiveName;
    if (plots && plots->plot_num) delete plots;
    delete [] tp;
    delete [] index;
@@ -216,6 +305,73 @@ LoopObj::LoopObj(TokenString &TS, VectorObj *res) : num( TS.token_count(LOOP_TOK
   }
 
 
+//**************************************************************************************************
+//  Reads the parameter table (see getLoopVarNum), and opens the file of the results of its rows 
+//  ("sweep.table.results", by default the table name with "_results" before its extension)
+//**************************************************************************************************
+
+void LoopObj::readTable(TokenString &TS) {
+
+  char s[MAX_LINE_LENGTH], *fields[MAX_TABLE_COLUMNS + 1], *end;
+  size_t length = 0;
+  long r, rows = 0;
+  int  i;
+
+  tableName = new char[MAX_STRING_LENGTH];
+  TS.get_string_param("sweep.table", tableName);
+  FILE *f = fopenAssure(tableName, "r", "reading", "the parameter table");
+
+  tableLine(f, s);
+  tableFields(s, fields, num);
+  for (i = 0; i < num; i++) {
+    ids[i] = StrCpy(fields[i]);
+    tp[i]  = 't';
+    var0[i] = dvar[i] = 0.0;
+    index[i] = 0;
+    limit[i] = 1;
+    length += strlen(ids[i]) + 32;
+  }
+  if (length >= sizeof(loopVarString)) { fclose(f); throw makeMessage("Parameter table %s: too many parameters", tableName); }
+
+  while ( tableLine(f, s) ) rows++;
+  if (!rows) { fclose(f); throw makeMessage("Parameter table %s: no parameter values", tableName); }
+
+  table = new double[rows * num];
+  rewind(f);
+  tableLine(f, s);
+  for (r = 0; r < rows; r++) {
+    tableLine(f, s);
+    int n = tableFields(s, fields, MAX_TABLE_COLUMNS + 1);
+    for (i = 0; i < num && i < n; i++) {
+      table[r * num + i] = strtod(fields[i], &end);
+      if (end == fields[i] || *end) break;
+    }
+    if (n != num || i < num) {
+      fclose(f);
+      throw makeMessage("Parameter table %s: bad row #%ld (expecting %d numbers)", tableName, r + 1, num);
+    }
+  }
+  fclose(f);
+
+  steps = rows;
+  for (i = 0; i < num; i++) var.elem[i] = table[i];
+  if (VERBOSE) fprintf(stderr, "\n### Parameter table %s: %ld rows of %d parameters\n", tableName, rows, num);
+
+  char rname[MAX_STRING_LENGTH];
+  if ( TS.token_count("sweep.table.results") ) TS.get_string_param("sweep.table.results", rname);
+  else {
+    char *dot = strrchr(tableName, '.');
+    if ( dot && !strchr(dot, '/') && !strchr(dot, '\\') && dot > tableName )
+         snprintf(rname, MAX_STRING_LENGTH, "%.*s_results%s", int(dot - tableName), tableName, dot);
+    else snprintf(rname, MAX_STRING_LENGTH, "%s_results", tableName);
+  }
+  results = fopenAssure(rname, "w", "writing", "the parameter table results");
+  fprintf(results, "row");
+  for (i = 0; i < num; i++)          fprintf(results, ",%s", ids[i]);
+  for (i = 0; i < result->size; i++) fprintf(results, ",%s", trackIDs[i]);
+  fprintf(results, "\n");
+}
+
 //**************************************************************************************************
 
 void LoopObj::step() {
@@ -238,9 +394,11 @@ void LoopObj::step() {
 
   for (i = 0; i < num; i++)
     {       
-    var[i] = var0[i] + index[i] * dvar[i];
-    if (tp[i] == 'i')
-      snprintf(temp, 1023, "%s = %d", ids[i], int(var[i] + 0.5) );
+    var[i] = table ? table[count * num + i] : var0[i] + index[i] * dvar[i];
+    if (tp[i] == 't')
+      tableBinding(temp, ids[i], var[i]);
+    else if (tp[i] == 'i')
+      snprintf(temp, 1023, "%s = %d", ids[i], int( floor(var[i] + 0.5) ) );
     else
       snprintf(temp, 1023, "%s = %g", ids[i], var[i] );
 
@@ -249,11 +407,56 @@ void LoopObj::step() {
     }
  
   if (VERBOSE > 0) {
-    fprintf(stderr,  "\n    Next step in the \"for\" loop: %s \n", loopVarString);
+    if (tableName) fprintf(stderr,  "\n    Row %ld of the parameter table: %s \n", count + 1, loopVarString);
+    else           fprintf(stderr,  "\n    Next step in the \"for\" loop: %s \n", loopVarString);
     fprintf(stderr,  "========================================================\n");
   }
 }
 
+//**************************************************************************************************
+
+double LoopObj::value(long n, int i) {
+
+  char temp[64];
+  int  j, k = 0;
+
+  if (table) return table[n * num + i];
+  for (j = num - 1; j >= i; j--) { k = int(n % limit[j]); n /= limit[j]; }
+
+  double v = var0[i] + k * dvar[i];
+  if (tp[i] == 'i') return floor(v + 0.5);
+
+  snprintf(temp, 63, "%g", v);   // the script receives the value printed by step()
+  return atof(temp);
+}
+
+//**************************************************************************************************
+
+void LoopObj::bindings(long n, char *s) {
+
+  char temp[1024];
+  int  i, *k = new int[num + 1];
+
+  strcpy(s, "");
+  if (!table)
+    for (i = num - 1; i >= 0; i--) { k[i] = int(n % limit[i]); n /= limit[i]; }
+
+  for (i = 0; i < num; i++)
+    {
+    double v = table ? table[n * num + i] : var0[i] + k[i] * dvar[i];
+    if (tp[i] == 't')
+      tableBinding(temp, ids[i], v);
+    else if (tp[i] == 'i')
+      snprintf(temp, 1023, "%s = %d", ids[i], int( floor(v + 0.5) ) );
+    else
+      snprintf(temp, 1023, "%s = %g", ids[i], v );
+
+    strcat( s, temp );
+    if ( i < num - 1 ) strcat( s, "; " );
+    }
+  delete [] k;
+}
+
 //**************************************************************************************************
 
   void LoopObj::draw()
@@ -262,6 +465,15 @@ void LoopObj::step() {
     if (!num) return;
     plots->draw_all();  
 
+    if (results) {     // a row of the parameter table, followed by the tracked values
+      char temp[1024];
+      fprintf(results, "%ld", count + 1);
+      for (i = 0; i < num; i++)          { tableBinding(temp, "", var[i]); fprintf(results, ",%s", temp + 3); }
+      for (i = 0; i < result->size; i++) fprintf(results, ",%.10g", (*result)[i]);
+      fprintf(results, "\n");
+      fflush(results);
+    }
+
     if (VERBOSE > 0 && result->size) {
       fprintf(stderr,"\n========================================================\n ");
       fprintf(stderr,"    %s : ", loopVarString);
@@ -272,3 +484,396 @@ void LoopObj::step() {
     }
 
 //**************************************************************************************************
+
+//**************************************************************************************************
+//  Sweep journal: a header identifying the script arguments, the loops and the tracked variables, 
+//  followed by a line per completed step, with its number, its outcome, the values of the loop
+//  variables and the tracked values (which are exact, so that the replayed track plots are identical)
+//**************************************************************************************************
+
+char *LoopObj::journalHeader(int argc, char **argv)
+{
+  int  i;
+  char *s, *t = makeMessage("%% CalC sweep journal: %ld steps\n%% arguments:", steps);
+
+  for (i = 2; i < argc; i++) { s = makeMessage("%s %s", t, argv[i]); delete [] t; t = s; }
+  s = makeMessage("%s\n", t); delete [] t; t = s;
+
+  for (i = 0; i < num; i++) {
+    if (tableName) s = makeMessage("%s%% table %s column %s\n", t, tableName, ids[i]);
+    else           s = makeMessage("%s%% for %s = %.17g step %.17g (%d values)\n", t, ids[i], var0[i], dvar[i], limit[i]);
+    delete [] t; t = s;
+  }
+  if (values) {
+    s = makeMessage("%s%% adaptive: tolerance %.17g, up to %ld points\n", t, tolerance, budget);
+    delete [] t; t = s;
+  }
+  s = makeMessage("%s%% step status", t); delete [] t; t = s;
+  for (i = 0; i < num; i++)          { s = makeMessage("%s %s", t, ids[i]);      delete [] t; t = s; }
+  for (i = 0; i < result->size; i++) { s = makeMessage("%s %s", t, trackIDs[i]); delete [] t; t = s; }
+  s = makeMessage("%s\n", t); delete [] t;
+  return s;
+}
+
+//**************************************************************************************************
+
+//  The journal is locked while the sweep runs: a concurrent run of the script with the same
+//  arguments keeps no journal (or stops, if it should resume from it). A journal that cannot be
+//  created is not an error: the sweep then runs without one
+
+long LoopObj::openJournal(const char *script, bool resume, int argc, char **argv)
+{
+  if ( !num || !(resume || journaled) ) return 0;
+
+  long done = 0;
+  int  status = STEP_DONE;
+
+  if (argc > 2) {        // the runs of the script with different arguments keep different journals
+    unsigned long hash = 2166136261UL;
+    for (int i = 2; i < argc; i++)
+      for (const char *p = argv[i]; ; p++) { hash = ( (hash ^ (unsigned char)*p) * 16777619UL ) & 0xffffffffUL;  if (!*p) break; }
+    journalName = makeMessage("%s.%08lx.journal", script, hash);
+  }
+  else journalName = makeMessage("%s.journal", script);
+
+  FILE *old = fopen(journalName, "a+");   // not truncated before it is locked
+  if (!old) {
+    fprintf(stderr, "\n*** Warning: could not create the sweep journal %s; the sweep cannot be resumed\n", journalName);
+    return 0;
+  }
+#ifndef _WIN32
+  struct flock lock;       // a record lock: the workers forked by "-j" do not inherit it
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  if ( fcntl(fileno(old), F_SETLK, &lock) ) {
+    fclose(old);
+    if (resume) throw makeMessage("Sweep journal %s is in use by another run of the script", journalName);
+    fprintf(stderr, "\n*** Warning: the sweep journal %s is in use by another run; the sweep cannot be resumed\n", journalName);
+    return 0;
+  }
+#endif
+
+  char *header = journalHeader(argc, argv);
+  char *copy   = makeMessage("%s", header);
+  rewind(old);
+  int  first = resume ? fgetc(old) : EOF;
+  if (resume && first == EOF && VERBOSE) fprintf(stderr, "\n### No sweep journal %s: running all the steps\n", journalName);
+
+  if (first != EOF) {
+    ungetc(first, old);
+    size_t n = strlen(header);
+    char   *text = new char[n + 1], *line = new char[n + 64 * (num + result->size) + 64];
+    bool   match = ( fread(text, 1, n, old) == n );
+    text[n] = 0;
+    if ( !match || !equal(text, header) ) {
+      fclose(old);
+      throw makeMessage("Sweep journal %s does not match the arguments, the \"for\" loops and the tracked "
+                        "variables of the script: delete it to run the sweep from the first step", journalName);
+    }
+
+    // replay the complete lines (the last one may be truncated if the sweep was killed)
+
+    while ( status != STEP_EXIT && done < steps && fgets(line, int(n + 64 * (num + result->size) + 64), old) ) {
+      char *p = line, *q;
+      if ( line[strlen(line) - 1] != '\n' ) break;
+      if ( strtol(p, &q, 10) != done || q == p ) break;
+      status = int( strtol(q, &p, 10) );
+
+      step();
+      bool valid = ( p != q );
+      for (int i = 0; i < num && valid; i++)          { valid = ( strtod(p, &q) == var[i] && q != p ); p = q; }
+      for (int i = 0; i < result->size && valid; i++) { (*result)[i] = strtod(p, &q); valid = (q != p); p = q; }
+      if (!valid) {
+        fclose(old);
+        throw makeMessage("Sweep journal %s: bad record of step %ld", journalName, done);
+      }
+      if (status == STEP_DONE) draw();
+      record(status);       // not journaled yet; refines an adaptive sweep
+
+      char *s = makeMessage("%s%s", copy, line);
+      delete [] copy; copy = s;
+      done++;
+    }
+    delete [] text; delete [] line;
+
+    if (VERBOSE) fprintf(stderr, "\n### Resuming the sweep: %ld of %ld steps completed\n", done, steps);
+    if (status == STEP_EXIT) done = steps;   // terminated by an "exit" statement
+  }
+
+  // (re)write the journal: the header, and the replayed steps without the truncated line, if any
+
+  fflush(old);
+  if ( ftruncate(fileno(old), 0) || fputs(copy, old) < 0 || fflush(old) ) {
+    fclose(old);
+    fprintf(stderr, "\n*** Warning: could not write the sweep journal %s; the sweep cannot be resumed\n", journalName);
+  }
+  else journal = old;
+  delete [] copy;
+  delete [] header;
+  return done;
+}
+
+//**************************************************************************************************
+
+void LoopObj::record(int status)
+{
+  if (values) {        // adaptive sweep: refined when all the current points are done
+    for (int i = 0; i < result->size; i++) values[count * result->size + i] = (status == STEP_DONE) ? (*result)[i] : NAN;
+    if      (status == STEP_EXIT)  writeAdaptive();
+    else if (count == steps - 1)   refine();
+  }
+  if (!journal) return;
+
+  fprintf(journal, "%ld %d", count, status);
+  for (int i = 0; i < num; i++)          fprintf(journal, " %.17g", var[i]);
+  for (int i = 0; i < result->size; i++) fprintf(journal, " %.17g", (*result)[i]);
+  fprintf(journal, "\n");
+  fflush(journal);          // flushed before the next worker is forked
+#ifndef _WIN32              // synced at most once a second, against a crash of the system
+  if ( long(time(NULL)) != synced ) { fsync( fileno(journal) );  synced = long(time(NULL)); }
+#endif
+}
+
+//**************************************************************************************************
+
+void LoopObj::closeJournal()
+{
+  if (!journal) return;
+  fclose(journal);
+  journal = 0;
+  remove(journalName);
+}
+
+//**************************************************************************************************
+//  Adaptive sweep: the points of the loop grid become the rows of a table (with the values the
+//  script would receive from the "for" loops), and each cell spans two points along each loop
+//**************************************************************************************************
+
+struct SweepPoint { double x[2]; long row; };
+
+static int byPoint(const void *a, const void *b) {
+  const SweepPoint *p = (const SweepPoint *)a, *q = (const SweepPoint *)b;
+  for (int i = 0; i < 2; i++)
+    if (p->x[i] != q->x[i]) return (p->x[i] < q->x[i]) ? -1 : 1;
+  return 0;
+}
+
+void LoopObj::setAdaptive(TokenString &TS) {
+
+  int  i, j, stride = 2 * num + 1;
+  long r, c, s;
+
+  if (table)   throw makeMessage("The adaptive sweep (\"sweep.adaptive\") cannot be combined with a parameter table");
+  if (num > 2) throw makeMessage("The adaptive sweep (\"sweep.adaptive\") supports one or two \"for\" loops");
+  if (!result->size) throw makeMessage("The adaptive sweep (\"sweep.adaptive\") requires a tracked variable");
+  for (i = 0; i < num; i++)
+    if (limit[i] < 2) throw makeMessage("The adaptive sweep requires at least two values of the loop variable %s", ids[i]);
+
+  tolerance = TS.get_param("sweep.adaptive");
+  budget    = 4 * steps;
+  TS.get_long_param("sweep.adaptive.points", &budget);
+  if (tolerance <= 0.0) throw makeMessage("The tolerance of the adaptive sweep (\"sweep.adaptive\") should be positive");
+  if (budget < steps) budget = steps;
+  if (budget > MAX_FOR_STEPS) budget = MAX_FOR_STEPS;
+
+  double *t = new double[budget * num];
+  for (r = 0; r < steps; r++)
+    for (i = 0; i < num; i++) t[r * num + i] = value(r, i);
+  table  = t;
+  values = new double[budget * result->size];
+  order  = new long[budget];
+
+  SweepPoint *p = new SweepPoint[steps];           // the index of findPoint(): the loop grid sorted
+  for (r = 0; r < steps; r++) {                    // by the loop values (a "step" may be negative)
+    p[r].x[1] = 0.0;
+    for (i = 0; i < num; i++) p[r].x[i] = table[r * num + i];
+    p[r].row = r;
+  }
+  qsort(p, steps, sizeof(SweepPoint), byPoint);
+  for (r = 0; r < steps; r++) order[r] = p[r].row;
+  delete [] p;
+  for (i = 0; i < num; i++) if (tp[i] != 'i') tp[i] = 't';
+
+  long coarse = 1;                  // each split adds a point (the center) and 2^num - 1 cells
+  for (i = 0; i < num; i++) coarse *= limit[i] - 1;
+  cells = new double[(coarse + budget * ((1 << num) - 1)) * stride];
+
+  for (c = 0; c < coarse; c++) {
+    double *cell = cells + cellNum++ * stride;
+    long   n = c;
+    for (i = num - 1; i >= 0; i--) {
+      long k = n % (limit[i] - 1);
+      n /= limit[i] - 1;
+      for (s = 1, j = i + 1; j < num; j++) s *= limit[j];     // the row stride of loop #i
+      cell[i]       = table[k * s * num + i];
+      cell[num + i] = table[(k + 1) * s * num + i];
+    }
+    cell[2 * num] = 0;
+  }
+
+  char prefix[256], name[MAX_STRING_LENGTH];
+  long pos;
+  strcpy(prefix, "");
+  if (TS.token_count("plot.print", &pos)) TS.line_string(pos + 1, prefix);
+  snprintf(name, MAX_STRING_LENGTH, "%sadaptive_results.csv", prefix);
+  if ( TS.token_count("sweep.adaptive.results") ) TS.get_string_param("sweep.adaptive.results", name);
+  adaptiveName = StrCpy(name);
+
+  if (VERBOSE) fprintf(stderr, "\n### Adaptive sweep: tolerance %g, up to %ld points\n", tolerance, budget);
+}
+
+//**************************************************************************************************
+
+static int comparePoint(const double *p, const double *q, int num) {
+  for (int i = 0; i < num; i++)
+    if (p[i] != q[i]) return (p[i] < q[i]) ? -1 : 1;
+  return 0;
+}
+
+long LoopObj::findPoint(const double *x, long *at) {   // the step of the point x, or -1 (and the
+                                                       // position of x in the sorted steps)
+  long lo = 0, hi = steps;
+  while (lo < hi) {
+    long k = (lo + hi) / 2;
+    int  c = comparePoint(table + order[k] * num, x, num);
+    if (!c) { if (at) *at = k;  return order[k]; }
+    if (c < 0) lo = k + 1; else hi = k;
+  }
+  if (at) *at = lo;
+  return -1;
+}
+
+void LoopObj::addPoint(const double *x) {              // a new step, at the point x
+  long at;
+  if ( findPoint(x, &at) >= 0 ) return;
+  for (int i = 0; i < num; i++) table[steps * num + i] = x[i];
+  memmove(order + at + 1, order + at, (steps - at) * sizeof(long));
+  order[at] = steps++;
+}
+
+//**************************************************************************************************
+//  Splits the cells over which a tracked value changes by more than the tolerance, the largest
+//  changes first, as long as their new points fit into the budget; if no point is added, the
+//  sweep is completed, and its results are written
+//**************************************************************************************************
+
+struct CellChange { double change; long cell; };
+
+static int byChange(const void *a, const void *b) {
+  double d = ((const CellChange *)b)->change - ((const CellChange *)a)->change;
+  return (d > 0) - (d < 0);
+}
+
+bool LoopObj::splitNode(int m, double *x, const double *cell, const double *mid, int halved) {  // node #m of 3^num
+  for (int i = 0; i < num; i++, m /= 3) {
+    if ( m % 3 == 1 && !((halved >> i) & 1) ) return false;   // no middle along a loop that is not halved
+    x[i] = (m % 3 == 0) ? cell[i] : (m % 3 == 1) ? mid[i] : cell[num + i];
+  }
+  return true;
+}
+
+void LoopObj::refine() {
+
+  int  i, j, m, halved, stride = 2 * num + 1, corners = 1 << num, nodes = (num == 1) ? 3 : 9;
+  long c, k, n = 0, added = 0, split = 0, stuck = 0, row[4];
+  double x[2], mid[2], old[5];
+  CellChange *list = new CellChange[cellNum];
+
+  for (c = 0; c < cellNum; c++) {          // the largest change of a tracked value over the corners
+    double *cell = cells + c * stride, change = 0.0;
+    for (i = 0; i < num; i++) if ( tp[i] != 'i' || fabs(cell[num + i] - cell[i]) > 1.5 ) break;
+    bool splittable = i < num && cell[2 * num] < MAX_REFINE_LEVEL;   // not with no integer between the
+                                                                     // corners along any loop
+    for (m = 0; m < corners; m++) {
+      for (i = 0; i < num; i++) x[i] = cell[ ((m >> i) & 1) ? num + i : i ];
+      row[m] = findPoint(x);
+    }
+    for (j = 0; j < result->size && change >= 0.0; j++) {
+      double lo = 0.0, hi = 0.0;
+      for (m = 0; m < corners; m++) {
+        double v = (row[m] < 0) ? NAN : values[row[m] * result->size + j];
+        if (v != v) { change = -1.0; break; }      // a step that was not drawn
+        if (!m || v < lo) lo = v;
+        if (!m || v > hi) hi = v;
+      }
+      if (change >= 0.0 && hi - lo > change) change = hi - lo;
+    }
+    if (change <= tolerance) continue;
+    if (splittable) { list[n].change = change; list[n].cell = c; n++; }
+    else stuck++;
+  }
+  qsort(list, n, sizeof(CellChange), byChange);
+
+  for (k = 0; k < n; k++) {
+    double *cell = cells + list[k].cell * stride;
+    long   need = 0;
+
+    for (i = 0; i < stride; i++) old[i] = cell[i];
+    for (halved = i = 0; i < num; i++) {     // the loops along which the cell is halved
+      mid[i] = 0.5 * (old[i] + old[num + i]);
+      if (tp[i] == 'i') {
+        if ( fabs(old[num + i] - old[i]) < 1.5 ) continue;
+        mid[i] = floor(mid[i] + 1.0e-6);
+      }
+      halved |= 1 << i;
+    }
+
+    for (m = 0; m < nodes; m++) {            // the nodes of the split cell: the lower, middle or
+      if ( !splitNode(m, x, old, mid, halved) ) continue;    // upper coordinate along each loop
+      if ( findPoint(x) < 0 ) need++;
+    }
+    if (steps + need > budget) break;        // the budget is exhausted
+
+    for (m = 0; m < nodes; m++)
+      if ( splitNode(m, x, old, mid, halved) ) addPoint(x);
+    added += need;
+    split++;
+
+    bool first = true;
+    for (m = 0; m < corners; m++) {          // the cell is replaced by its halves (quarters)
+      if (m & ~halved) continue;
+      double *sub = first ? cell : cells + cellNum++ * stride;
+      for (i = 0; i < num; i++) {
+        sub[i]       = ((m >> i) & 1) ? mid[i] : old[i];
+        sub[num + i] = ((m >> i) & 1) ? old[num + i] : ( ((halved >> i) & 1) ? mid[i] : old[num + i] );
+      }
+      sub[2 * num] = old[2 * num] + 1;
+      first = false;
+    }
+  }
+  delete [] list;
+
+  if (VERBOSE) fprintf(stderr, "\n### Adaptive sweep: %ld cells over the tolerance, %ld split, %ld unsplittable; %ld points added (%ld of %ld)\n",
+                       n + stuck, split, stuck, added, steps, budget);
+  if (added) return;
+  if (stuck) fprintf(stderr, "\n*** Warning: the adaptive sweep ends with %ld cells over the tolerance that cannot be split "
+                             "(integer spacing or %d refinements reached)\n", stuck, MAX_REFINE_LEVEL);
+  writeAdaptive();
+}
+
+//**************************************************************************************************
+//  The results of the steps done so far, sorted by the loop variables
+//**************************************************************************************************
+
+void LoopObj::writeAdaptive() {
+
+  long r, rows = count + 1;
+  int  i;
+  char temp[1024];
+
+  FILE *f = fopenAssure(adaptiveName, "w", "writing", "the adaptive sweep results");
+  for (i = 0; i < num; i++)          fprintf(f, "%s%s", i ? "," : "", ids[i]);
+  for (i = 0; i < result->size; i++) fprintf(f, ",%s", trackIDs[i]);
+  fprintf(f, "\n");
+
+  for (long k = 0; k < steps; k++) {
+    if ( (r = order[k]) >= rows ) continue;       // not done: the sweep was ended by "exit"
+    for (i = 0; i < num; i++)          { tableBinding(temp, "", table[r * num + i]); fprintf(f, "%s%s", i ? "," : "", temp + 3); }
+    for (i = 0; i < result->size; i++) fprintf(f, ",%.10g", values[r * result->size + i]);
+    fprintf(f, "\n");
+  }
+  fclose(f);
+
+  if (VERBOSE) fprintf(stderr, "\n### Adaptive sweep: %ld points written to %s\n", rows, adaptiveName);
+}
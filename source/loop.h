@@ -5,7 +5,8 @@
  *
  *                               loop.h
  *
- *  LoopObj variable contains data for the (nested) "for" loop script statement
+ *  LoopObj variable contains data for the (nested) "for" loop script statement,
+ *  or for the rows of a parameter table ("sweep.table = file")
  *
  **************************************************************************
  
@@ -30,6 +31,8 @@
 #define CALC_LOOP_H_included
 
 #define MAX_FOR_STEPS 1000000
+#define MAX_TABLE_COLUMNS 64
+#define MAX_REFINE_LEVEL  20
 
 class LoopObj
 {
@@ -49,14 +52,63 @@ public:
   int       *index, *limit;
   char      **ids, **trackIDs, *tp;
 
+  // Parameter table ("sweep.table = file"): the loop variables are the columns of the table, 
+  // and each row is a step; the tracked values of each step are written as a row of "results"
+
+  double    *table;      // steps x num values, or 0 for "for" loops
+  char      *tableName;
+  FILE      *results;
+
+  void readTable(TokenString &);
+
+  // Adaptive sweep ("sweep.adaptive = tolerance", with one or two "for" loops): the loop grid is
+  // the coarse grid, stored as a table. When all its points are done, the cells over which a 
+  // tracked value changes by more than the tolerance are halved in each dimension, and the new 
+  // points are appended as steps, up to "sweep.adaptive.points" steps; the results of all points 
+  // are then written to "sweep.adaptive.results", sorted by the loop variables. An integer loop
+  // keeps integer values: its midpoints are rounded down, and a cell of width 1 is not halved along it
+
+  double    tolerance;
+  long      budget;
+  double    *values;     // tracked values of each step (NaN if the step was not drawn)
+  double    *cells;      // per cell: the lower corner, the upper corner and the level
+  long      cellNum;
+  long      *order;      // the steps sorted by their loop values, for findPoint()
+  char      *adaptiveName;
+
+  void setAdaptive(TokenString &);
+  long findPoint(const double *x, long *at = 0);
+  void addPoint(const double *x);
+  bool splitNode(int m, double *x, const double *cell, const double *mid, int halved);
+  void refine();
+  void writeAdaptive();
+
   LoopObj(TokenString &, VectorObj *);
   ~LoopObj();
  
   int  operator()() { return num; }
   void step();
   void draw();
+  double value(long n, int i);  // value of loop variable #i at step #n, as set by step()
+  void bindings(long n, char *s); // loop variable string of step #n, as set by step()
+
+  // Journal of the completed steps ("script.journal", or "script.<hash>.journal" for a script with
+  // arguments), kept with "--resume" or "sweep.journal = on", appended to after each step and 
+  // removed when the sweep is completed. With "--resume", the steps recorded in the journal of an 
+  // interrupted sweep are replayed (their tracked values drawn) instead of being run again
+
+  FILE *journal;
+  char *journalName;
+  bool journaled;              // "sweep.journal = on"
+  long synced;                 // the time of the last fsync of the journal
+
+  long openJournal(const char *script, bool resume, int argc, char **argv);  // returns the number of steps replayed
+  void record(int status);     // the outcome of the current step (see sweep.h), and its tracked values
+  void closeJournal();
+  char *journalHeader(int argc, char **argv);
 };
 
+int  getLoopVarNum(TokenString &);    // the number of "for" loops, or of parameter table columns
 int  getTrackVarNum(TokenString &);
 long getTrackVar(TokenString &TS, int n, int * = 0, int * = 0);
 
@@ -40,7 +40,7 @@
 #include "syntax.h"
 #include "markov.h"
 
-double *MarkovObj::errorTolerance = 0;
+thread_local double *MarkovObj::errorTolerance = 0;
 
 //**************************************************************************
 
@@ -65,7 +65,7 @@ double MarkovObj::Evaluate(double Time)
 
      for (int subdivisions = 0; subdivisions < steps; subdivisions++) {
        currentTime += Tstep;
-       double random = double(rand()) / (double(RAND_MAX) + 1.0);
+       double random = double(randomNumber()) / (double(RANDOM_MAX) + 1.0);
        index = state * (States - 1);
        double sum = 0;
        for (int j=0; j<States; j++) {
@@ -49,7 +49,7 @@ protected:
 
 public:
 
-  static double *errorTolerance;  /* bound to m_ODEaccuracy in SimulationObj constructor */
+  static thread_local double *errorTolerance;  /* bound to m_ODEaccuracy in SimulationObj constructor */
   int    States; /* number of discrete states */
   int    state;  /* current state of the markov variable (an integer) */
   double dstate; /* same, but float value */
@@ -0,0 +1,406 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             native.cpp
+ *
+ *  Native code generation for the right-hand sides of the ODEs and the
+ *  time-dependent (auxiliary) variables of the KineticObj ("ODE.compile = native")
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include "syntax.h"
+#include "native.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <dlfcn.h>
+  #include <errno.h>
+  #include <sys/stat.h>
+#endif
+
+extern thread_local int VERBOSE;
+
+//**************************************************************************
+//  The preamble of the generated source. The helper functions reproduce the
+//  semantics of binary() and function() in syntax.cpp exactly, and the code is
+//  compiled without floating-point contraction, so that the compiled model
+//  produces results identical to those of the interpreter
+//**************************************************************************
+
+static const char *nativePreamble =
+"#include <math.h>\n"
+"static inline double op_mul(double a, double b) { return (a == 0.0 || b == 0.0) ? 0.0 : a * b; }\n"
+"static inline double op_div(double a, double b) { return (b != 0) ? a / b : a; }\n"
+"static inline double op_mod(double a, double b) { return double( int(a) % int(b) ); }\n"
+"static inline double fn_bracket(double x) { return x; }\n"
+"static inline double fn_not(double x)   { return (x > 0) ? 0 : 1; }\n"
+"static inline double fn_int(double x)   { return double(int(x)); }\n"
+"static inline double fn_sqr(double x)   { return x * x; }\n"
+"static inline double fn_theta(double x) { if (x == 0.0) return 0.5; else return (x > 0) ? 1 : 0; }\n"
+"static inline double fn_sigma(double x) { return 0.5 * (1 + tanh(x)); }\n\n";
+
+static const char *nativeFunctionName(int Type)
+{
+	switch (Type) {
+	case BRACKET: return "fn_bracket";
+	case T_NOT:   return "fn_not";
+	case T_INT:   return "fn_int";
+	case T_COSH:  return "cosh";
+	case T_SINH:  return "sinh";
+	case T_COS:   return "cos";
+	case T_SIN:   return "sin";
+	case T_TANH:  return "tanh";
+	case T_TAN:   return "tan";
+	case T_ATAN:  return "atan";
+	case T_EXP:   return "exp";
+	case T_LOG:   return "log";
+	case T_LOG10: return "log10";
+	case T_SQR:   return "fn_sqr";
+	case T_ABS:   return "fabs";
+	case T_SQRT:  return "sqrt";
+	case T_THETA: return "fn_theta";
+	case T_SIGMA: return "fn_sigma";
+	default:      throw makeMessage("Function %d cannot be compiled", Type);
+	}
+}
+
+//**************************************************************************
+
+static void emitBinary(FILE *f, int op, char *a, const char *b, int &temp_num)
+{
+	char t[24];
+	sprintf(t, "t%d", temp_num++);
+
+	switch (op) {
+	case T_PLUS:  fprintf(f, "  double %s = %s + %s;\n", t, a, b); break;
+	case T_MINUS: fprintf(f, "  double %s = %s - %s;\n", t, a, b); break;
+	case T_OR:    fprintf(f, "  double %s = ( (%s > 0) || (%s > 0) ) ? 1 : 0;\n", t, a, b); break;
+	case T_AND:   fprintf(f, "  double %s = ( (%s > 0) && (%s > 0) ) ? 1 : 0;\n", t, a, b); break;
+	case T_GT:    fprintf(f, "  double %s = (%s > %s)  ? 1 : 0;\n", t, a, b); break;
+	case T_GE:    fprintf(f, "  double %s = (%s >= %s) ? 1 : 0;\n", t, a, b); break;
+	case T_LT:    fprintf(f, "  double %s = (%s < %s)  ? 1 : 0;\n", t, a, b); break;
+	case T_LE:    fprintf(f, "  double %s = (%s <= %s) ? 1 : 0;\n", t, a, b); break;
+	case T_EQ:    fprintf(f, "  double %s = (%s == %s) ? 1 : 0;\n", t, a, b); break;
+	case T_NEQ:   fprintf(f, "  double %s = (%s != %s) ? 1 : 0;\n", t, a, b); break;
+	case T_MULT:  fprintf(f, "  double %s = op_mul(%s, %s);\n", t, a, b); break;
+	case T_DIV:   fprintf(f, "  double %s = op_div(%s, %s);\n", t, a, b); break;
+	case T_MOD:   fprintf(f, "  double %s = op_mod(%s, %s);\n", t, a, b); break;
+	case T_POWER: fprintf(f, "  double %s = pow(%s, %s);\n", t, a, b); break;
+	default:      throw makeMessage("Unknown binary operator %d", op);
+	}
+	strcpy(a, t);
+}
+
+//**************************************************************************
+
+int NativeKinetics::addPointer(double *ptr)
+{
+	for (int k = 0; k < pointer_num; k++) if (pointers[k] == ptr) return k;
+	if (pointer_num == pointer_max) {
+		double **temp = new double *[pointer_max = 2 * pointer_max + 16];
+		for (int k = 0; k < pointer_num; k++) temp[k] = pointers[k];
+		delete [] pointers;
+		pointers = temp;
+	}
+	pointers[pointer_num] = ptr;
+	return pointer_num++;
+}
+
+//**************************************************************************
+
+int NativeKinetics::addConstant(double val)
+{
+	if (constant_num == constant_max) {
+		double *temp = new double[constant_max = 2 * constant_max + 16];
+		for (int k = 0; k < constant_num; k++) temp[k] = constants[k];
+		delete [] constants;
+		constants = temp;
+	}
+	constants[constant_num] = val;
+	return constant_num++;
+}
+
+//**************************************************************************
+//  Mirrors ExpressionObj::Evaluate(), emitting one statement per operation;
+//  a non-finite result of any (sub-)expression makes the function return
+//  (1 + index), where the interpreter would have thrown an error
+//**************************************************************************
+
+void NativeKinetics::emitExpression(FILE *f, ExpressionObj *E, int *firstTerm, char *result, int index)
+{
+	int  pr, unaryOp = 0;
+	int  opStack[priorityLevels];
+	char valStack[priorityLevels + 1][24];
+	int  j, j0, stackHead = 0;
+
+	if (E->term_num <= 0) { sprintf(result, "C[%d]", addConstant(0.0)); return; }
+	j0 = firstTerm ? *firstTerm : 0;
+
+	for (j = j0; j < E->term_num; j ++) {
+
+		struct TermStruct &term = E->term_array[j];
+		int  Type = term.type;
+		char *val = valStack[ stackHead ];
+
+		if ( isUnary(Type) ) { unaryOp = Type; continue; }
+
+		if ( isBinary(Type) ) {
+			pr = priority[ Type ];
+			while ( stackHead )
+				if ( priority[ opStack[stackHead - 1] ] <= pr ) {
+					stackHead --;
+					emitBinary( f, opStack[stackHead], valStack[stackHead], valStack[stackHead+1], temp_num );
+				} else break;
+			opStack[ stackHead++ ] = Type;
+			continue;
+		}
+
+		if ( Type == BR_CLOSE )  break;
+
+		if ( isFunction(Type) ) {
+			char arg[24];
+			j ++;
+			emitExpression(f, E, &j, arg, index);
+			sprintf(val, "t%d", temp_num++);
+			fprintf(f, "  double %s = %s(%s);\n", val, nativeFunctionName(Type), arg);
+		}
+		else if ( Type == NUMBER_TYPE )  sprintf(val, "C[%d]", addConstant(term.val));
+		else if ( Type == POINTER_TYPE ) sprintf(val, "(*P[%d])", addPointer(term.ptr));
+		else throw makeMessage("Cannot compile expression { %s }: unknown term %d\n", E->formula, Type);
+
+		if (unaryOp) {
+			if (unaryOp == T_UNARY_NOT) {
+				char t[24];
+				sprintf(t, "t%d", temp_num++);
+				fprintf(f, "  double %s = (%s > 0) ? 0 : 1;\n", t, val);
+				strcpy(val, t);
+			}
+			unaryOp = 0;
+		}
+	}
+
+	if (firstTerm) *firstTerm = j;
+	while ( stackHead-- )
+		emitBinary( f, opStack[stackHead], valStack[stackHead], valStack[stackHead+1], temp_num );
+
+	fprintf(f, "  if ( !isfinite(%s) ) return %d;\n", valStack[0], index + 1);
+	strcpy(result, valStack[0]);
+}
+
+//**************************************************************************
+
+void NativeKinetics::emitFunction(FILE *f, const char *name, ExpressionObj **formulas, int first, int num)
+{
+	char result[24];
+
+	fprintf(f, "extern \"C\" int %s(double * const *P, const double *C, double *result)\n{\n", name);
+	for (int i = 0; i < num; i++) {
+		fprintf(f, " { // %s #%d\n", name, i + 1);  // no formula text: constants must not affect the hash
+		emitExpression(f, formulas[first + i], 0, result, i);
+		fprintf(f, "  result[%d] = %s;\n }\n", i, result);
+	}
+	fprintf(f, " return 0;\n}\n\n");
+}
+
+//**************************************************************************
+
+#ifndef _WIN32
+
+//**************************************************************************
+//  The cache directory, created if needed: it should belong to the user, and
+//  not be writable by the others
+
+static bool privateDir(const char *dir)
+{
+	struct stat st;
+	if ( mkdir(dir, 0700) && errno != EEXIST ) return false;
+	return lstat(dir, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+static bool cacheDir(char *dir, size_t n)
+{
+	const char *env = getenv("CALC_NATIVE_DIR");
+	if (env && *env) snprintf(dir, n, "%s", env);
+	else {
+		char base[MAX_STRING_LENGTH];
+		if ( (env = getenv("XDG_CACHE_HOME")) && *env ) snprintf(base, sizeof(base), "%s", env);
+		else if ( (env = getenv("HOME")) && *env ) {
+			snprintf(base, sizeof(base), "%s/.cache", env);
+			mkdir(base, 0700);
+		}
+		else return false;
+		snprintf(dir, n, "%.1900s/%s", base, NATIVE_DEFAULT_DIR);
+	}
+	return privateDir(dir);
+}
+
+//**************************************************************************
+//  A cached object is trusted if it is a regular file of the user, which the
+//  others cannot modify
+
+static bool trustedFile(const char *path)
+{
+	struct stat st;
+	return lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == getuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+#endif
+
+//**************************************************************************
+//  The object is built under a unique temporary name (the threads of a process
+//  may compile at the same time), then renamed into the cache in one step
+
+bool NativeKinetics::compile(const char *dir, const char *source, const char *object)
+{
+#ifdef _WIN32
+	return false;
+#else
+	char  command[4*MAX_STRING_LENGTH], temp[MAX_STRING_LENGTH], log[MAX_STRING_LENGTH + 8];
+	const char *cxx = getenv("CXX");
+
+	if (!cxx || !*cxx) cxx = NATIVE_DEFAULT_CXX;
+	snprintf(temp, sizeof(temp), "%.2000s/calc_ode_XXXXXX.so", dir);
+	int fd = mkstemps(temp, 3);
+	if (fd < 0) return false;
+	close(fd);
+	snprintf(log, sizeof(log), "%s.log", temp);
+	snprintf(command, sizeof(command), "%s %s -o \"%s\" \"%s\" > \"%s\" 2>&1", cxx, NATIVE_CXX_FLAGS, temp, source, log);
+
+	if (VERBOSE) fprintf(stderr, "\n### Compiling the ODE right-hand sides: %s\n", command);
+	if ( system(command) != 0 ) {
+		snprintf(command, sizeof(command), "%s.log", object);
+		rename(log, command);
+		remove(temp);
+		return false;
+	}
+	remove(log);
+	if ( rename(temp, object) ) { remove(temp); return false; }
+	return true;
+#endif
+}
+
+//**************************************************************************
+
+NativeKinetics::NativeKinetics(ExpressionObj **formulas, int ident_num, int var_num)
+{
+	pointer_num = constant_num = pointer_max = constant_max = temp_num = 0;
+	pointers  = 0;
+	constants = 0;
+	identFn   = derivFn = 0;
+	handle    = 0;
+	ok        = false;
+
+#ifdef _WIN32
+	if (VERBOSE) fprintf(stderr, "\n### Native ODE compilation is not available on this platform; using the interpreter\n");
+#else
+	int  i, j;
+	char dir[MAX_STRING_LENGTH], temp[MAX_STRING_LENGTH], source[MAX_STRING_LENGTH], object[MAX_STRING_LENGTH];
+
+	for (i = 0; i < ident_num + var_num; i++)
+		for (j = 0; j < formulas[i]->term_num; j++)
+			if (formulas[i]->term_array[j].type == T_RAND) {
+				if (VERBOSE) fprintf(stderr, "\n### Expressions with rand() are not compiled; using the interpreter\n");
+				return;
+			}
+
+	if ( !cacheDir(dir, 2000) ) {
+		if (VERBOSE) fprintf(stderr, "\n### No private cache directory for the compiled ODEs (%s); using the interpreter\n", dir);
+		return;
+	}
+
+	// 1. Generate the source, and compute its hash (FNV-1a):
+
+	snprintf(temp, sizeof(temp), "%.1990s/calc_ode_XXXXXX.cpp", dir);
+	int   fd = mkstemps(temp, 4);
+	FILE *f  = (fd < 0) ? 0 : fdopen(fd, "w");
+	if (!f) {
+		if (fd >= 0) { close(fd); remove(temp); }
+		if (VERBOSE) fprintf(stderr, "\n### Cannot write %s; using the interpreter\n", temp);
+		return;
+	}
+
+	fprintf(f, "%s", nativePreamble);
+	emitFunction(f, "calc_ident", formulas, 0, ident_num);
+	emitFunction(f, "calc_deriv", formulas, ident_num, var_num);
+	fclose(f);
+
+	unsigned long long hash = 14695981039346656037ULL;
+	int c;
+	f = fopen(temp, "r");
+	while ( (c = fgetc(f)) != EOF ) { hash ^= (unsigned char)c; hash *= 1099511628211ULL; }
+	fclose(f);
+
+	snprintf(source, sizeof(source), "%.1990s/calc_ode_%016llx.cpp", dir, hash);
+	snprintf(object, sizeof(object), "%.1990s/calc_ode_%016llx.so",  dir, hash);
+
+	// 2. Compile, unless a trusted shared object built from the same source already exists:
+
+	if ( trustedFile(object) ) {
+		remove(temp);
+		if (VERBOSE) fprintf(stderr, "\n### Using the cached compiled ODE right-hand sides %s\n", object);
+	}
+	else {
+		rename(temp, source);
+		if ( !compile(dir, source, object) || !trustedFile(object) ) {
+			if (VERBOSE) fprintf(stderr, "\n### Native compilation failed (see %s.log); using the interpreter\n", object);
+			return;
+		}
+	}
+
+	// 3. Load:
+
+	handle = dlopen(object, RTLD_NOW | RTLD_LOCAL);
+	if (handle) {
+		identFn = (NativeFunction) dlsym(handle, "calc_ident");
+		derivFn = (NativeFunction) dlsym(handle, "calc_deriv");
+	}
+	if (!identFn || !derivFn) {
+		if (VERBOSE) fprintf(stderr, "\n### Cannot load %s (%s); using the interpreter\n", object, dlerror());
+		return;
+	}
+
+	ok = true;
+	if (VERBOSE) fprintf(stderr, "  # %d expression(s) compiled: %d variable(s), %d constant(s)\n",
+	                     ident_num + var_num, pointer_num, constant_num);
+#endif
+}
+
+NativeKinetics::~NativeKinetics()
+{
+	delete [] pointers;
+	delete [] constants;
+#ifndef _WIN32
+	if (handle) dlclose(handle);
+#endif
+}
+
+//**************************************************************************
+//@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -0,0 +1,83 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                              native.h
+ *
+ *  Native code generation for the right-hand sides of the ODEs and the
+ *  time-dependent (auxiliary) variables of the KineticObj ("ODE.compile = native").
+ *  The formulas are translated into C++ source, compiled into a shared object
+ *  by the local C++ compiler and loaded with dlopen(). The shared object is
+ *  cached under a name derived from a hash of the generated source, which
+ *  depends only on the model structure, so repeated runs and sweep steps
+ *  reuse it. Numerical constants and variable addresses are passed at run time.
+ *  The cache is a private directory of the user (mode 0700); a cached object
+ *  is loaded only if it is a regular file of the user, not writable by others,
+ *  and is rebuilt otherwise.
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_NATIVE_H_included
+#define CALC_NATIVE_H_included
+
+// Compiler command and cache directory (under $XDG_CACHE_HOME, or ~/.cache); can be
+// overridden by the environment variables CXX and CALC_NATIVE_DIR:
+
+#define NATIVE_DEFAULT_CXX  "c++"
+#define NATIVE_DEFAULT_DIR  "calc"
+#define NATIVE_CXX_FLAGS    "-O2 -fPIC -shared -ffp-contract=off"
+
+//*************************************************************************************
+
+typedef int (*NativeFunction)(double * const *P, const double *C, double *result);
+
+class NativeKinetics
+{
+  int      pointer_max, constant_max, temp_num;
+
+  int      addPointer (double *ptr);
+  int      addConstant(double val);
+  void     emitExpression(FILE *f, ExpressionObj *E, int *firstTerm, char *result, int index);
+  void     emitFunction  (FILE *f, const char *name, ExpressionObj **formulas, int first, int num);
+  bool     compile(const char *dir, const char *source, const char *object);
+  void     *handle;      // of the loaded shared object
+
+ public:
+
+  NativeFunction identFn, derivFn;
+  double   **pointers;   // distinct variable addresses referenced by the formulas
+  double   *constants;   // numerical constants of the formulas, in the order of appearance
+  int      pointer_num, constant_num;
+  bool     ok;           // false if the code could not be generated, compiled or loaded
+
+  NativeKinetics(ExpressionObj **formulas, int ident_num, int var_num);
+ ~NativeKinetics();
+
+  // Both return zero on success, or (1 + index) of the first formula that returned
+  // a non-finite value, in which case the interpreter should be used to report the error
+
+  int evalIdent(double *ident) { return identFn(pointers, constants, ident); }
+  int evalDeriv(double *dvar)  { return derivFn(pointers, constants, dvar);  }
+};
+
+//*************************************************************************************
+
+#endif
@@ -0,0 +1,424 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                            optimize.cpp
+ *
+ *  Whole-model optimization of the formulas of the KineticObj ("ODE.optimize = on"):
+ *  common subexpression elimination, constant hoisting and power strength reduction
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>  // for compatibility with Visual C++
+#include <stdarg.h>
+#include "syntax.h"
+#include "optimize.h"
+
+extern thread_local int VERBOSE;
+
+#define OPT_CONST    0   // constant: the register is set on construction, no instruction
+#define OPT_LOAD     1   // reg[dst] = *ptr
+#define OPT_BINARY   2   // reg[dst] = reg[a] op reg[b], as in binary()
+#define OPT_FUNCTION 3   // reg[dst] = op( reg[a] ), as in function(); reg[a] is a nested expression
+#define OPT_NOT      4   // reg[dst] = !reg[a] (unary "not")
+#define OPT_MUL      5   // reg[dst] = reg[a] * reg[b], from a reduced power
+#define OPT_RECIP    6   // reg[dst] = 1 / reg[a],       from a reduced power
+#define OPT_EVAL     7   // reg[dst] = formulas[formula]->Evaluate(), for the expressions calling rand()
+#define OPT_STORE    8   // result[b] = reg[a]
+
+//**************************************************************************
+//  Same semantics as binary() and function() in syntax.cpp
+//**************************************************************************
+
+static inline double applyBinary(int op, double a, double b)
+{
+	switch(op) {
+	case T_PLUS:  return a + b;
+	case T_MINUS: return a - b;
+	case T_OR:    return ( (a > 0) || (b > 0) ) ? 1 : 0;
+	case T_AND:   return ( (a > 0) && (b > 0) ) ? 1 : 0;
+	case T_GT:    return (a > b)  ? 1 : 0;
+	case T_GE:    return (a >= b) ? 1 : 0;
+	case T_LT:    return (a < b)  ? 1 : 0;
+	case T_LE:    return (a <= b) ? 1 : 0;
+	case T_EQ:    return (a == b) ? 1 : 0;
+	case T_NEQ:   return (a != b) ? 1 : 0;
+	case T_MULT:  return (a == 0.0 || b == 0.0) ? 0.0 : a * b;
+	case T_DIV:   return (b != 0) ? a / b : a;
+	case T_MOD:   return double ( int(a) % int(b) );
+	case T_POWER: return pow(a, b);
+	default:      throw makeMessage("Unknown binary operator %d", op);
+	}
+}
+
+static inline double applyFunction(int op, double x)
+{
+	switch (op)
+	{
+	case BRACKET:   return x;
+	case T_NOT:     return (x > 0) ? 0 : 1;
+	case T_INT:     return double(int(x));
+	case T_COSH:    return cosh(x);
+	case T_SINH:    return sinh(x);
+	case T_COS:     return cos(x);
+	case T_SIN:     return sin(x);
+	case T_TANH:    return tanh(x);
+	case T_TAN:     return tan(x);
+	case T_ATAN:    return atan(x);
+	case T_EXP:     return exp(x);
+	case T_LOG:     return log(x);
+	case T_LOG10:   return log10(x);
+	case T_SQR:     return x * x;
+	case T_ABS:     return fabs( x );
+	case T_SQRT:    return sqrt(x);
+	case T_THETA:   if (x == 0.0 ) return 0.5; else return (x > 0) ? 1 : 0;
+	case T_SIGMA:   return 0.5 * (1 + tanh(x) );
+	default:        throw makeMessage("Unknown function %d", op);
+	}
+}
+
+static inline bool isCommutative(int code, int op)
+{
+	if (code == OPT_MUL) return true;
+	return code == OPT_BINARY && ( op == T_PLUS || op == T_MULT || op == T_EQ || op == T_NEQ || op == T_AND || op == T_OR );
+}
+
+//**************************************************************************
+//  Hash-consing of the nodes: returns the index of an identical node, or -1
+//**************************************************************************
+
+static unsigned long nodeHash(const OptNode &n)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	const unsigned char *p;
+	size_t k;
+
+	unsigned long long key[6] = { (unsigned long long)(n.code * 256 + n.op), (unsigned long long)n.a,
+	                              (unsigned long long)n.b, (unsigned long long)n.version, 0, (unsigned long long)n.ptr };
+	memcpy(&key[4], &n.val, sizeof(double));
+	for (p = (const unsigned char *)key, k = 0; k < sizeof(key); k++) { h ^= p[k]; h *= 1099511628211ULL; }
+	return (unsigned long)(h ^ (h >> 29));
+}
+
+static bool sameNode(const OptNode &n1, const OptNode &n2)
+{
+	return n1.code == n2.code && n1.op == n2.op && n1.a == n2.a && n1.b == n2.b && n1.version == n2.version
+	    && n1.ptr == n2.ptr && memcmp(&n1.val, &n2.val, sizeof(double)) == 0;
+}
+
+int OptimizedKinetics::find(OptNode &n)
+{
+	for (unsigned long h = nodeHash(n) & (hashSize - 1); hashTable[h] >= 0; h = (h + 1) & (hashSize - 1))
+		if ( sameNode(nodes[ hashTable[h] ], n) ) return hashTable[h];
+	return -1;
+}
+
+//**************************************************************************
+
+void OptimizedKinetics::emit(char code, char op, int dst, int a, int b, double *ptr)
+{
+	OptInstr &I = prog[ (*length)++ ];
+	I.code = code;  I.op = op;  I.dst = dst;  I.a = a;  I.b = b;  I.ptr = ptr;
+	I.formula = formulaIndex;
+}
+
+//**************************************************************************
+//  Returns the node of the subexpression, creating it (and the instruction
+//  computing it) if it has not been encountered before
+//**************************************************************************
+
+int OptimizedKinetics::node(char code, char op, int a, int b, double val, double *ptr)
+{
+	OptNode n;
+	int     k;
+
+	if ( isCommutative(code, op) && a > b ) { k = a; a = b; b = k; }
+
+	n.code = code;  n.op = op;  n.a = a;  n.b = b;  n.val = val;  n.ptr = ptr;  n.version = 0;
+	if ( code == OPT_LOAD && ptr >= ident && ptr < ident + ident_num ) n.version = storeCount[ ptr - ident ];
+
+	if ( (k = find(n)) >= 0 ) {
+		if (code != OPT_CONST) shared++;
+		return k;
+	}
+
+	if (node_num == node_max) throw makeMessage("ODE formula optimizer: too many subexpressions");
+	k = node_num++;
+	nodes[k] = n;
+
+	unsigned long h;
+	for (h = nodeHash(n) & (hashSize - 1); hashTable[h] >= 0; h = (h + 1) & (hashSize - 1)) ;
+	hashTable[h] = k;
+
+	if (code != OPT_CONST) emit(code, op, k, a, b, ptr);
+	return k;
+}
+
+int OptimizedKinetics::number(double val)    { return node(OPT_CONST, 0, -1, -1, val); }
+int OptimizedKinetics::variable(double *ptr) { return node(OPT_LOAD,  0, -1, -1, 0.0, ptr); }
+
+//**************************************************************************
+
+int OptimizedKinetics::binaryNode(int op, int a, int b)
+{
+	if ( nodes[a].code == OPT_CONST && nodes[b].code == OPT_CONST ) {     // hoist a constant subexpression
+		double v = applyBinary(op, nodes[a].val, nodes[b].val);
+		if ( _finite(v) ) { hoisted++; return number(v); }
+	}
+
+	if ( op == T_POWER && nodes[b].code == OPT_CONST ) {                   // x^n with a small integer n
+		double e = nodes[b].val;
+		if ( e == floor(e) && fabs(e) <= OPT_MAX_POWER ) { powers++; return powerNode(a, int(e)); }
+	}
+
+	return node(OPT_BINARY, char(op), a, b);
+}
+
+//**************************************************************************
+
+int OptimizedKinetics::powerNode(int a, int n)
+{
+	int p, m = (n < 0) ? -n : n;
+
+	if (m == 0) return number(1.0);                 // pow(x, 0) = 1 for any x
+	if (m == 1) p = a;
+	else {
+		int sq = node(OPT_MUL, 0, a, a);
+		if      (m == 2) p = sq;
+		else if (m == 3) p = node(OPT_MUL, 0, sq, a);
+		else             p = node(OPT_MUL, 0, sq, sq);
+	}
+
+	return (n < 0) ? node(OPT_RECIP, 0, p, -1) : p;
+}
+
+//**************************************************************************
+
+int OptimizedKinetics::functionNode(int op, int a)
+{
+	if ( nodes[a].code == OPT_CONST && _finite(nodes[a].val) ) {         // hoist a constant subexpression
+		double v = applyFunction(op, nodes[a].val);
+		if ( _finite(v) ) { if (op != BRACKET) hoisted++; return number(v); }
+	}
+
+	return node(OPT_FUNCTION, char(op), a, -1);
+}
+
+//**************************************************************************
+//  Same operator-precedence algorithm as ExpressionObj::Evaluate(), building
+//  the nodes of the subexpressions instead of evaluating them
+//**************************************************************************
+
+int OptimizedKinetics::build(ExpressionObj *E, int *firstTerm)
+{
+	int  pr, unaryOp = 0, val;
+	int  opStack[priorityLevels];
+	int  valStack[priorityLevels + 1];
+	int  j, j0, stackHead = 0;
+
+	if (E->term_num <= 0) return number(0.0);
+	j0 = firstTerm ? *firstTerm : 0;
+	valStack[0] = -1;
+
+	for (j = j0; j < E->term_num; j ++) {
+
+		struct TermStruct &term = E->term_array[j];
+		int  Type = term.type;
+
+		if ( isUnary(Type) ) { unaryOp = Type; continue; }
+
+		if ( isBinary(Type) ) {
+			pr = priority[ Type ];
+			while ( stackHead )
+				if ( priority[ opStack[stackHead - 1] ] <= pr ) {
+					stackHead --;
+					valStack[stackHead] = binaryNode( opStack[stackHead], valStack[stackHead], valStack[stackHead+1] );
+				} else break;
+			opStack[ stackHead++ ] = Type;
+			continue;
+		}
+
+		if ( Type == BR_CLOSE )  break;
+
+		if ( isFunction(Type) ) {
+			j ++;
+			val = functionNode( Type, build(E, &j) );
+		}
+		else if ( Type == NUMBER_TYPE )  val = number(term.val);
+		else if ( Type == POINTER_TYPE ) val = variable(term.ptr);
+		else throw makeMessage("Cannot optimize expression { %s }: unknown term %d\n", E->formula, Type);
+
+		if (unaryOp) {
+			if (unaryOp == T_UNARY_NOT) {
+				if ( nodes[val].code == OPT_CONST ) { val = number( (nodes[val].val > 0) ? 0 : 1 ); hoisted++; }
+				else val = node(OPT_NOT, 0, val, -1);
+			}
+			unaryOp = 0;
+		}
+
+		valStack[ stackHead ] = val;
+	}
+
+	if (firstTerm) *firstTerm = j;
+	while ( stackHead-- )
+		valStack[stackHead] = binaryNode( opStack[stackHead], valStack[stackHead], valStack[stackHead+1] );
+
+	if (valStack[0] < 0) throw makeMessage("Cannot optimize expression { %s }: no operands\n", E->formula);
+	return valStack[0];
+}
+
+//**************************************************************************
+
+static long countOps(ExpressionObj *E)   // operations of the interpreted evaluation
+{
+	long n = 0;
+	for (int j = 0; j < E->term_num; j++) {
+		int Type = E->term_array[j].type;
+		if ( isBinary(Type) || Type == NUMBER_TYPE || Type == POINTER_TYPE || Type == T_UNARY_NOT ||
+		     ( isFunction(Type) && Type != BRACKET ) ) n++;
+	}
+	return n;
+}
+
+//**************************************************************************
+
+OptimizedKinetics::OptimizedKinetics(ExpressionObj **F, int identNum, int varNum, double *identPtr, bool shareDeriv)
+{
+	int  i, k, terms = 0;
+	long ops[2] = { 0, 0 };
+
+	formulas  = F;
+	ident_num = identNum;
+	var_num   = varNum;
+	ident     = identPtr;
+	hoisted   = shared = powers = 0;
+	originalOps = 0;
+
+	for (i = 0; i < ident_num + var_num; i++) {
+		terms += formulas[i]->term_num;
+		originalOps += countOps(formulas[i]) * ( (i < ident_num) ? 2 : 1 );  // identities are evaluated twice
+	}
+
+	node_max = 4 * terms + ident_num + var_num + 16;
+	for (hashSize = 64; hashSize < 2 * node_max; hashSize *= 2) ;
+
+	nodes      = new OptNode[node_max];
+	hashTable  = new int[hashSize];
+	storeCount = new int[ident_num + 1];
+	identProg  = new OptInstr[node_max + ident_num + 1];
+	derivProg  = new OptInstr[node_max + var_num + 1];
+	node_num   = identLength = derivLength = 0;
+
+	for (k = 0; k < hashSize; k++)  hashTable[k] = -1;
+	for (i = 0; i < ident_num; i++) storeCount[i] = 0;
+
+	// 1. The identities are assigned in order; a later formula reads the new values
+
+	prog = identProg;  length = &identLength;
+	for (i = 0; i < ident_num; i++) {
+		formulaIndex = i;
+		if ( formulas[i]->isVolatile() ) {
+			k = node_num++;
+			nodes[k].code = OPT_EVAL;
+			emit(OPT_EVAL, 0, k, -1, -1);
+			ops[0] += countOps(formulas[i]);
+		}
+		else k = build(formulas[i], 0);
+		emit(OPT_STORE, 0, -1, k, i);
+		storeCount[i]++;
+	}
+
+	// 2. The derivatives are evaluated right after the identities: their values can be reused,
+	//    unless the variables may change in between (the calcium currents)
+
+	if (!shareDeriv) for (k = 0; k < hashSize; k++)  hashTable[k] = -1;
+
+	prog = derivProg;  length = &derivLength;
+	for (i = 0; i < var_num; i++) {
+		formulaIndex = i + ident_num;
+		if ( formulas[i + ident_num]->isVolatile() ) {
+			k = node_num++;
+			nodes[k].code = OPT_EVAL;
+			emit(OPT_EVAL, 0, k, -1, -1);
+			ops[1] += countOps(formulas[i + ident_num]);
+		}
+		else k = build(formulas[i + ident_num], 0);
+		emit(OPT_STORE, 0, -1, k, i);
+	}
+
+	reg = new double[node_num + 1];
+	for (k = 0; k < node_num; k++) reg[k] = (nodes[k].code == OPT_CONST) ? nodes[k].val : 0.0;
+
+	for (k = 0; k < identLength; k++) if (identProg[k].code != OPT_STORE && identProg[k].code != OPT_EVAL) ops[0]++;
+	for (k = 0; k < derivLength; k++) if (derivProg[k].code != OPT_STORE && derivProg[k].code != OPT_EVAL) ops[1]++;
+	identOps = ops[0];
+	derivOps = ops[1];
+
+	if (VERBOSE) fprintf(stderr,
+		"\n### ODE formula optimizer: %ld operations per derivative evaluation reduced to %ld"
+		"\n    (%ld shared subexpressions, %ld constant subexpressions hoisted, %ld powers reduced)\n",
+		originalOps, 2 * identOps + derivOps, shared, hoisted, powers);
+}
+
+//**************************************************************************
+
+OptimizedKinetics::~OptimizedKinetics()
+{
+	delete [] nodes;  delete [] hashTable;  delete [] storeCount;
+	delete [] identProg;  delete [] derivProg;  delete [] reg;
+}
+
+//**************************************************************************
+
+void OptimizedKinetics::run(OptInstr *p, int n, double *result)
+{
+	double *r = reg;
+
+	for (int k = 0; k < n; k++) {
+		OptInstr &I = p[k];
+		switch (I.code) {
+		case OPT_LOAD:     r[I.dst] = *I.ptr; break;
+		case OPT_BINARY:   r[I.dst] = applyBinary(I.op, r[I.a], r[I.b]); break;
+		case OPT_MUL:      r[I.dst] = r[I.a] * r[I.b]; break;
+		case OPT_RECIP:    r[I.dst] = 1.0 / r[I.a]; break;
+		case OPT_NOT:      r[I.dst] = (r[I.a] > 0) ? 0 : 1; break;
+		case OPT_EVAL:     r[I.dst] = formulas[I.formula]->Evaluate(); break;
+		case OPT_FUNCTION:
+		case OPT_STORE:
+			if ( !_finite(r[I.a]) )
+				throw makeMessage("\n Not-a-number returned by the following expression: \n\n { %s }\n",
+				                  formulas[I.formula]->formula);
+			if (I.code == OPT_STORE) result[I.b] = r[I.a];
+			else r[I.dst] = applyFunction(I.op, r[I.a]);
+			break;
+		}
+	}
+}
+
+//**************************************************************************
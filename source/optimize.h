@@ -0,0 +1,104 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             optimize.h
+ *
+ *  Whole-model optimization of the formulas of the KineticObj ("ODE.optimize = on").
+ *  The expressions for the time-dependent (auxiliary) variables and for the ODE
+ *  right-hand sides are translated into a single straight-line program, in which
+ *  the subexpressions shared by several formulas (or repeated within a formula)
+ *  are evaluated only once per call, the subexpressions depending only on the
+ *  constants are evaluated once on construction, and the small integer powers
+ *  are replaced by multiplications.
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_OPTIMIZE_H_included
+#define CALC_OPTIMIZE_H_included
+
+#define OPT_MAX_POWER 4   // integer powers x^n with |n| <= OPT_MAX_POWER are reduced to multiplications
+
+//*************************************************************************************
+
+struct OptNode           // a distinct subexpression
+{
+  char   code, op;       // instruction code (OPT_xxx in optimize.cpp), and operator or function type
+  int    a, b;           // operand nodes
+  int    version;        // for variables: number of times the variable was assigned by the program
+  double val;            // for constants
+  double *ptr;           // for variables
+};
+
+struct OptInstr          // an instruction of the program: computes register "dst"
+{
+  char   code, op;
+  int    dst, a, b;
+  double *ptr;
+  int    formula;        // index of the formula, for error messages and interpreted evaluation
+};
+
+class OptimizedKinetics
+{
+  ExpressionObj **formulas;
+  int      ident_num, var_num;
+  double   *ident;           // addresses of the auxiliary variables, assigned by the identity program
+
+  OptNode  *nodes;
+  int      node_num, node_max;
+  int      *hashTable, hashSize;
+  int      *storeCount;      // number of times each auxiliary variable was assigned so far
+
+  OptInstr *identProg, *derivProg, *prog;
+  int      identLength, derivLength, *length;
+  double   *reg;             // one register per node
+
+  int      formulaIndex;
+  long     hoisted, shared, powers;
+
+  int      find  (OptNode &);
+  int      node  (char code, char op, int a, int b, double val = 0.0, double *ptr = 0);
+  int      number(double val);
+  int      variable(double *ptr);
+  int      binaryNode  (int op, int a, int b);
+  int      functionNode(int op, int a);
+  int      powerNode   (int a, int n);
+  int      build(ExpressionObj *E, int *firstTerm);
+  void     emit (char code, char op, int dst, int a, int b, double *ptr = 0);
+  void     run  (OptInstr *p, int n, double *result);
+
+ public:
+
+  long     originalOps, identOps, derivOps;   // operations per identity/derivative evaluation
+
+  OptimizedKinetics(ExpressionObj **formulas, int ident_num, int var_num, double *ident, bool shareDeriv);
+ ~OptimizedKinetics();
+
+  // Same results as the sequential interpreted evaluation of the formulas; the derivative
+  // program may use the values computed by the last run of the identity program
+
+  void evalIdent(double *ident) { run(identProg, identLength, ident); }
+  void evalDeriv(double *dvar)  { run(derivProg, derivLength, dvar);  }
+};
+
+//*************************************************************************************
+
+#endif
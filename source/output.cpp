@@ -0,0 +1,496 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             output.cpp
+ *
+ *  Buffered output of the point plot files, in the ASCII or binary format,
+ *  and the output thread of the field plots
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "syntax.h"
+#include "output.h"
+
+#ifdef _WIN32
+  #include <io.h>
+  #define ftruncate(fd, size) _chsize_s(fd, (long long)(size))
+  #define fileno _fileno
+#else
+  #include <unistd.h>
+#endif
+
+extern thread_local int VERBOSE;
+
+#define ASCII_SAMPLE 64    // the maximal length of an ASCII sample line
+
+thread_local int    PointWriter::FORMAT      = FORMAT_ASCII;
+thread_local long   PointWriter::BUFFER_SIZE = 65536;
+thread_local double PointWriter::FLUSH_TIME  = 1.0;
+thread_local PointWriter *PointWriter::first = 0;
+
+//**************************************************************************
+//  "plot.format = ascii | binary | float", "plot.buffer = bytes" and
+//  "plot.flush = seconds"
+//**************************************************************************
+
+void PointWriter::setFormat(TokenString &TS)
+{
+  if ( TS.token_count("plot.format") ) {
+    char s[MAX_TOKEN_LENGTH];
+    TS.get_string_param("plot.format", s);
+         if ( equal(s, "ascii") )  FORMAT = FORMAT_ASCII;
+    else if ( equal(s, "binary") ) FORMAT = FORMAT_DOUBLE;
+    else if ( equal(s, "float") )  FORMAT = FORMAT_FLOAT;
+    else throw makeMessage("Unknown plot file format \"%s\" (should be ascii, binary or float)", s);
+  }
+  TS.get_long_param("plot.buffer", &BUFFER_SIZE);
+  TS.get_param("plot.flush", &FLUSH_TIME);
+}
+
+//**************************************************************************
+
+PointWriter::PointWriter(FILE *f, int fmt) : file(f), format(fmt), used(0), size(BUFFER_SIZE), header(0), flushed(0)
+{
+  if (file == stdout || file == stderr) format = FORMAT_ASCII;
+  if (size < 2 * ASCII_SAMPLE) size = 2 * ASCII_SAMPLE;
+  buffer  = new char[size];
+  written = time(NULL);
+
+  if (format) {
+    int info[2] = { format, 0 };
+    memcpy(buffer, POINT_FILE_TAG, 8);
+    memcpy(buffer + 8, info, sizeof(info));
+    used = header = 8 + sizeof(info);
+  }
+  prev = 0;
+  next = first;
+  if (first) first->prev = this;
+  first = this;
+}
+
+PointWriter::~PointWriter()
+{
+  flush();
+  delete [] buffer;
+  if (prev) prev->next = next; else first = next;
+  if (next) next->prev = prev;
+}
+
+void PointWriter::flushAll()
+{
+  for (PointWriter *w = first; w; w = w->next) w->flush();
+}
+
+//**************************************************************************
+
+void PointWriter::push(double t, double y)
+{
+  if (format == FORMAT_DOUBLE) {
+    memcpy(buffer + used, &t, sizeof(double));
+    memcpy(buffer + used + sizeof(double), &y, sizeof(double));
+    used += 2 * sizeof(double);
+  }
+  else if (format == FORMAT_FLOAT) {
+    float v[2] = { float(t), float(y) };
+    memcpy(buffer + used, v, sizeof(v));
+    used += sizeof(v);
+  }
+  else used += snprintf(buffer + used, ASCII_SAMPLE, "%.10g %.10g \n", t, y);
+
+  if ( used + ASCII_SAMPLE > size || FLUSH_TIME <= 0.0 || difftime(time(NULL), written) >= FLUSH_TIME )
+    flush();
+}
+
+//**************************************************************************
+
+void PointWriter::flush()
+{
+  if (used && fwrite(buffer, 1, used, file) != used && VERBOSE)
+    fprintf(stderr, "*** Warning: could not write %ld bytes to a plot file\n", long(used));
+  fflush(file);
+  flushed += (long long)(used);
+  used     = 0;
+  written  = time(NULL);
+}
+
+//**************************************************************************
+
+void PointWriter::truncate(long long offset)
+{
+  if (file == stdout || file == stderr || offset >= position()) return;
+
+  if (offset >= flushed) used = size_t(offset - flushed);   // the samples are still in the buffer
+  else {
+    used    = 0;
+    truncateFile(file, offset);
+    flushed = offset;
+  }
+}
+
+//**************************************************************************
+//  Reads the samples back from the file (when a back-step goes beyond the
+//  samples remembered by the plot)
+//**************************************************************************
+
+long long PointWriter::locate(const char *fname, double t, double *last, double *next)
+{
+  flush();
+  FILE *f = fopenAssure(fname, "rb", "reading back", "a point plot");
+  long long offset = header;
+  fseek64(f, header, SEEK_SET);
+
+  double eps = (format == FORMAT_DOUBLE) ? 0.0 : (format == FORMAT_FLOAT) ? 1e-7 : 1e-9;   // the precision of
+  t -= eps * fabs(t);                                                                     //  the stored times
+  if (format) {
+    double v[2];
+    float  w[2];
+    while (format == FORMAT_DOUBLE ? fread(v, sizeof(double), 2, f) == 2 : fread(w, sizeof(float), 2, f) == 2) {
+      if (format == FORMAT_FLOAT) { v[0] = w[0];  v[1] = w[1]; }
+      if (v[0] >= t) { if (next) { next[0] = v[0];  next[1] = v[1]; }  break; }
+      if (last) { last[0] = v[0];  last[1] = v[1]; }
+      offset += 2 * format;
+    }
+  }
+  else {
+    char line[ASCII_SAMPLE + 1];
+    double v[2];
+    while ( fgets(line, sizeof(line), f) ) {
+      v[0] = atof(line);
+      v[1] = 0.0;
+      sscanf(line, "%*f %lf", v + 1);
+      if (v[0] >= t) { if (next) { next[0] = v[0];  next[1] = v[1]; }  break; }
+      if (last) { last[0] = v[0];  last[1] = v[1]; }
+      offset = ftell64(f);
+    }
+  }
+  fclose(f);
+  return offset;
+}
+
+//**************************************************************************
+//  The samples written so far, copied to the snapshot as bytes of the file
+//**************************************************************************
+
+void PointWriter::exportSamples(FILE *state, const char *fname)
+{
+  flush();
+  exportFile(state, fname, header, flushed);
+}
+
+void PointWriter::importSamples(FILE *state)
+{
+  flush();
+  flushed = importFile(state, file, "", header);
+}
+
+//**************************************************************************
+//  File helpers of the back-steps and the snapshots of the mute plots
+//**************************************************************************
+
+void truncateFile(FILE *f, long long size)
+{
+  fflush(f);
+  if ( ftruncate(fileno(f), size) ) { }    // the stale bytes are overwritten otherwise
+  fseek64(f, size, SEEK_SET);
+}
+
+void exportFile(FILE *state, const char *fname, long long from, long long to)
+{
+  long long n = (to > from) ? to - from : 0;
+  writeState(state, &n, sizeof(long long));
+  if (!n) return;
+
+  char buffer[65536];
+  FILE *f = fopenAssure(fname, "rb", "reading back", "a plot");
+  fseek64(f, from, SEEK_SET);
+  while (n > 0) {
+    size_t k = fread(buffer, 1, (n < (long long)(sizeof(buffer))) ? size_t(n) : sizeof(buffer), f);
+    if (!k) { fclose(f); throw makeMessage("Could not read back plot file %s for the snapshot", fname); }
+    writeState(state, buffer, k);
+    n -= (long long)(k);
+  }
+  fclose(f);
+}
+
+long long importFile(FILE *state, FILE *&f, const char *fname, long long at)
+{
+  long long n;
+  char buffer[65536];
+  readState(state, &n, sizeof(long long));
+  if (!f) {
+    if (!n) return at;
+    f = fopenAssure(fname, "w", "restoring", "a plot");
+  }
+  truncateFile(f, at);
+  for (long long k = 0; k < n; k += (long long)(sizeof(buffer))) {
+    size_t m = (n - k < (long long)(sizeof(buffer))) ? size_t(n - k) : sizeof(buffer);
+    readState(state, buffer, m);
+    if ( fwrite(buffer, 1, m, f) != m ) throw makeMessage("Could not write a plot file restored from a snapshot");
+  }
+  fflush(f);
+  return at + n;
+}
+
+//**************************************************************************
+//  Writes the samples of a binary point file in the ASCII format
+//**************************************************************************
+
+int pointsToAscii(const char *in, const char *out)
+{
+  FILE *f = fopen(in, "rb");
+  if (!f) throw makeMessage("Could not open the point plot file \"%s\"", in);
+
+  char tag[8];
+  int  info[2];
+  if ( fread(tag, 1, 8, f) != 8 || fread(info, sizeof(int), 2, f) != 2 || memcmp(tag, POINT_FILE_TAG, 8) ||
+       (info[0] != FORMAT_DOUBLE && info[0] != FORMAT_FLOAT) ) {
+    fclose(f);
+    throw makeMessage("\"%s\" is not a binary point plot file", in);
+  }
+
+  FILE *g = fopenAssure(out, "w", "the ASCII copy of", in);
+  long n = 0;
+  double v[2];
+  float  w[2];
+
+  while (info[0] == FORMAT_DOUBLE ? fread(v, sizeof(double), 2, f) == 2 : fread(w, sizeof(float), 2, f) == 2) {
+    if (info[0] == FORMAT_FLOAT) { v[0] = w[0]; v[1] = w[1]; }
+    fprintf(g, "%.10g %.10g \n", v[0], v[1]);
+    n++;
+  }
+  fclose(f);
+  if (g != stdout) fclose(g);
+  else fflush(g);
+
+  if (VERBOSE) fprintf(stderr, "### %ld samples of %s converted\n", n, in);
+  return 0;
+}
+
+//**************************************************************************
+//  The queue of the output thread of a simulation thread
+//**************************************************************************
+
+#define POOL_SIZE 8   // the released buffers kept for reuse
+
+struct OutputQueue
+{
+  std::thread  worker;
+  std::mutex   lock;
+  std::condition_variable posted, written;
+  OutputJob    *head, *tail;
+  size_t       queued;     // bytes held by the queued jobs
+  bool         busy, quit;
+  char         *error;     // the first error of the output thread
+  char         *pool[POOL_SIZE];
+  size_t       poolSize[POOL_SIZE];
+  int          pooled;
+};
+
+static thread_local OutputQueue *queue = 0;
+thread_local double OutputThread::MEMORY = 64.0;
+
+//**************************************************************************
+
+static void release(OutputQueue *q, char *data, size_t size)   // with q->lock held
+{
+  if (q->pooled < POOL_SIZE) { q->pool[q->pooled] = data; q->poolSize[q->pooled++] = size; }
+  else delete [] data;
+}
+
+static void writeJobs(OutputQueue *q)    // the output thread
+{
+  std::unique_lock<std::mutex> guard(q->lock);
+  while (true) {
+    while (!q->head && !q->quit) q->posted.wait(guard);
+    if (!q->head) break;
+
+    OutputJob *job = q->head;
+    q->head = job->next;
+    if (!q->head) q->tail = 0;
+    q->busy = true;
+    guard.unlock();
+
+    char *msg = 0;
+    try { job->write(); }
+    catch (char *str) { msg = str; }
+
+    guard.lock();
+    q->queued -= job->size;
+    release(q, job->data, job->size);
+    delete job;
+    if (msg) { if (!q->error) q->error = msg; else delete [] msg; }
+    q->busy = false;
+    q->written.notify_all();
+  }
+}
+
+//**************************************************************************
+//  "plot.async = MB"
+//**************************************************************************
+
+void OutputThread::setMode(TokenString &TS)
+{
+  TS.get_param("plot.async", &MEMORY);
+  if (MEMORY < 0.0) throw makeMessage("The memory of the asynchronous plot output (\"plot.async\") cannot be negative");
+}
+
+//**************************************************************************
+
+char *OutputThread::buffer(size_t bytes)
+{
+  if (queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    for (int i = 0; i < queue->pooled; i++)
+      if (queue->poolSize[i] == bytes) {
+        char *data = queue->pool[i];
+        queue->pool[i]     = queue->pool[--queue->pooled];
+        queue->poolSize[i] = queue->poolSize[queue->pooled];
+        return data;
+      }
+  }
+  return new char[bytes ? bytes : 1];
+}
+
+OutputJob::OutputJob(size_t bytes) : size(bytes), next(0)
+{
+  data = OutputThread::buffer(bytes);
+}
+
+//**************************************************************************
+
+void OutputThread::post(OutputJob *job)
+{
+  if (MEMORY <= 0.0) {                     // synchronous output
+    char *msg = 0;
+    try { job->write(); }
+    catch (char *str) { msg = str; }
+    if (queue) { std::lock_guard<std::mutex> guard(queue->lock); release(queue, job->data, job->size); }
+    else delete [] job->data;
+    delete job;
+    if (msg) throw msg;
+    return;
+  }
+
+  if (!queue) {
+    queue = new OutputQueue;
+    queue->head   = queue->tail = 0;
+    queue->queued = 0;
+    queue->busy   = queue->quit = false;
+    queue->error  = 0;
+    queue->pooled = 0;
+    queue->worker = std::thread(writeJobs, queue);
+  }
+
+  std::unique_lock<std::mutex> guard(queue->lock);
+  size_t limit = size_t(MEMORY * 1048576.0);
+  while (queue->queued && queue->queued + job->size > limit && !queue->error) queue->written.wait(guard);
+  if (queue->error) {
+    char *msg = queue->error;
+    queue->error = 0;
+    release(queue, job->data, job->size);
+    delete job;
+    throw msg;
+  }
+
+  if (queue->tail) queue->tail->next = job; else queue->head = job;
+  queue->tail    = job;
+  queue->queued += job->size;
+  queue->posted.notify_one();
+}
+
+//**************************************************************************
+
+void OutputThread::wait(bool report)
+{
+  if (!queue) return;
+  std::unique_lock<std::mutex> guard(queue->lock);
+  while (queue->head || queue->busy) queue->written.wait(guard);
+  if (report && queue->error) {
+    char *msg = queue->error;
+    queue->error = 0;
+    throw msg;
+  }
+}
+
+void OutputThread::stop()
+{
+  if (!queue) return;
+  OutputQueue *q = queue;
+  {
+    std::lock_guard<std::mutex> guard(q->lock);
+    q->quit = true;
+    q->posted.notify_one();
+  }
+  q->worker.join();
+  queue = 0;
+
+  char *msg = q->error;
+  for (int i = 0; i < q->pooled; i++) delete [] q->pool[i];
+  delete q;
+  if (msg) throw msg;
+}
+
+//**************************************************************************
+
+FileJob::FileJob(const char *fname, const char *fmode, size_t bytes, const char *action) :
+  OutputJob(bytes), mode(fmode), what(action), used(0)
+{
+  strncpy(fileName, fname, 511);
+  fileName[511] = 0;
+}
+
+void FileJob::write()
+{
+  FILE *f = fopenAssure(fileName, mode, what, "");
+  size_t wrote = fwrite(data, 1, used, f);
+  if (f != stdout && f != stderr) fclose(f);
+  if (wrote != used)
+    throw makeMessage("Failure to write %s to file %s: wrote only %ld of total %ld bytes", what, fileName, long(wrote), long(used));
+}
+
+//**************************************************************************
+
+TruncateJob::TruncateJob(const char *fname, long long bytes) : OutputJob(0), length(bytes)
+{
+  strncpy(fileName, fname, 511);
+  fileName[511] = 0;
+}
+
+void TruncateJob::write()
+{
+  FILE *f = fopenAssure(fileName, "r+b", "truncation", "");
+  int  rc = ftruncate(fileno(f), length);
+  fclose(f);
+  if (rc) throw makeMessage("Could not truncate file %s to %lld bytes", fileName, length);
+}
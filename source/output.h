@@ -0,0 +1,168 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                              output.h
+ *
+ *  Buffered output of the point plot files ("plot mute" and "plot.print").
+ *  The samples are formatted into a memory buffer, which is written to the
+ *  file when it holds "plot.buffer" bytes, "plot.flush" seconds after the
+ *  previous write, and when the plot is closed ("plot.flush = 0" writes
+ *  every sample). With "plot.format = binary" (or "float"), the file is a
+ *  16-byte header (POINT_FILE_TAG, followed by the size of a value, 8 or 4,
+ *  as a 32-bit integer, and a 32-bit zero), followed by the (time, value)
+ *  pairs as raw double (float) values, in the byte order of the machine;
+ *  "calc --ascii file [output]" converts it to the ASCII format
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_OUTPUT_H_included
+#define CALC_OUTPUT_H_included
+
+#define POINT_FILE_TAG "CalCpts"   // 8 bytes, with the terminating zero
+
+// The file offsets are 64-bit, also where a "long" has 32 bits (Windows)
+
+#ifdef _WIN32
+  #define fseek64 _fseeki64
+  #define ftell64 _ftelli64
+#else
+  #define fseek64 fseeko
+  #define ftell64 ftello
+#endif
+
+#define FORMAT_ASCII   0           // value of PointWriter::FORMAT: "%.10g %.10g" lines,
+#define FORMAT_DOUBLE  8           //  or the size of a binary value
+#define FORMAT_FLOAT   4
+
+//*************************************************************************************
+
+class PointWriter
+{
+  FILE   *file;
+  int    format;
+  char   *buffer;
+  size_t used, size;
+  long long header;     // bytes before the first sample
+  long long flushed;    // bytes in the file
+  time_t written;       // the time of the last write
+  PointWriter *next, *prev;
+
+  static thread_local PointWriter *first;   // the open writers
+
+ public:
+
+  static thread_local int    FORMAT;
+  static thread_local long   BUFFER_SIZE;
+  static thread_local double FLUSH_TIME;
+
+  static void setFormat(class TokenString &);
+
+  PointWriter(FILE *f, int fmt);
+ ~PointWriter();       // writes the buffer; the file is closed by its owner
+
+  int  binary()   { return format; }
+  long long start()    { return header; }
+  long long position() { return flushed + (long long)(used); }   // the offset of the next sample
+  void push(double t, double y);
+  void flush();
+  void truncate(long long offset);   // discards the samples from the offset on (a back-step)
+  long long locate(const char *fname, double t,    // the offset of the first sample at or after t, and
+                   double *last = 0, double *next = 0);   //  the samples (time, value) before and at it, if any
+
+  void exportSamples(FILE *state, const char *fname);   // the samples in a snapshot (see prefix.h)
+  void importSamples(FILE *state);
+
+  static void flushAll();   // on an error, so that the files hold the samples up to it
+};
+
+int pointsToAscii(const char *in, const char *out);   // converts a binary point file
+
+void      truncateFile(FILE *f, long long size);   // the next write goes to the new end of the file
+void      exportFile  (FILE *state, const char *fname, long long from, long long to);   // the bytes [from, to)
+long long importFile  (FILE *state, FILE *&f, const char *fname, long long at);   // replaces the file from
+                                                                  // "at" on (opens fname if f is 0); returns its size
+
+//*************************************************************************************
+//  Asynchronous output of the field plots: the solver copies the data to be written
+//  into a pooled buffer, and hands the write over to a background thread of its own
+//  (one per simulation thread), which formats it and writes the file in the order of
+//  posting. "plot.async = MB" bounds the memory of the queued writes (the solver
+//  waits when it is exceeded); "plot.async = 0" writes synchronously. An error of
+//  the output thread is thrown by the next post() or wait() on the solver thread
+//*************************************************************************************
+
+class OutputJob
+{
+ public:
+  char   *data;         // the copied data, taken from the pool (see OutputThread::buffer)
+  size_t size;
+  OutputJob *next;
+
+  OutputJob(size_t bytes);
+  virtual ~OutputJob() { }
+  virtual void write() = 0;
+};
+
+//*************************************************************************************
+
+class FileJob : public OutputJob   // blocks of bytes written to a file
+{
+  char   fileName[512];
+  const char *mode, *what;
+  size_t used;
+
+ public:
+  FileJob(const char *fname, const char *fmode, size_t bytes, const char *action);
+  void add(const void *block, size_t bytes) { memcpy(data + used, block, bytes); used += bytes; }
+  void write();
+};
+
+//*************************************************************************************
+
+class TruncateJob : public OutputJob   // cuts a file to the given length (a back-step)
+{
+  char fileName[512];
+  long long length;
+
+ public:
+  TruncateJob(const char *fname, long long bytes);
+  void write();
+};
+
+//*************************************************************************************
+
+class OutputThread
+{
+ public:
+
+  static thread_local double MEMORY;   // in MB
+
+  static void  setMode(class TokenString &);
+  static char *buffer(size_t bytes);
+  static void  post(OutputJob *);      // the job is deleted when it is written
+  static void  wait(bool report = true);   // returns when the posted jobs are written
+  static void  stop();                 // waits, and ends the output thread (before a fork)
+};
+
+//*************************************************************************************
+
+#endif
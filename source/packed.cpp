@@ -0,0 +1,536 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             packed.cpp
+ *
+ *  Packed binary field plots: the brick codec, the output jobs writing
+ *  and trimming the packed files, and the reader
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "syntax.h"
+#include "output.h"
+#include "packed.h"
+
+extern thread_local int VERBOSE;
+
+#define MIN_MATCH   4              // the shortest match of the LZ77 codec
+#define HASH_BITS   12
+#define MAX_OFFSET  65535
+#define INDEX_ENTRY ((long long)(sizeof(double) + sizeof(long long)))   // a record of the index file
+
+thread_local int    PackedWriter::VALUES = 0;
+thread_local double PackedWriter::ERROR  = 0.0;
+thread_local int    PackedWriter::BRICK  = 16;
+
+//**************************************************************************
+//  "plot.binary.pack = double | float | error" and "plot.binary.brick = n"
+//**************************************************************************
+
+void PackedWriter::setFormat(TokenString &TS)
+{
+  if ( TS.token_count("plot.binary.pack") ) {
+    char s[MAX_TOKEN_LENGTH];
+    TS.get_string_param("plot.binary.pack", s);
+         if ( equal(s, "double") ) VALUES = 8;
+    else if ( equal(s, "float") )  VALUES = 4;
+    else {
+      TS.get_param("plot.binary.pack", &ERROR, "The packed binary plot format (\"plot.binary.pack\") should be double, float or an absolute error");
+      if ( !(ERROR > 0.0) ) throw makeMessage("The error of the packed binary plots (\"plot.binary.pack\") should be positive");
+      VALUES = -1;
+    }
+  }
+  TS.get_int_param("plot.binary.brick", &BRICK);
+  if (BRICK < 1 || BRICK > 256) throw makeMessage("The brick size of the packed binary plots (\"plot.binary.brick\") should be within 1..256");
+}
+
+//**************************************************************************
+//  The bricks of a frame
+//**************************************************************************
+
+long PackedLayout::bricks() const
+{
+  long n = 1;
+  for (int i = 0; i < 3; i++) n *= (size[i] + brick - 1) / brick;
+  return n;
+}
+
+long PackedLayout::brickNodes(long b, long *start, int *extent) const
+{
+  long n = 1, node = 0, stride = 1;
+  for (int i = 0; i < 3; i++) {
+    long num = (size[i] + brick - 1) / brick;
+    long k   = b % num;
+    b /= num;
+    extent[i] = (size[i] - k * brick < brick) ? int(size[i] - k * brick) : brick;
+    node += k * brick * stride;
+    stride *= size[i];
+    n *= extent[i];
+  }
+  *start = node;
+  return n;
+}
+
+//**************************************************************************
+//  The LZ77 codec: a sequence is a token (the number of literals in the upper
+//  four bits, the match length less MIN_MATCH in the lower four; 15 is followed
+//  by bytes added to it, up to the first byte below 255), the literals, and the
+//  16-bit offset of the match; the last sequence holds only the literals
+//**************************************************************************
+
+static inline uint32_t read32(const unsigned char *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static inline bool putLength(unsigned char *out, size_t &op, size_t capacity, size_t n)
+{
+  for ( ; n >= 255; n -= 255) { if (op >= capacity) return false; out[op++] = 255; }
+  if (op >= capacity) return false;
+  out[op++] = (unsigned char)(n);
+  return true;
+}
+
+static bool putSequence(unsigned char *out, size_t &op, size_t capacity, const unsigned char *literals,
+                        size_t lit, size_t offset, size_t len)   // len = 0: the last sequence
+{
+  size_t m = len ? len - MIN_MATCH : 0;
+  if (op >= capacity) return false;
+  out[op++] = (unsigned char)( ((lit < 15 ? lit : 15) << 4) | (m < 15 ? m : 15) );
+  if (lit >= 15 && !putLength(out, op, capacity, lit - 15)) return false;
+  if (op + lit > capacity) return false;
+  memcpy(out + op, literals, lit);
+  op += lit;
+  if (!len) return true;
+  if (op + 2 > capacity) return false;
+  out[op++] = (unsigned char)(offset & 255);
+  out[op++] = (unsigned char)(offset >> 8);
+  return m < 15 || putLength(out, op, capacity, m - 15);
+}
+
+size_t packBytes(const unsigned char *in, size_t n, unsigned char *out, size_t capacity)
+{
+  long table[1 << HASH_BITS];
+  for (int i = 0; i < (1 << HASH_BITS); i++) table[i] = -1;
+
+  size_t ip = 0, anchor = 0, op = 0;
+  while (ip + MIN_MATCH <= n) {
+    uint32_t h   = (read32(in + ip) * 2654435761u) >> (32 - HASH_BITS);
+    long     ref = table[h];
+    table[h] = long(ip);
+    if (ref < 0 || ip - size_t(ref) > MAX_OFFSET || read32(in + ref) != read32(in + ip)) { ip++; continue; }
+
+    size_t len = MIN_MATCH;
+    while (ip + len < n && in[ref + len] == in[ip + len]) len++;
+    if ( !putSequence(out, op, capacity, in + anchor, ip - anchor, ip - size_t(ref), len) ) return 0;
+    ip += len;
+    anchor = ip;
+  }
+  if ( !putSequence(out, op, capacity, in + anchor, n - anchor, 0, 0) ) return 0;
+  return op;
+}
+
+static inline size_t getLength(const unsigned char *in, size_t n, size_t &ip, size_t len)
+{
+  unsigned char b;
+  do {
+    if (ip >= n) throw makeMessage("Corrupt packed data: a length runs past the end of a brick");
+    b = in[ip++];
+    len += b;
+  } while (b == 255);
+  return len;
+}
+
+size_t unpackBytes(const unsigned char *in, size_t n, unsigned char *out, size_t capacity)
+{
+  size_t ip = 0, op = 0;
+  while (ip < n) {
+    unsigned token = in[ip++];
+    size_t lit = token >> 4;
+    if (lit == 15) lit = getLength(in, n, ip, lit);
+    if (lit > n - ip || lit > capacity - op) throw makeMessage("Corrupt packed data: literals run past the end of a brick");
+    memcpy(out + op, in + ip, lit);
+    ip += lit; op += lit;
+    if (ip == n) break;
+
+    if (n - ip < 2) throw makeMessage("Corrupt packed data: a truncated match offset");
+    size_t offset = in[ip] | (size_t(in[ip+1]) << 8);
+    ip += 2;
+    size_t len = token & 15;
+    if (len == 15) len = getLength(in, n, ip, len);
+    len += MIN_MATCH;
+    if (!offset || offset > op) throw makeMessage("Corrupt packed data: a match offset of %ld at byte %ld", long(offset), long(op));
+    if (len > capacity - op)    throw makeMessage("Corrupt packed data: a match runs past the end of a brick");
+    for (size_t i = 0; i < len; i++, op++) out[op] = out[op - offset];   // the copies may overlap
+  }
+  return op;
+}
+
+//**************************************************************************
+//  A brick as words (the bits of the double or float values, or the quantized
+//  values), each replaced by its zigzag coded difference with the previous one,
+//  with the bytes shuffled by significance: out[byte * n + word]
+//**************************************************************************
+
+static inline int wordSize(const PackedLayout &L) { return (L.values == 4) ? 4 : 8; }
+
+static void brickWords(const PackedLayout &L, const double *field, long start, const int *extent,
+                       long n, unsigned char *out)
+{
+  int      w = wordSize(L);
+  double   step = 2.0 * L.error;
+  uint64_t prev = 0;
+  long     i = 0;
+
+  for (int iz = 0; iz < extent[2]; iz++)
+    for (int iy = 0; iy < extent[1]; iy++)
+      for (int ix = 0; ix < extent[0]; ix++, i++) {
+        double   v = field[start + ix + long(L.size[0]) * (iy + long(L.size[1]) * iz)];
+        uint64_t word;
+        if (L.values == 8) memcpy(&word, &v, 8);
+        else if (L.values == 4) { float f = float(v); uint32_t u; memcpy(&u, &f, 4); word = u; }
+        else {
+          double q = floor(v / step + 0.5);
+          if ( !(fabs(q) < 4.0e18) ) throw makeMessage("Value %g cannot be quantized with the packed binary plot error %g", v, L.error);
+          word = uint64_t(int64_t(q));
+        }
+        uint64_t d = word - prev;
+        prev = word;
+        if (w == 4) { uint32_t s = uint32_t(d); d = uint32_t((s << 1) ^ uint32_t(int32_t(s) >> 31)); }
+        else d = (d << 1) ^ uint64_t(int64_t(d) >> 63);
+        for (int b = 0; b < w; b++) out[b * n + i] = (unsigned char)(d >> (8 * b));
+      }
+}
+
+static void brickValues(const PackedLayout &L, const unsigned char *in, long start, const int *extent,
+                        long n, double *field)
+{
+  int      w = wordSize(L);
+  double   step = 2.0 * L.error;
+  uint64_t prev = 0;
+  long     i = 0;
+
+  for (int iz = 0; iz < extent[2]; iz++)
+    for (int iy = 0; iy < extent[1]; iy++)
+      for (int ix = 0; ix < extent[0]; ix++, i++) {
+        uint64_t d = 0;
+        for (int b = 0; b < w; b++) d |= uint64_t(in[b * n + i]) << (8 * b);
+        if (w == 4) { uint32_t s = uint32_t(d); d = uint32_t((s >> 1) ^ (0u - (s & 1))); }
+        else d = (d >> 1) ^ (0 - (d & 1));
+        uint64_t word = prev + d;
+        if (w == 4) word = uint32_t(word);
+        prev = word;
+
+        double v;
+        if (L.values == 8) memcpy(&v, &word, 8);
+        else if (L.values == 4) { uint32_t u = uint32_t(word); float f; memcpy(&f, &u, 4); v = f; }
+        else v = double(int64_t(word)) * step;
+        field[start + ix + long(L.size[0]) * (iy + long(L.size[1]) * iz)] = v;
+      }
+}
+
+//**************************************************************************
+//  The frame is compressed on the output thread: data holds a copy of the field
+//**************************************************************************
+
+class PackedFrameJob : public OutputJob
+{
+  char   fileName[512], indexName[512];
+  PackedLayout L;
+  double time;
+
+ public:
+  PackedFrameJob(const char *fname, const char *index, const PackedLayout &layout, double t) :
+    OutputJob(layout.nodes() * sizeof(double)), L(layout), time(t)
+    {
+    strncpy(fileName,  fname, 511);  fileName[511]  = 0;
+    strncpy(indexName, index, 511);  indexName[511] = 0;
+    }
+
+  void write();
+};
+
+void PackedFrameJob::write()
+{
+  long   most  = long(L.brick) * L.brick * L.brick;
+  size_t bytes = size_t(most) * wordSize(L);
+  unsigned char *words  = new unsigned char[bytes];
+  unsigned char *packed = new unsigned char[bytes + 5];
+
+  FILE *f = fopenAssure(fileName, "ab", "packed field dump", "");
+  fseek64(f, 0, SEEK_END);
+  long long offset = ftell64(f);
+  bool ok = ( fwrite(&time, sizeof(double), 1, f) == 1 );
+  long raw = 0, stored = 0;
+
+  try {
+    for (long b = 0; ok && b < L.bricks(); b++) {
+      long     start;
+      int      extent[3];
+      long     n = L.brickNodes(b, &start, extent);
+      uint32_t m = uint32_t(n * wordSize(L));
+      brickWords(L, (const double *)data, start, extent, n, words);
+
+      uint32_t k = uint32_t( packBytes(words, m, packed + 5, m - 1) );   // stored if it does not shrink
+      packed[4] = (k > 0);
+      if (!k) { k = m; memcpy(packed + 5, words, m); }
+      memcpy(packed, &k, 4);
+      ok = ( fwrite(packed, 1, k + 5, f) == k + 5 );
+      raw += long(n) * long(sizeof(double));  stored += long(k) + 5;
+    }
+  }
+  catch (char *) { fclose(f); delete [] words; delete [] packed; throw; }
+
+  fclose(f);
+  delete [] words;
+  delete [] packed;
+  if (!ok) throw makeMessage("Failure to write a frame of the packed field dump into file %s", fileName);
+  if (VERBOSE > 5) fprintf(stderr, " >> Packed frame at time %g into %s: %ld bytes of %ld\n", time, fileName, stored, raw);
+
+  f = fopenAssure(indexName, "ab", "packed field dump", "index");
+  ok = ( fwrite(&time, sizeof(double), 1, f) == 1 && fwrite(&offset, sizeof(long long), 1, f) == 1 );
+  fclose(f);
+  if (!ok) throw makeMessage("Failure to write the index of the packed field dump into file %s", indexName);
+}
+
+//**************************************************************************
+//  A back-step: the frame offsets are only known on the output thread
+
+class PackedTrimJob : public OutputJob
+{
+  char fileName[512], indexName[512];
+  long frame;
+
+ public:
+  PackedTrimJob(const char *fname, const char *index, long k) : OutputJob(0), frame(k)
+    {
+    strncpy(fileName,  fname, 511);  fileName[511]  = 0;
+    strncpy(indexName, index, 511);  indexName[511] = 0;
+    }
+
+  void write()
+    {
+    FILE *f = fopenAssure(indexName, "rb", "packed field dump", "index");
+    double    t;
+    long long offset;
+    fseek64(f, frame * INDEX_ENTRY, SEEK_SET);
+    bool found = ( fread(&t, sizeof(double), 1, f) == 1 && fread(&offset, sizeof(long long), 1, f) == 1 );
+    fclose(f);
+    if (!found) return;    // no frames to remove
+    TruncateJob(fileName,  offset).write();
+    TruncateJob(indexName, frame * INDEX_ENTRY).write();
+    }
+};
+
+//**************************************************************************
+
+void PackedWriter::header(FILE *f, const PackedLayout &L, const double *coord[3])
+{
+  int info[7] = { PACKED_VERSION, L.geometry, L.size[0], L.size[1], L.size[2], L.brick, L.values > 0 ? L.values : 0 };
+  fwrite(PACKED_FILE_TAG, 1, 8, f);
+  fwrite(info, sizeof(int), 7, f);
+  fwrite(&L.error, sizeof(double), 1, f);
+  for (int i = 0; i < (L.geometry & 3); i++) fwrite(coord[i], sizeof(double), L.size[i], f);
+}
+
+void PackedWriter::post(const char *fname, const char *index, const PackedLayout &L, double time, const double *field)
+{
+  PackedFrameJob *job = new PackedFrameJob(fname, index, L, time);
+  memcpy(job->data, field, job->size);
+  OutputThread::post(job);
+}
+
+void PackedWriter::trim(const char *fname, const char *index, long frame)
+{
+  OutputThread::post( new PackedTrimJob(fname, index, frame) );
+}
+
+//**************************************************************************
+//  The reader
+//**************************************************************************
+
+PackedReader::PackedReader(const char *fname) : num(0), offset(0), times(0), packed(0), bytes(0)
+{
+  coord[0] = coord[1] = coord[2] = 0;
+  file = fopen(fname, "rb");
+  if (!file) throw makeMessage("Could not open the packed field plot file \"%s\"", fname);
+
+  char tag[8];
+  int  info[7];
+  if ( fread(tag, 1, 8, file) != 8 || memcmp(tag, PACKED_FILE_TAG, 8) || fread(info, sizeof(int), 7, file) != 7 ||
+       fread(&L.error, sizeof(double), 1, file) != 1 ) {
+    fclose(file);
+    throw makeMessage("\"%s\" is not a packed field plot file", fname);
+  }
+  L.geometry = info[1];
+  L.size[0]  = info[2];  L.size[1] = info[3];  L.size[2] = info[4];
+  L.brick    = info[5];
+  L.values   = info[6] ? info[6] : -1;
+  if ( info[0] != PACKED_VERSION || L.size[0] < 1 || L.size[1] < 1 || L.size[2] < 1 || L.brick < 1 ||
+       (L.values != 8 && L.values != 4 && !(L.error > 0.0)) ) {
+    fclose(file);
+    throw makeMessage("Unsupported layout of the packed field plot file \"%s\" (version %d)", fname, info[0]);
+  }
+  for (int i = 0; i < 3; i++) {
+    coord[i] = new double[L.size[i]];
+    for (int k = 0; k < L.size[i]; k++) coord[i][k] = 0.0;
+    if (i < (L.geometry & 3) && fread(coord[i], sizeof(double), L.size[i], file) != size_t(L.size[i])) {
+      fclose(file);
+      throw makeMessage("The header of the packed field plot file \"%s\" is truncated", fname);
+    }
+  }
+  long long first = ftell64(file);
+  long most  = long(L.brick) * L.brick * L.brick * wordSize(L);
+  packed = new unsigned char[most];
+  bytes  = new unsigned char[most];
+
+  char index[1024];
+  snprintf(index, 1023, "%s.idx", fname);
+  FILE *g = fopen(index, "rb");
+  if (g) {                       // the frames are listed by the index
+    fseek64(g, 0, SEEK_END);
+    long n = long( ftell64(g) / INDEX_ENTRY );
+    fseek64(g, 0, SEEK_SET);
+    offset = new long long[n + 1];
+    times  = new double[n + 1];
+    while (num < n && fread(&times[num], sizeof(double), 1, g) == 1 && fread(&offset[num], sizeof(long long), 1, g) == 1)
+      num++;
+    fclose(g);
+    return;
+  }
+
+  long max = 16;                 // the frames are found by a scan
+  offset = new long long[max];
+  times  = new double[max];
+  fseek64(file, 0, SEEK_END);
+  long long end = ftell64(file), at = first;
+  while (at + (long long)(sizeof(double)) <= end) {
+    double   t;
+    uint32_t k;
+    unsigned char method;
+    fseek64(file, at, SEEK_SET);
+    if ( fread(&t, sizeof(double), 1, file) != 1 ) break;
+    long long next = at + (long long)(sizeof(double));
+    for (long b = 0; b < L.bricks() && next <= end; b++) {
+      fseek64(file, next, SEEK_SET);
+      if ( fread(&k, 4, 1, file) != 1 || fread(&method, 1, 1, file) != 1 ) next = end + 1;
+      else next += 5 + (long long)(k);
+    }
+    if (next > end) break;       // an incomplete frame
+
+    if (num == max) {
+      long long *o = new long long[2 * max];
+      double *s = new double[2 * max];
+      for (long i = 0; i < num; i++) { o[i] = offset[i]; s[i] = times[i]; }
+      delete [] offset;  delete [] times;
+      offset = o;  times = s;  max *= 2;
+    }
+    offset[num]  = at;
+    times[num++] = t;
+    at = next;
+  }
+}
+
+//**************************************************************************
+
+PackedReader::~PackedReader()
+{
+  if (file) fclose(file);
+  delete [] offset;  delete [] times;
+  delete [] packed;  delete [] bytes;
+  for (int i = 0; i < 3; i++) delete [] coord[i];
+}
+
+//**************************************************************************
+
+void PackedReader::read(long frame, double *field)
+{
+  if (frame < 0 || frame >= num) throw makeMessage("No frame #%ld in the packed field plot file (of %ld frames)", frame, num);
+  double t;
+  fseek64(file, offset[frame], SEEK_SET);
+  if ( fread(&t, sizeof(double), 1, file) != 1 ) throw makeMessage("The packed field plot file is truncated at frame #%ld", frame);
+
+  for (long b = 0; b < L.bricks(); b++) {
+    long     start;
+    int      extent[3];
+    long     n = L.brickNodes(b, &start, extent);
+    uint32_t m = uint32_t(n * wordSize(L)), k;
+    unsigned char method;
+
+    if ( fread(&k, 4, 1, file) != 1 || fread(&method, 1, 1, file) != 1 || k > m || method > 1 ||
+         fread(packed, 1, k, file) != k )
+      throw makeMessage("The packed field plot file is truncated or corrupt at frame #%ld, brick #%ld", frame, b);
+    if (method == 0) {
+      if (k != m) throw makeMessage("Corrupt packed data: a stored brick of %ld bytes (%ld expected)", long(k), long(m));
+      brickValues(L, packed, start, extent, n, field);
+    } else {
+      if ( unpackBytes(packed, k, bytes, m) != m ) throw makeMessage("Corrupt packed data: brick #%ld of frame #%ld is short", b, frame);
+      brickValues(L, bytes, start, extent, n, field);
+    }
+  }
+}
+
+//**************************************************************************
+//  Writes a packed file (and its index) in the raw binary plot format
+//**************************************************************************
+
+int unpackFile(const char *in, const char *out)
+{
+  PackedReader R(in);
+  int dims = R.L.geometry & 3;
+  FILE *g = fopenAssure(out, "wb", "the raw copy of", in);
+  fwrite(&R.L.geometry, sizeof(int), 1, g);
+  for (int i = 0; i < dims; i++) fwrite(&R.L.size[i], sizeof(int), 1, g);
+  for (int i = 0; i < dims; i++) fwrite(R.coord[i], sizeof(double), R.L.size[i], g);
+  long long at = ftell64(g);
+
+  char index[1024];
+  snprintf(index, 1023, "%s.idx", out);
+  FILE *h = fopenAssure(index, "wb", "the raw copy of", in);
+
+  long   n = R.L.nodes();
+  double *field = new double[n];
+  bool   ok = true;
+  try {
+    for (long k = 0; ok && k < R.frames(); k++) {
+      double t = R.time(k);
+      R.read(k, field);
+      ok = ( fwrite(&t, sizeof(double), 1, g) == 1 && fwrite(field, sizeof(double), n, g) == size_t(n) &&
+             fwrite(&t, sizeof(double), 1, h) == 1 && fwrite(&at, sizeof(long long), 1, h) == 1 );
+      at += (long long)(sizeof(double)) * (n + 1);
+    }
+  }
+  catch (char *) { delete [] field; fclose(g); fclose(h); throw; }
+
+  delete [] field;
+  fclose(g);
+  fclose(h);
+  if (!ok) throw makeMessage("Failure to write the raw copy of %s into %s", in, out);
+  if (VERBOSE) fprintf(stderr, "### %ld frames of %s unpacked into %s\n", R.frames(), in, out);
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                              packed.h
+ *
+ *  Packed (chunked and compressed) binary field plots: "plot binary" with
+ *  "plot.binary.pack = double | float | error" stores each frame as bricks
+ *  of "plot.binary.brick" nodes along each dimension (16 by default), and
+ *  compresses every brick on the output thread (see output.h). The values
+ *  of a brick are taken as double or float bit patterns, or quantized to
+ *  multiples of 2 * error (the absolute error is then at most "error");
+ *  each word is replaced by its difference with the previous one (zigzag
+ *  coded), the bytes are shuffled by significance, and the result is
+ *  compressed by an LZ77 codec (the LZ4 block layout). The file is:
+ *
+ *    header:  PACKED_FILE_TAG, int32 version, geometry (the lowest 2 bits are
+ *             the number of dimensions), xsize, ysize, zsize (1 for the absent
+ *             dimensions), brick, value size (8, 4, or 0 if quantized), double
+ *             error, and the double coordinates along the present dimensions
+ *    frame:   double time, and each brick (x fastest, then y, z): uint32 size,
+ *             uint8 method (0 = the shuffled words as they are, 1 = compressed),
+ *             and the bytes
+ *
+ *  The index file "<file>.idx" holds the time and the offset of each frame
+ *  (see FieldDumpT). PackedReader reads the frames back; "calc --unpack file
+ *  [output]" converts a packed file to the raw binary plot format
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_PACKED_H_included
+#define CALC_PACKED_H_included
+
+#define PACKED_FILE_TAG  "CalCfld"   // 8 bytes, with the terminating zero
+#define PACKED_VERSION   1
+
+//*************************************************************************************
+
+struct PackedLayout       // the layout of the frames of a packed file
+{
+  int    geometry, size[3], brick, values;
+  double error;
+
+  long   nodes()  const { return long(size[0]) * size[1] * size[2]; }
+  long   bricks() const;
+  long   brickNodes(long b, long *start, int *extent) const;   // the first node and the extent of brick #b
+};
+
+//*************************************************************************************
+
+class PackedWriter
+{
+ public:
+
+  static thread_local int    VALUES;   // 0: the raw binary format; 8 or 4: double or float words;
+  static thread_local double ERROR;    //  -1: quantized to multiples of 2 * ERROR
+  static thread_local int    BRICK;
+
+  static void setFormat(class TokenString &);
+
+  static void header(FILE *f, const PackedLayout &L, const double *coord[3]);
+
+  // the frame (a copy of the field) is compressed and appended to the file and its index on the output thread
+  static void post(const char *fname, const char *index, const PackedLayout &L, double time, const double *field);
+
+  // the frames from #frame on are removed from the file and its index on the output thread
+  static void trim(const char *fname, const char *index, long frame);
+};
+
+//*************************************************************************************
+
+class PackedReader
+{
+  FILE   *file;
+  long   num;
+  long long *offset;
+  double *times;
+  unsigned char *packed, *bytes;
+
+ public:
+
+  PackedLayout L;
+  double *coord[3];
+
+  PackedReader(const char *fname);     // the frames are located with the index file, or by a scan
+ ~PackedReader();
+
+  long   frames()       { return num; }
+  double time(long k)   { return times[k]; }
+  void   read(long k, double *field);  // the values of frame #k, field[ix + xsize * (iy + ysize * iz)]
+};
+
+//*************************************************************************************
+
+size_t packBytes  (const unsigned char *in, size_t n, unsigned char *out, size_t capacity);   // 0 if it does not fit
+size_t unpackBytes(const unsigned char *in, size_t n, unsigned char *out, size_t capacity);   // throws if corrupt
+
+int unpackFile(const char *in, const char *out);   // a packed file in the raw binary plot format
+
+#endif
@@ -37,6 +37,8 @@
 
 class PeakTrackObj
 {
+  friend class EnsembleObj;
+
 protected:
 
   double T1, T2;
@@ -0,0 +1,380 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             prefix.cpp
+ *
+ *  Snapshot cache of the simulation state at the end of the "Run" statements
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <thread>
+#include <functional>
+#include "syntax.h"
+#include "vector.h"
+#include "box.h"
+#include "grid.h"
+#include "field.h"
+#include "table.h"
+#include "peak.h"
+#include "markov.h"
+#include "interpol.h"
+#include "simulation.h"
+#include "gate.h"
+#include "fplot.h"
+#include "prefix.h"
+
+#ifdef _WIN32
+  #include <direct.h>
+  #include <process.h>
+  #define getpid    _getpid
+  #define makeDir(d) _mkdir(d)
+#else
+  #include <unistd.h>
+  #include <sys/stat.h>
+  #define makeDir(d) mkdir(d, 0777)
+#endif
+
+extern thread_local int VERBOSE;
+extern char *versionStr;
+
+//**************************************************************************
+//  Statements of the script: ranges of tokens between the ";" tokens
+//**************************************************************************
+
+struct PrefixStatement
+{
+  long first, last;
+  int  run;              // a "Run" statement, or a "current" statement of Run #run; 0 otherwise
+  bool header;           // the first line: the extra parameters and the loop variable bindings
+  bool loop;             // a "for" statement
+  const char *defines;   // the parameter defined by the statement, if it is referred to elsewhere
+};
+
+struct NameSet           // the names are token text, so that at most token_num are distinct
+{
+  const char **name;
+  int  num;
+
+  NameSet(long n) { name = new const char *[n + 1]; num = 0; }
+ ~NameSet()       { delete [] name; }
+
+  int  find(const char *s) { for (int i = 0; i < num; i++) if ( equal(name[i], s) ) return i; return -1; }
+  bool has (const char *s) { return find(s) >= 0; }
+  void add (const char *s) { if ( !has(s) ) name[num++] = s; }
+};
+
+//**************************************************************************
+
+static bool isCurrentToken(const char *t)
+{
+  if ( equal(t, "current") || equal(t, "currents") ) return true;
+  const char *dot = strrchr(t, '.');
+  return dot && ( equal(dot, ".current") || equal(dot, ".currents") );
+}
+
+static bool isDefinition(TokenString &TS, PrefixStatement &s, const char *name)
+{
+  return s.last > s.first && TS.equal(s.first, name) &&
+         ( TS.equal(s.first + 1, ASSIGN_TOKEN) || TS.equal(s.first + 1, VAR_TOKEN) );
+}
+
+static bool refersTo(TokenString &TS, PrefixStatement &s, const char *name)
+{
+  for (long p = s.first; p <= s.last; p++) if ( TS.equal(p, name) ) return true;
+  return false;
+}
+
+//**************************************************************************
+//  A "Run" statement belongs to the segment of its ordinal number, as does
+//  the "current" statement of the same number (see FieldObj::getCurrents).
+//  A definition of a parameter without a dot in its name is only relevant if
+//  one of the relevant statements refers to it, unless no other statement
+//  does: the parameters with a dot (such as "Ca.D") are read by the program
+//**************************************************************************
+
+static PrefixStatement *splitStatements(TokenString &TS, int &num)
+{
+  PrefixStatement *s = new PrefixStatement[TS.token_num + 1];
+  NameSet currents(TS.token_num);
+  int     *count = new int[TS.token_num + 1], runCount = 0;
+
+  num = 0;
+  for (long p = 0; p < TS.token_num; p++) {
+    if ( TS.equal(p, CARR_RET_TOKEN) ) continue;
+
+    PrefixStatement &st = s[num++];
+    st.first   = p;
+    st.header  = ( p < TS.headerTokens );
+    st.loop    = TS.equal(p, LOOP_TOKEN);
+    st.run     = 0;
+    st.defines = 0;
+    while ( p + 1 < TS.token_num && !TS.equal(p + 1, CARR_RET_TOKEN) && p + 1 != TS.headerTokens ) p++;
+    st.last = p;
+
+    if ( TS.equal(st.first, "Run") ) st.run = ++runCount;
+    else if ( isCurrentToken(TS[st.first]) ) {
+      int i = currents.find(TS[st.first]);
+      if (i < 0) { currents.add(TS[st.first]); count[i = currents.num - 1] = 0; }
+      st.run = ++count[i];
+    }
+  }
+  delete [] count;
+
+  for (int i = 0; i < num; i++) {
+    const char *name = TS[s[i].first];
+    if ( s[i].header || s[i].run || !is_letter(name[0]) || strchr(name, '.') || !isDefinition(TS, s[i], name) ) continue;
+    for (int j = 0; j < num && !s[i].defines; j++)
+      if ( !s[j].header && !s[j].loop && !isDefinition(TS, s[j], name) && refersTo(TS, s[j], name) ) s[i].defines = name;
+  }
+  return s;
+}
+
+//**************************************************************************
+//  The names the statements of the first k segments depend on
+
+static void neededNames(TokenString &TS, PrefixStatement *s, int num, int k, NameSet &needed)
+{
+  bool *done = new bool[num], changed = true;
+
+  for (int i = 0; i < num; i++) done[i] = s[i].header || s[i].loop || s[i].run > k;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < num; i++) {
+      if ( done[i] || ( s[i].defines && !needed.has(s[i].defines) ) ) continue;
+      for (long p = s[i].first; p <= s[i].last; p++) if ( is_letter(TS[p][0]) ) needed.add(TS[p]);
+      done[i] = changed = true;
+    }
+  }
+  delete [] done;
+}
+
+//**************************************************************************
+
+static void append(char *&key, size_t &size, size_t &len, const char *item)
+{
+  size_t n = strlen(item);
+  if (len + n + 1 > size) {
+    char *s = new char[size = 2 * (len + n + 1)];
+    strcpy(s, key);
+    delete [] key;
+    key = s;
+  }
+  strcpy(key + len, item);
+  len += n;
+}
+
+static unsigned long long fingerprint(const char *key)   // 64-bit FNV-1a hash
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for ( ; *key; key++) { h ^= (unsigned char)(*key); h *= 1099511628211ULL; }
+  return h;
+}
+
+//**************************************************************************
+//  The key of the first k segments: the version, the total simulation time
+//  (the plots are sampled in proportion to it), the relevant statements, and
+//  the bindings of the loop variables these depend on
+//**************************************************************************
+
+PrefixCache::PrefixCache(SimulationObj &Sim, const char *directory)
+{
+  TokenString &TS = *Sim.Params;
+  char item[MAX_STRING_LENGTH];
+  int  num;
+
+  PrefixStatement *s = splitStatements(TS, num);
+  NameSet loopVars(TS.token_num);
+  for (int i = 0; i < num; i++) if ( s[i].loop && s[i].last > s[i].first ) loopVars.add( TS[s[i].first + 1] );
+
+  dir     = StrCpy(directory);
+  runs    = TS.token_count("Run");
+  keys    = new char *[runs];
+  storing = true;
+
+  for (int k = 1; k <= runs; k++) {
+    NameSet needed(TS.token_num);
+    neededNames(TS, s, num, k, needed);
+
+    size_t size = 1024, len = 0;
+    char   *key = new char[size];
+    key[0] = 0;
+    snprintf(item, sizeof(item), "CalC %s: Runs 1-%d, total time %.17g\n", versionStr, k, Sim.totalSimTime);
+    append(key, size, len, item);
+
+    for (int i = 0; i < num; i++) {
+      if ( s[i].loop || s[i].run > k ) continue;
+      if ( s[i].header && loopVars.has(TS[s[i].first]) && !needed.has(TS[s[i].first]) ) continue;
+      for (long p = s[i].first; p <= s[i].last; p++) {
+        append(key, size, len, TS[p]);
+        append(key, size, len, (p < s[i].last) ? " " : "\n");
+      }
+    }
+    keys[k - 1] = key;
+  }
+  delete [] s;
+
+  makeDir(dir);   // may already exist
+}
+
+//**************************************************************************
+
+PrefixCache *PrefixCache::create(SimulationObj &Sim)
+{
+  TokenString &TS = *Sim.Params;
+  char directory[MAX_STRING_LENGTH];
+  const char *reason = 0;
+
+  if ( !TS.token_count("sweep.cache") ) return 0;
+  TS.get_string_param("sweep.cache", directory);
+
+  if      ( TS.token_count("rand(") )       reason = "random numbers";
+  else if ( Sim.Gates->switches->number )   reason = "Markov channels";
+  else if ( TS.token_count("Import") )      reason = "an \"Import\" statement";
+
+  if (reason) {
+    if (VERBOSE) fprintf(stderr, "\n*** Warning: the script uses %s; the simulation state is not cached\n", reason);
+    return 0;
+  }
+  return new PrefixCache(Sim, directory);
+}
+
+//**************************************************************************
+
+PrefixCache::~PrefixCache()
+{
+  for (int k = 0; k < runs; k++) delete [] keys[k];
+  delete [] keys;
+  delete [] dir;
+}
+
+//**************************************************************************
+
+void PrefixCache::snapshotName(int k, char *name)
+{
+  snprintf(name, MAX_STRING_LENGTH - 1, "%s/%016llx.snapshot", dir, fingerprint(keys[k - 1]));
+}
+
+//**************************************************************************
+//  Snapshot file: the tag, the length and the text of the key, the time,
+//  the state of the simulation (SimulationObj::exportState), and the tag
+//**************************************************************************
+
+int PrefixCache::resume(SimulationObj &Sim, double &T)
+{
+  char name[MAX_STRING_LENGTH], tag[sizeof(SNAPSHOT_TAG)];
+
+  for (int k = runs; k > 0; k--) {
+    snapshotName(k, name);
+    FILE *f = fopen(name, "rb");
+    if (!f) continue;
+
+    bool match = false;
+    long len   = 0;
+    try {
+      readState(f, tag, sizeof(tag));
+      readState(f, &len, sizeof(long));
+      tag[sizeof(tag) - 1] = 0;
+      if ( equal(tag, SNAPSHOT_TAG) && len == long( strlen(keys[k - 1]) ) ) {
+        char *key = new char[len + 1];
+        readState(f, key, len);
+        key[len] = 0;
+        match = equal(key, keys[k - 1]);
+        delete [] key;
+      }
+    } catch (char *str) { delete [] str; }
+    if (!match) { fclose(f); continue; }   // a different prefix with the same fingerprint
+
+    try {
+      readState(f, &T, sizeof(double));
+      Sim.importState(f);
+      readState(f, tag, sizeof(tag));
+      tag[sizeof(tag) - 1] = 0;
+      if ( !equal(tag, SNAPSHOT_TAG) ) throw makeMessage("the file size does not match the simulation");
+    } catch (char *str) {
+      fclose(f);
+      char *message = makeMessage("Snapshot file %s: %s (delete the file to recompute it)", name, str);
+      delete [] str;
+      throw message;
+    }
+    fclose(f);
+
+    if (VERBOSE) fprintf(stderr, "\n#### Resuming from the state after Run #%d (time = %g ms) cached in %s\n", k, T, name);
+    return k;
+  }
+  return 0;
+}
+
+//**************************************************************************
+//  The snapshot is written under a temporary name and then renamed, so that
+//  the steps running in parallel never read an incomplete file
+//**************************************************************************
+
+void PrefixCache::store(SimulationObj &Sim, int k, double T)
+{
+  char name[MAX_STRING_LENGTH], temp[MAX_STRING_LENGTH + 64];
+
+  if ( !storing ) return;
+  snapshotName(k, name);
+
+  FILE *f = fopen(name, "rb");
+  if (f) { fclose(f); return; }   // cached by an earlier step
+
+  snprintf(temp, sizeof(temp), "%s.%d-%lx", name, int( getpid() ),
+           (unsigned long)( std::hash<std::thread::id>()( std::this_thread::get_id() ) ));
+  if ( !(f = fopen(temp, "wb")) ) {
+    if (VERBOSE) fprintf(stderr, "\n*** Warning: cannot write into the snapshot directory %s; the simulation state is not cached\n", dir);
+    storing = false;
+    return;
+  }
+
+  long len = long( strlen(keys[k - 1]) );
+  bool supported = true, wrote = true;
+  try {
+    writeState(f, SNAPSHOT_TAG, sizeof(SNAPSHOT_TAG));
+    writeState(f, &len, sizeof(long));
+    writeState(f, keys[k - 1], len);
+    writeState(f, &T, sizeof(double));
+    if ( (supported = Sim.exportState(f)) ) writeState(f, SNAPSHOT_TAG, sizeof(SNAPSHOT_TAG));
+  } catch (char *str) { delete [] str; wrote = false; }
+  if ( fclose(f) != 0 ) wrote = false;
+
+  if ( supported && wrote && rename(temp, name) == 0 ) {
+    if (VERBOSE > 3) fprintf(stderr, " ### State after Run #%d cached in %s\n", k, name);
+    return;
+  }
+  remove(temp);
+
+  if (!supported) {
+    if (VERBOSE) fprintf(stderr, "\n*** Warning: a plot of the script does not support snapshots; the simulation state is not cached\n");
+    storing = false;
+  }
+  else if (!wrote && VERBOSE) fprintf(stderr, "\n*** Warning: could not write the snapshot file %s\n", name);
+}
@@ -0,0 +1,69 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                              prefix.h
+ *
+ *  Caching of the simulation state at the end of each "Run" statement, for
+ *  the sweeps whose steps share the first "Run" segments ("sweep.cache =
+ *  directory"). The state after the first k "Run"s is stored in a snapshot
+ *  file named by the fingerprint of the inputs of these Runs: the script
+ *  without its "for" statements and the later "Run" and "current"
+ *  statements, and the values of the loop variables the remaining
+ *  statements depend on. A step of the sweep starts from the snapshot of
+ *  its longest cached prefix, if any, and runs only the remaining Runs.
+ *
+ *  Scripts with random numbers, Markov channels or an "Import" statement
+ *  are not cached, nor those with a plot that does not support snapshots
+ *  (PlotObj::exportState). Delete the directory to clear the cache
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_PREFIX_H_included
+#define CALC_PREFIX_H_included
+
+#define SNAPSHOT_TAG "CalC snapshot 2"   // 2: the mute plots hold the bytes of their files
+
+//*************************************************************************************
+
+class PrefixCache
+{
+  char  *dir;
+  int   runs;
+  char  **keys;      // keys[k-1]: the inputs of the first k "Run"s, or 0 if these are not cached
+  bool  storing;     // false if a plot turned out not to support snapshots
+
+  PrefixCache(class SimulationObj &Sim, const char *directory);
+
+  void snapshotName(int k, char *name);
+
+ public:
+
+  static PrefixCache *create(class SimulationObj &Sim);   // 0 if the script is not cached
+ ~PrefixCache();
+
+  int  resume(class SimulationObj &Sim, double &T);   // loads the longest cached prefix, returns its number of Runs
+  void store (class SimulationObj &Sim, int k, double T);   // the state after the first k Runs
+};
+
+//*************************************************************************************
+
+#endif
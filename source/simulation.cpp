@@ -47,6 +47,7 @@
 #include <float.h>  // for compatibility with Visual C++
 #include <string.h>
 #include <stdarg.h>
+#include <memory>
 #include "vector.h"
 #include "syntax.h"
 #include "box.h"
@@ -59,9 +60,11 @@
 #include "simulation.h"
 #include "gate.h"
 #include "fplot.h"
+#include "prefix.h"
+#include "output.h"
 
-extern int    Number_Of_Iterations_Per_PDE_Step;   
-extern double CHARGE_LOSS;
+extern thread_local int    Number_Of_Iterations_Per_PDE_Step;   
+extern thread_local double CHARGE_LOSS;
 
 extern double get_sim_time(TokenString &TS);
 extern void   setFieldByFunction(TokenString &TS, long p, double *Diff, const char *errStr);
@@ -71,6 +74,12 @@ extern void   getRun( TokenString &TS, int i, bool *adaptive, double *time=0, do
 
 //*******************************************************************************************
 
+thread_local char      *SimulationObj::geometryKey  = 0;
+thread_local RegionObj *SimulationObj::cachedRegion = 0;
+thread_local GridObj   *SimulationObj::cachedGrid   = 0;
+
+//*******************************************************************************************
+
 SimulationObj::SimulationObj(TokenString &TS) {
 
   initialize();
@@ -120,11 +129,27 @@ SimulationObj::SimulationObj(TokenString &TS) {
 
   Params  = &TS;
   BCArray = new BCarrayObj(TS);
-  Synapse = new RegionObj(TS);
-  Grid    = new GridObj( *Synapse, TS);
-  FieldObj::setStaticData(*Synapse, *Grid, *BCArray); 
-  Synapse->bindToGrid( *Grid );
-  Synapse->computeFormulas(TS);
+
+  char *key = getGeometryKey(TS);
+  if ( key && geometryKey && equal(key, geometryKey) ) {
+    if (VERBOSE) fprintf(stderr, "\n#### Geometry and grid unchanged: reusing those of the previous simulation\n");
+    delete [] key;
+    Synapse = cachedRegion;
+    Grid    = cachedGrid;
+    FieldObj::setStaticData(*Synapse, *Grid, *BCArray); 
+    Synapse->bindToGrid( *Grid );
+  }
+  else {
+    releaseGeometry();
+    Synapse = new RegionObj(TS);
+    Grid    = new GridObj( *Synapse, TS);
+    FieldObj::setStaticData(*Synapse, *Grid, *BCArray); 
+    Synapse->bindToGrid( *Grid );
+    Synapse->computeFormulas(TS);
+    geometryKey  = key;
+    cachedRegion = Synapse;
+    cachedGrid   = Grid;
+  }
   Ca      = new FieldObj(TS);
   Ca->adjust_sources(*Ca);  // Increase current if some of it falls outsise the boundary
   kuptake = new VectorObj(Grid->Size);
@@ -173,6 +198,7 @@ SimulationObj::SimulationObj(TokenString &TS) {
   Params->get_param    ("adaptive.dt0",      &m_dt0);         Params->get_param("adaptive.dtMax",     &m_dtMax);  
   Params->get_param    ("adaptive.accuracy", &m_accuracy);    Params->get_param("adaptive.dtStretch", &m_dtStretch); 
   Params->get_param    ("ODE.accuracy",      &m_ODEaccuracy); Params->get_param("adaptive.dtMax",     &m_dtMax);         
+  m_landing = Params->Assert("adaptive.landing", "on");
 
   ERROR_FLAG = 0;
  }
@@ -188,13 +214,72 @@ SimulationObj::~SimulationObj() {
   FieldObj::kill_tridiag();      
   if (Buffers)        delete Buffers;
   if (Ca)             delete Ca;
-  if (Grid)           delete Grid;
-  if (Synapse)        delete Synapse;
+  if (Grid && Grid != cachedGrid)          delete Grid;       // otherwise kept for the next simulation
+  if (Synapse && Synapse != cachedRegion)  delete Synapse;
   if (BCArray)        delete BCArray;
   if (kuptake)        delete kuptake;
   ERROR_FLAG = 1;
 }
 
+//********************************************************************************************
+//  The key of the geometry and the grid: the statements defining the geometry, the volumes,
+//  the obstacles, the grid and its stretching, with the parameters replaced by their values.
+//  Returns 0 (no reuse) if the script calls the random number generator, since the values
+//  would then differ between the evaluations
+//********************************************************************************************
+
+static const char *geometryStatements[] = { "geometry", "volume", "obstacle", "grid", "stretch", "stretch.factor", 0 };
+
+char *SimulationObj::getGeometryKey(TokenString &TS) {
+
+  if ( TS.token_count("rand(") ) return 0;
+
+  size_t size = 1024, len = 0;
+  char   *key = new char[size], item[MAX_TOKEN_LENGTH + 32];
+  double value;
+  long   pos;
+
+  key[0] = 0;
+  for (int k = 0; geometryStatements[k]; k++)
+    for (int i = 1; i <= TS.token_count(geometryStatements[k]); i++) {
+      long p = TS.token_index(geometryStatements[k], i), last = TS.lastInLine(p);
+      for ( ; p <= last + 1; p++) {
+        bool number = false;
+        if ( p <= last && is_letter(TS[p][0]) )
+          try { number = TS.isNumberParam(TS[p], pos, &value); }
+          catch (char *str) { delete [] str; }   // bad definitions are reported when the geometry is built
+          catch (int)       { }
+        if (p > last)    snprintf(item, sizeof(item), "\n");
+        else if (number) snprintf(item, sizeof(item), "%.17g ", value);
+        else             snprintf(item, sizeof(item), "%s ", TS[p]);
+
+        size_t n = strlen(item);
+        if (len + n + 1 > size) {
+          char *s = new char[size = 2 * (len + n + 1)];
+          strcpy(s, key);
+          delete [] key;
+          key = s;
+        }
+        strcpy(key + len, item);
+        len += n;
+      }
+    }
+  return key;
+}
+
+//********************************************************************************************
+
+void SimulationObj::releaseGeometry() {
+
+  FieldObj::release_boundaries();
+  if (cachedGrid)   delete cachedGrid;
+  if (cachedRegion) delete cachedRegion;
+  if (geometryKey)  delete [] geometryKey;
+  cachedGrid   = 0;
+  cachedRegion = 0;
+  geometryKey  = 0;
+}
+
 //********************************************************************************************
 //********************************************************************************************
 
@@ -300,17 +385,42 @@ FieldObj *SimulationObj::ResolveField(const char *label) {
 //**************************************************************************************************
 
 
+//  The state is copied, and the file is written on the output thread (see output.h)
+
 void SimulationObj::Export(const char *filename)
 {
-  FILE *f;
   char endtag[7];
   strcpy(endtag,"endtag");
-  size_t wrote, toWrite;
 
   if (VERBOSE) 
     fprintf(stderr,"\n#### Dumping all state variables into file %s\n", filename);
 
-  f = fopenAssure(filename, "wb", "Simulation state export", "");
+  size_t size = strlen(endtag) + 1;
+  if (Ca)      size += sizeof(long) + Ca->size * sizeof(double);
+  if (Buffers) for (int i = 0; i < Buffers->buf_num; i++) size += Buffers->array[i]->size * sizeof(double);
+  if (Gates)   size += sizeof(int) + Gates->var_num * sizeof(double);
+
+  FileJob *job = new FileJob(filename, "wb", size, "Simulation state export");
+  if (Ca) {
+    job->add(&Ca->size, sizeof(long));
+    job->add(Ca->elem,  Ca->size * sizeof(double));
+  }
+  if (Buffers)
+    for (int i = 0; i < Buffers->buf_num; i++) job->add(Buffers->array[i]->elem, Buffers->array[i]->size * sizeof(double));
+  if (Gates) {
+    int m = Gates->var_num;
+    job->add(&m, sizeof(int));
+    job->add(Gates->var->elem, Gates->var_num * sizeof(double));
+  }
+  job->add(endtag, strlen(endtag) + 1);
+  OutputThread::post(job);
+}
+
+//**************************************************************************************************
+
+void SimulationObj::exportFields(FILE *f, const char *filename)
+{
+  size_t wrote, toWrite;
 
   if (Ca) {
 	toWrite = Ca->size;
@@ -335,10 +445,6 @@ void SimulationObj::Export(const char *filename)
      fwrite( &m, sizeof(int), 1, f );
      fwrite( (void *)(Gates->var->elem), sizeof(double), Gates->var_num, f);
   }
-
-  fwrite( (void *)endtag, sizeof(char), strlen(endtag)+1, f);
-  fflush(f);
-  fclose(f);
 }
 
 
@@ -352,8 +458,25 @@ void SimulationObj::Import(const char *filename)
   if (VERBOSE) 
     fprintf(stderr,"\n#### Importing all state variables from file %s\n", filename);
 
+  OutputThread::wait();   // the file may have been exported by this thread
   f = fopenAssure(filename, "rb", "Simulation state import", "");
+  importFields(f, filename);
+  if (Gates) {
+    Gates->locations->reset();
+    Gates->Evaluate();
+  }
 
+  fread( (void *)endtag, sizeof(char), strlen("endtag")+1, f );
+  if ( !equal(endtag,"endtag") )  
+    throw makeMessage("in Import: file size mismatch (endtag=%s)\n", endtag);
+
+  fclose(f);
+}
+
+//**************************************************************************************************
+
+void SimulationObj::importFields(FILE *f, const char *filename)
+{
   long n, Size;
   size_t imported;
   
@@ -383,15 +506,55 @@ void SimulationObj::Import(const char *filename)
     if (m != Gates->var_num)  
       throw makeMessage("Can't import the dynamic variables: wrong number of ODE variables (%d vs %d)\n", m, Gates->var_num);
     fread( (void *)(Gates->var->elem), sizeof(double), Gates->var_num, f);
-    Gates->locations->reset();
-    Gates->Evaluate();
   }
+}
 
-  fread( (void *)endtag, sizeof(char), strlen("endtag")+1, f );
-  if ( !equal(endtag,"endtag") )  
-    throw makeMessage("in Import: file size mismatch (endtag=%s)\n", endtag);
+//**************************************************************************************************
+//  Snapshot of the simulation at the end of a "Run" (see prefix.h): the payload of Export(),
+//  followed by the time and the current of each field, the run parameters carried over to
+//  the next "Run", the complete state of the ODE variables and trackers, and the plots
+//**************************************************************************************************
 
-  fclose(f);
+bool SimulationObj::exportState(FILE *f)
+{
+  double run[6] = { m_dt0, m_accuracy, m_dtStretch, m_ODEaccuracy, m_dtMax, CHARGE_LOSS };
+
+  exportFields(f, "(snapshot)");
+  if (Ca) {
+    writeState(f, &Ca->Time, sizeof(double));
+    writeState(f, &Ca->ICa,  sizeof(double));
+  }
+  if (Buffers)
+    for (int i = 0; i < Buffers->buf_num; i++) {
+      writeState(f, &Buffers->array[i]->Time, sizeof(double));
+      writeState(f, &Buffers->array[i]->ICa,  sizeof(double));
+    }
+  writeState(f, run, sizeof(run));
+  Gates->exportState(f);
+  return Plots->exportState(f);
+}
+
+//**************************************************************************************************
+
+void SimulationObj::importState(FILE *f)
+{
+  double run[6];
+
+  importFields(f, "(snapshot)");
+  if (Ca) {
+    readState(f, &Ca->Time, sizeof(double));
+    readState(f, &Ca->ICa,  sizeof(double));
+  }
+  if (Buffers)
+    for (int i = 0; i < Buffers->buf_num; i++) {
+      readState(f, &Buffers->array[i]->Time, sizeof(double));
+      readState(f, &Buffers->array[i]->ICa,  sizeof(double));
+    }
+  readState(f, run, sizeof(run));
+  m_dt0         = run[0];  m_accuracy = run[1];  m_dtStretch = run[2];
+  m_ODEaccuracy = run[3];  m_dtMax    = run[4];  CHARGE_LOSS = run[5];
+  Gates->importState(f);
+  Plots->importState(f);
 }
 
 
@@ -442,7 +605,7 @@ long SimulationObj::Adaptive(double T)  {
   FieldObj      oldCa(*Ca), CaNew(*Ca), CaNew2(*Ca);
   BufferArray   BufNew(*Buffers), oldBuf(*Buffers);
   double        oneHi, twoHi, oneLo, twoLo, errorHi, errorLo, error;
-  double        old_dt = m_dt0, dt = m_dt0;
+  double        old_dt = m_dt0, dt = m_dt0, landed = 0.0;
   int           rvalue = 0, errorODE = 0;
   long          between_checks = 0, total_steps = 0, since_last_divide = 0, total_backsteps = 0;
 
@@ -462,6 +625,13 @@ long SimulationObj::Adaptive(double T)  {
       dt *= m_dtStretch;
 	  if (dt > m_dtMax) dt = m_dtMax;
 	  if (Ca->Time + dt >= T) { m_dt0 = dt / 2.0; dt = T - Ca->Time; rvalue = 1; }
+	  else if (m_landing) {   // the step is shortened to end at the next plot time
+		  double due = Plots->due();
+		  if (due > Ca->Time && due < Ca->Time + dt) {
+			  landed = dt;  dt = due - Ca->Time;
+			  while (Ca->Time + dt < due) dt = nextafter(dt, DBL_MAX);
+		  }
+	  }
       Ca->evaluateCurrents();
 	  Plots->draw_all();
       
@@ -500,6 +670,7 @@ long SimulationObj::Adaptive(double T)  {
 	  try { Gates->RungeKuttaAdaptive(dt, m_ODEaccuracy, 0, ODEstatus, T); }
 	  catch (char *errorMsg) { fprintf(stderr, "%s", errorMsg); errorODE = 1; break; }
       Plots->draw_all();
+      if (landed > 0.0) { dt = landed;  landed = 0.0; }
       since_last_divide ++; 
       if (status) status->update('.');
       if (VERBOSE > 6) fprintf(stderr, "\n > Adaptive step #%ld (of %ld): T=%g(%g) dt=%.3g", i, between_checks, Ca->Time, Gates->Time, dt);  
@@ -540,7 +711,7 @@ long SimulationObj::Adaptive(double T)  {
        *Ca = oldCa; *Buffers = oldBuf; BufNew = oldBuf;
 	   CaNew.Time = Ca->Time;
 	   Gates->recoverState(); Gates->Evaluate(); Ca->evaluateCurrents();
-       dt = (old_dt *= 0.5);
+       dt = (old_dt *= 0.5);  landed = 0.0;
 	   if ( Ca->Time + dt <= Ca->Time )  globalError( makeMessage("*** Error: adaptive time step is too small (dt = %.2e)", dt) );
        Plots->draw_all();
        total_backsteps++;
@@ -586,8 +757,11 @@ void SimulationObj::Run() {
   double t, T = 0.0;
   long   nIterations;
   Plots->draw_all();
+
+  std::unique_ptr<PrefixCache> cache( PrefixCache::create(*this) );  // "sweep.cache": resume from the state cached by an earlier step;
+  int first = cache ? cache->resume(*this, T) : 0;                    // deleted (with its temp snapshot) even if the Run throws
   
-  for (int i = 1; i <= Params->token_count("Run"); i++)  {
+  for (int i = first + 1; i <= Params->token_count("Run"); i++)  {
       
      getRun( *Params, i, &adaptive, &t );
      Ca->getCurrents(*Params, i, (VarList *)this, &Gates->Time); 
@@ -629,6 +803,7 @@ void SimulationObj::Run() {
 			else fprintf(stderr," ## charge gain = %.4g%% (net charge = %g, integrated flux = %g), %ld iterations \n", -CHARGE_LOSS, exper, theor, nIterations ); 
 		}
 		Ca->killCurrents();
+		if (cache) cache->store(*this, i, T);
   } // i loop over runs
 
   if (VERBOSE) fprintf(stderr, "\n### Simulation completed: total time = %g ms\n",T );
@@ -647,6 +822,9 @@ ODESimulationObj::ODESimulationObj(TokenString &TS) : SimulationObj() {
      Gates        = new KineticObj(this);
      if ( TS.token_count("Import", &pos) ) Import( Params->line_string( pos + 1, temp ) );
      Plots        = new PlotArray(*this);
+
+     double denseDt = 0;  // point plots are sampled at multiples of "plot.dense.dt" using the RK dense output
+     if ( Params->get_param("plot.dense.dt", &denseDt) > 0 ) Plots->setDense(denseDt);
      Plots->redraw_all();
 
      m_dt0 = 1.0;
@@ -655,19 +833,27 @@ ODESimulationObj::ODESimulationObj(TokenString &TS) : SimulationObj() {
      Params->get_param("ODE.accuracy", &m_ODEaccuracy);
   }                                 
 
+ODESimulationObj::~ODESimulationObj() {    // the buffered plot files are written when the plots are closed
+     if (Plots) delete Plots;
+     Plots = 0;
+  }
+
 //*******************************************************************************************
 
 void ODESimulationObj::Run()  {
   double time = 0;
   bool   flag;
 
-  RunStatusString *rss = 0;
-  if (VERBOSE > 2)  rss = new RunStatusString(30, "time", &(Gates->Time), 0);
-  else if (VERBOSE) rss = new RunStatusString(1,  "time", &(Gates->Time), 0);
+  std::unique_ptr<RunStatusString> rss;
+  if (VERBOSE > 2)  rss.reset( new RunStatusString(30, "time", &(Gates->Time), 0) );
+  else if (VERBOSE) rss.reset( new RunStatusString(1,  "time", &(Gates->Time), 0) );
 
   if (VERBOSE) fprintf(stderr,"\n\n#### Running the ODEs: total simulation time = %g\n", totalSimTime);
 
-  for (int i = 1; i <= Params->token_count("Run"); i++) {
+  std::unique_ptr<PrefixCache> cache( PrefixCache::create(*this) );
+  int first = cache ? cache->resume(*this, time) : 0;
+
+  for (int i = first + 1; i <= Params->token_count("Run"); i++) {
     
     getRun(*Params, i, &flag, &time, &m_ODEaccuracy, &m_dt0);
 
@@ -675,12 +861,11 @@ void ODESimulationObj::Run()  {
             i, time, m_ODEaccuracy, m_dt0);
 
     if (rss) rss->reset( Gates->Time + time );
-    Gates->RungeKuttaAdaptive(time, m_ODEaccuracy, Plots, rss, totalSimTime, m_dt0);
+    Gates->RungeKuttaAdaptive(time, m_ODEaccuracy, Plots, rss.get(), totalSimTime, m_dt0);
     if (VERBOSE) fprintf(stderr,"\n");
     Plots->redraw_all();
+    if (cache) cache->store(*this, i, Gates->Time);
   }
-
-  if (rss) delete rss;
 }
 //*******************************************************************************************************
 //@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
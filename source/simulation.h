@@ -59,6 +59,7 @@ class SimulationObj : public VarList {
  protected:
 
   double       m_dt0, m_accuracy, m_dtStretch, m_ODEaccuracy, m_dtMax;
+  bool         m_landing;      // "adaptive.landing = on": the steps end at the plot times (see PlotArray::due)
   char         ERROR_FLAG;
 
  public:
@@ -89,11 +90,26 @@ class SimulationObj : public VarList {
   SimulationObj(TokenString &TS);
  ~SimulationObj();
 
+  // The geometry and the grid are kept for the next simulation (the next step of the "for"
+  // loops), and reused if the statements defining them evaluate to the same key
+
+  static thread_local char      *geometryKey;
+  static thread_local RegionObj *cachedRegion;
+  static thread_local GridObj   *cachedGrid;
+
+  static char *getGeometryKey(TokenString &TS);
+  static void  releaseGeometry();
+
   void initTortuosity();
   void killTortuosity();
 
   void Export(const char *filename);
   void Import(const char *filename);
+  void exportFields(FILE *f, const char *filename);  // the state written by Export(): the fields and the ODE variables
+  void importFields(FILE *f, const char *filename);
+
+  bool exportState(FILE *f);   // snapshot at the end of a "Run" (see prefix.h); false if a plot does not support it
+  void importState(FILE *f);
   
   double         *ResolveID   (const char *, double **t=0);
   const char     *ResolvePtr  (double *ptr);
@@ -111,7 +127,7 @@ class ODESimulationObj : public SimulationObj {
  public:
 
    ODESimulationObj(TokenString &TS);
-  ~ODESimulationObj() { }
+  ~ODESimulationObj();
 
   void Run();                
 };
@@ -0,0 +1,261 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                            snapshot.cpp
+ *
+ *  The shared-memory ring of plot snapshots, and its headless reader
+ *  ("calc --snapshots")
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include "syntax.h"
+#include "snapshot.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/mman.h>
+#endif
+
+extern thread_local int VERBOSE;
+
+//**************************************************************************
+//  The file of a ring: a name without a '/' is placed in /dev/shm
+
+static void ringPath(const char *name, char *path)
+{
+  if ( strchr(name, '/') ) snprintf(path, 511, "%s", name);
+  else                     snprintf(path, 511, "/dev/shm/%s", name);
+}
+
+//**************************************************************************
+
+SnapshotRing::SnapshotRing(const char *name, int n)
+{
+  ringPath(name, path);
+  slots     = n;
+  slotSize  = 0;
+  mapSize   = 0;
+  map       = 0;
+  header    = 0;
+  published = 0;
+  if (slots < 2) throw makeMessage("The snapshot ring should have at least 2 slots (plot.shm.slots = %d)", slots);
+#ifdef _WIN32
+  throw makeMessage("Shared-memory snapshots (\"plot.shm\") are not available on this platform");
+#endif
+}
+
+//**************************************************************************
+
+SnapshotRing::~SnapshotRing()
+{
+#ifndef _WIN32
+  if (map) {
+    header->done.store(1, std::memory_order_release);
+    munmap(map, mapSize);
+    unlink(path);
+  }
+#endif
+  if (VERBOSE > 1 && published) fprintf(stderr, "### Snapshot ring %s: %lld frames published\n", path, published);
+}
+
+//**************************************************************************
+//  A file left by an earlier run is replaced; its readers keep the old one
+
+void SnapshotRing::start()
+{
+#ifndef _WIN32
+  long long data = ( (long long)(sizeof(SnapshotHeader) + introUsed) + 63 ) / 64 * 64;
+  slotSize = ( (long long)(sizeof(long long) + sizeof(StreamHeader) + maxValues * sizeof(double)) + 63 ) / 64 * 64;
+  mapSize  = size_t(data + slots * slotSize);
+
+  unlink(path);
+  int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if ( fd < 0 || ftruncate(fd, off_t(mapSize)) ) {       // the slots start zeroed: no frame is complete
+    int error = errno;
+    if (fd >= 0) { close(fd); unlink(path); }
+    throw makeMessage("Cannot create the snapshot ring \"%s\": %s", path, strerror(error));
+  }
+  void *p = mmap(0, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    unlink(path);
+    throw makeMessage("Cannot map the snapshot ring \"%s\": %s", path, strerror(errno));
+  }
+
+  map    = (char *) p;
+  header = (SnapshotHeader *) map;
+  header->version   = SHM_RING_VERSION;
+  header->slots     = slots;
+  header->slotSize  = slotSize;
+  header->introSize = (long long) introUsed;
+  header->data      = data;
+  header->pid       = int( getpid() );
+  header->head.store(0, std::memory_order_relaxed);
+  header->done.store(0, std::memory_order_relaxed);
+  if (introUsed) memcpy(map + sizeof(SnapshotHeader), intro, introUsed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->tag, SHM_RING_TAG, 8);                  // a reader checks the tag last
+
+  if (VERBOSE > 1)
+    fprintf(stderr, "### Snapshot ring %s: %d slots of %lld bytes\n", path, slots, slotSize);
+#endif
+}
+
+//**************************************************************************
+
+void SnapshotRing::send(int plot, double time, const double *v, int n)
+{
+  if (!map) return;
+
+  long long k = ++published;
+  char *slot  = map + header->data + ( (k - 1) % slots ) * slotSize;
+  std::atomic<long long> *sequence = (std::atomic<long long> *) slot;
+  size_t bytes = compose(STREAM_VALUES, plot, time, v, n, n * sizeof(double));
+
+  sequence->store(2 * k - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);  // the odd sequence is seen before the new frame
+  memcpy(slot + sizeof(long long), frame, bytes);
+  sequence->store(2 * k, std::memory_order_release);
+  header->head.store(k, std::memory_order_release);
+}
+
+//**************************************************************************
+//  The headless reader: every frame is taken as soon as it is published,
+//  and checked against the titles of the plots; the frames overwritten
+//  before they could be read are counted as skipped
+//**************************************************************************
+
+int readSnapshots(const char *name, int plot)
+{
+#ifdef _WIN32
+  throw makeMessage("Shared-memory snapshots are not available on this platform");
+#else
+  char   path[512];
+  struct stat st;
+
+  ringPath(name, path);
+  int fd = open(path, O_RDONLY);
+  if ( fd < 0 || fstat(fd, &st) ) throw makeMessage("Cannot open the snapshot ring \"%s\": %s", path, strerror(errno));
+  size_t size = size_t(st.st_size);
+  void *p = (size >= sizeof(SnapshotHeader)) ? mmap(0, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (p == MAP_FAILED) throw makeMessage("Cannot map the snapshot ring \"%s\"", path);
+
+  const char *map = (const char *) p;
+  const SnapshotHeader *H = (const SnapshotHeader *) map;
+  if ( memcmp(H->tag, SHM_RING_TAG, 8) ) {
+    munmap(p, size);
+    throw makeMessage("\"%s\" is not a snapshot ring (or it is not ready yet)", path);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if ( H->version != SHM_RING_VERSION || H->slots < 2 || H->slotSize < (long long)(sizeof(long long) + sizeof(StreamHeader)) ||
+       H->data < (long long)(sizeof(SnapshotHeader) + H->introSize) || H->data + H->slots * H->slotSize > (long long) size ) {
+    munmap(p, size);
+    throw makeMessage("The header of the snapshot ring \"%s\" is invalid", path);
+  }
+
+  //**************** the titles and the axes: the number of values of each plot
+
+  int  plots = 0, *values = new int[1], maxPlots = 1;
+  long long at = sizeof(SnapshotHeader), end = at + H->introSize;
+  StreamHeader h;
+  while (at + (long long) sizeof(h) <= end) {
+    memcpy(&h, map + at, sizeof(h));
+    size_t bytes = (h.kind == STREAM_TITLE) ? size_t(h.count) : h.count * sizeof(double);
+    if ( h.magic != STREAM_MAGIC || h.count < 0 || (h.kind != STREAM_TITLE && h.kind != STREAM_AXIS) ||
+         at + (long long)(sizeof(h) + bytes) > end ) break;
+    if (h.kind == STREAM_TITLE) {
+      if (h.plot != plots) break;
+      if (plots == maxPlots) {
+        int *v = new int[maxPlots *= 2];
+        memcpy(v, values, plots * sizeof(int));
+        delete [] values;
+        values = v;
+      }
+      values[plots++] = int(h.time);
+    }
+    if (plot < 0 || h.plot == plot) printFrame(h, map + at + sizeof(h));
+    at += (long long)(sizeof(h) + bytes);
+  }
+  if (at != end) {
+    delete [] values;
+    munmap(p, size);
+    throw makeMessage("The titles of the snapshot ring \"%s\" are invalid", path);
+  }
+
+  //**************** the frames
+
+  long long next = 1, read = 0, skipped = 0, invalid = 0, idle = 0;
+  size_t    room = size_t(H->slotSize) - sizeof(long long);
+  char      *copy = new char[room];
+
+  while (true) {
+    long long head = H->head.load(std::memory_order_acquire);
+    if (next > head) {
+      if ( H->done.load(std::memory_order_acquire) && next > H->head.load(std::memory_order_acquire) ) break;
+      if (++idle % 1000 == 0 && kill(H->pid, 0) && errno == ESRCH) break;   // the solver is gone
+      usleep(1000);
+      continue;
+    }
+    idle = 0;
+    if (head - next >= H->slots) { skipped += head - H->slots + 1 - next;  next = head - H->slots + 1; }
+
+    const char *slot = map + H->data + ( (next - 1) % H->slots ) * H->slotSize;
+    const std::atomic<long long> *sequence = (const std::atomic<long long> *) slot;
+    long long s1 = sequence->load(std::memory_order_acquire);
+    memcpy(copy, slot + sizeof(long long), room);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    long long s2 = sequence->load(std::memory_order_relaxed);
+    if (s1 != 2 * next || s2 != s1) { skipped++; next++; continue; }   // overwritten meanwhile
+
+    memcpy(&h, copy, sizeof(h));
+    if ( h.magic != STREAM_MAGIC || h.kind != STREAM_VALUES || h.plot < 0 || h.plot >= plots ||
+         h.count != values[h.plot] || sizeof(h) + h.count * sizeof(double) > room || !_finite(h.time) ) {
+      invalid++;
+      fprintf(stderr, "*** Invalid frame #%lld in the snapshot ring %s (plot %d, %d values)\n", next, path, h.plot, h.count);
+    }
+    else if (plot < 0 || h.plot == plot) printFrame(h, copy + sizeof(h));
+    read++;
+    next++;
+  }
+
+  delete [] copy;
+  delete [] values;
+  munmap(p, size);
+  if (VERBOSE)
+    fprintf(stderr, "### Snapshot ring %s: %lld frames read, %lld skipped, %lld invalid\n", path, read, skipped, invalid);
+  return invalid ? 1 : 0;
+#endif
+}
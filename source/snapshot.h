@@ -0,0 +1,97 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             snapshot.h
+ *
+ *  Shared-memory snapshots of the plots: with "plot.shm = name", the frames
+ *  of the point, 1D and 2D plots (as in stream.h) are also published into a
+ *  ring of "plot.shm.slots" slots (64 by default) in a memory-mapped file,
+ *  "/dev/shm/name" (or the name itself if it contains a '/'), from which any
+ *  number of viewers may read at their own pace: the solver never waits for
+ *  them, and does the same work whether anyone is watching or not. The file
+ *  is:
+ *
+ *    header:  SHM_RING_TAG, int32 version, int32 slots, int64 slot size, int64
+ *             intro size, int64 offset of slot 0, int64 head (the number of
+ *             frames published), int32 done (1 once the run is over), int32
+ *             the process id of the solver
+ *    intro:   the title and axis frames of the plots, following the header
+ *    slots:   int64 sequence, followed by a frame; frame #k (from 1) goes to
+ *             slot (k - 1) % slots, whose sequence is 2k - 1 while the frame
+ *             is written, and 2k once it is complete
+ *
+ *  A reader takes frame #k if the sequence of its slot is 2k both before and
+ *  after the frame is copied; a reader lagging by more than the ring skips the
+ *  frames overwritten. The file is removed at the end of the run (the readers
+ *  keep their mapping). "calc --snapshots name [plot]" reads a ring headless,
+ *  checks each frame, and prints it as "calc --monitor" does
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_SNAPSHOT_H_included
+#define CALC_SNAPSHOT_H_included
+
+#include <atomic>
+#include "stream.h"
+
+#define SHM_RING_TAG      "CalCshm"   // 8 bytes, with the terminating zero
+#define SHM_RING_VERSION  1
+
+//*************************************************************************************
+
+struct SnapshotHeader
+{
+  char      tag[8];
+  int       version, slots;
+  long long slotSize, introSize, data;
+  std::atomic<long long> head;
+  std::atomic<int>       done;
+  int       pid;
+};
+
+//*************************************************************************************
+
+class SnapshotRing : public PlotSink
+{
+  char   path[512];
+  int    slots;
+  long long slotSize;
+  size_t mapSize;
+  char   *map;            // 0 until start()
+  SnapshotHeader *header;
+  long long published;
+
+ public:
+
+  SnapshotRing(const char *name, int n);
+ ~SnapshotRing();
+
+  void   start();         // creates the ring, once all the plots are known; throws if it cannot
+  int    listening() { return map != 0; }
+  void   send(int plot, double time, const double *v, int n);
+};
+
+//*************************************************************************************
+
+int readSnapshots(const char *name, int plot = -1);   // checks and prints the frames of a ring; 1 if one is invalid
+
+#endif
@@ -0,0 +1,407 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             stream.cpp
+ *
+ *  Non-blocking binary streaming of the plots to a Unix-domain socket or a
+ *  FIFO, and the reader of a stream ("calc --monitor")
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "syntax.h"
+#include "stream.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0          // no such flag on BSD/macOS: the sockets get SO_NOSIGPIPE instead (see connect)
+  #endif
+#endif
+
+extern thread_local int VERBOSE;
+
+//**************************************************************************
+//  A socket left by an earlier run is replaced; one that accepts a
+//  connection belongs to a running simulation, and is not
+//**************************************************************************
+
+StreamSink::StreamSink(const char *fname)
+{
+  strncpy(path, fname, 511);
+  path[511] = 0;
+  listener = -1;
+  num      = 0;
+  sent     = dropped = 0;
+  pipeSaved = false;
+
+#ifdef _WIN32
+  throw makeMessage("Plot streaming (\"plot.stream\") is not available on this platform");
+#else
+  struct stat st;
+  if ( stat(path, &st) == 0 ) {
+    if ( S_ISFIFO(st.st_mode) ) {           // opened once a reader opens it (see connect)
+      pipeHandler = signal(SIGPIPE, SIG_IGN);   // a reader leaving is seen as the EPIPE error of write(),
+      pipeSaved   = true;                       // until the sink is closed
+      return;
+    }
+    if ( !S_ISSOCK(st.st_mode) ) throw makeMessage("\"%s\" exists, and is neither a FIFO nor a socket", path);
+  }
+
+  struct sockaddr_un addr;
+  if ( strlen(path) >= sizeof(addr.sun_path) ) throw makeMessage("The stream socket name \"%s\" is too long", path);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int  probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  bool inUse = probe >= 0 && ::connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+  if (probe >= 0) close(probe);
+  if (inUse) throw makeMessage("The stream socket \"%s\" is in use by another simulation", path);
+
+  unlink(path);
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ( listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) || listen(listener, STREAM_READERS) ||
+       fcntl(listener, F_SETFL, O_NONBLOCK) ) {
+    int error = errno;
+    if (listener >= 0) close(listener);
+    throw makeMessage("Cannot create the stream socket \"%s\": %s", path, strerror(error));
+  }
+#endif
+}
+
+//**************************************************************************
+
+StreamSink::~StreamSink()
+{
+#ifndef _WIN32
+  for (int r = num - 1; r >= 0; r--) if ( flush(r) ) leave(r);
+  while (num) leave(num - 1);
+  if (listener >= 0) { close(listener); unlink(path); }
+  if (pipeSaved) signal(SIGPIPE, pipeHandler);
+#endif
+  if (VERBOSE > 1 && (sent || dropped))
+    fprintf(stderr, "### Plot stream %s: %ld frames sent, %ld dropped\n", path, sent, dropped);
+}
+
+//**************************************************************************
+//                           P L O T   S I N K
+//**************************************************************************
+
+PlotSink::PlotSink()
+{
+  intro = frame = 0;
+  introUsed = introSize = frameSize = 0;
+  plots = maxValues = 0;
+}
+
+//**************************************************************************
+
+PlotSink::~PlotSink()
+{
+  delete [] intro;
+  delete [] frame;
+}
+
+//**************************************************************************
+
+size_t PlotSink::compose(int kind, int plot, double time, const void *data, int count, size_t bytes)
+{
+  size_t n = sizeof(StreamHeader) + bytes;
+  if (n > frameSize) {
+    delete [] frame;
+    frame = new char[frameSize = n];
+  }
+
+  StreamHeader h;
+  h.magic = STREAM_MAGIC;
+  h.kind  = (unsigned int) kind;
+  h.plot  = plot;
+  h.count = count;
+  h.time  = time;
+  memcpy(frame, &h, sizeof(h));
+  if (bytes) memcpy(frame + sizeof(h), data, bytes);
+  return n;
+}
+
+//**************************************************************************
+//  The title and axis frames are kept for the readers to come
+
+void PlotSink::introduce(size_t n)
+{
+  if (introUsed + n > introSize) {
+    introSize = 2 * (introUsed + n);
+    char *p = new char[introSize];
+    if (introUsed) memcpy(p, intro, introUsed);
+    delete [] intro;
+    intro = p;
+  }
+  memcpy(intro + introUsed, frame, n);
+  introUsed += n;
+}
+
+//**************************************************************************
+
+int PlotSink::title(const char *s, int values)
+{
+  int n = int( strlen(s) );
+  introduce( compose(STREAM_TITLE, plots, double(values), s, n, size_t(n)) );
+  if (values > maxValues) maxValues = values;
+  return plots++;
+}
+
+//**************************************************************************
+
+void PlotSink::axis(int plot, int a, const double *x, int n)
+{
+  introduce( compose(STREAM_AXIS, plot, double(a), x, n, n * sizeof(double)) );
+}
+
+//**************************************************************************
+//                          S T R E A M   S I N K
+//**************************************************************************
+//  The title and axis frames are never dropped
+
+void StreamSink::introduce(size_t n)
+{
+  PlotSink::introduce(n);
+  for (int r = num - 1; r >= 0; r--) { keep(r, frame, n); flush(r); }
+}
+
+//**************************************************************************
+
+int StreamSink::listening()
+{
+  connect();
+  return num;
+}
+
+//**************************************************************************
+
+void StreamSink::send(int plot, double time, const double *v, int n)
+{
+  if (!num) return;
+  size_t bytes = compose(STREAM_VALUES, plot, time, v, n, n * sizeof(double));
+  for (int r = num - 1; r >= 0; r--) deliver(r, frame, bytes);   // leave(r) moves the last reader to #r
+}
+
+//**************************************************************************
+//                  T H E   R E A D E R S   O F   A   S T R E A M
+//**************************************************************************
+
+#ifndef _WIN32
+
+void StreamSink::connect()
+{
+  int fd;
+
+  if (listener >= 0)
+    while ( num < STREAM_READERS && (fd = accept(listener, 0, 0)) >= 0 ) {
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+      int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+      join(fd);
+    }
+  else if ( !num && (fd = open(path, O_WRONLY | O_NONBLOCK)) >= 0 ) join(fd);   // ENXIO until a reader opens the FIFO
+}
+
+//**************************************************************************
+
+void StreamSink::join(int fd)
+{
+  Reader &R = readers[num++];
+  R.fd      = fd;
+  R.pending = 0;
+  R.used    = R.size = 0;
+  if (VERBOSE > 1) fprintf(stderr, "\n### Plot stream %s: a reader joined (%d connected)\n", path, num);
+  if (introUsed) { keep(num - 1, intro, introUsed); flush(num - 1); }
+}
+
+//**************************************************************************
+
+void StreamSink::leave(int r)
+{
+  close(readers[r].fd);
+  delete [] readers[r].pending;
+  readers[r] = readers[--num];
+  if (VERBOSE > 1) fprintf(stderr, "\n### Plot stream %s: a reader left (%d connected)\n", path, num);
+}
+
+//**************************************************************************
+//  A socket reader leaving must not raise SIGPIPE in the whole process
+
+long StreamSink::put(int fd, const char *p, size_t n)
+{
+  return long( (listener >= 0) ? ::send(fd, p, n, MSG_NOSIGNAL) : write(fd, p, n) );
+}
+
+//**************************************************************************
+//  A frame is written whole, or its rest is kept (and sent before the next
+//  frames); a frame which finds the reader busy is dropped
+
+void StreamSink::deliver(int r, const char *p, size_t n)
+{
+  if ( readers[r].used && !flush(r) ) { dropped++; return; }
+
+  ssize_t w = put(readers[r].fd, p, n);
+  if (w == ssize_t(n)) { sent++; return; }
+  if (w < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) dropped++;
+    else leave(r);
+    return;
+  }
+  keep(r, p + w, n - size_t(w));
+  sent++;
+}
+
+//**************************************************************************
+
+bool StreamSink::flush(int r)
+{
+  Reader &R = readers[r];
+  size_t done = 0;
+
+  while (done < R.used) {
+    ssize_t w = put(R.fd, R.pending + done, R.used - done);
+    if (w > 0) { done += size_t(w); continue; }
+    if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) break;
+    leave(r);
+    return false;
+  }
+  if (done) {
+    R.used -= done;
+    memmove(R.pending, R.pending + done, R.used);
+  }
+  return R.used == 0;
+}
+
+//**************************************************************************
+
+void StreamSink::keep(int r, const char *p, size_t n)
+{
+  Reader &R = readers[r];
+  if (R.used + n > R.size) {
+    R.size = 2 * (R.used + n);
+    char *q = new char[R.size];
+    if (R.used) memcpy(q, R.pending, R.used);
+    delete [] R.pending;
+    R.pending = q;
+  }
+  memcpy(R.pending + R.used, p, n);
+  R.used += n;
+}
+
+#else
+
+void StreamSink::connect() { }
+void StreamSink::join(int) { }
+void StreamSink::leave(int) { }
+void StreamSink::deliver(int, const char *, size_t) { }
+bool StreamSink::flush(int) { return true; }
+void StreamSink::keep(int, const char *, size_t) { }
+
+#endif
+
+//**************************************************************************
+//  The reference reader: the titles and the axes are printed as comments,
+//  the values as lines "plot time value value ..."
+//**************************************************************************
+
+void printFrame(const StreamHeader &h, const char *data)
+{
+  const double *v = (const double *) data;
+
+  if (h.kind == STREAM_TITLE) printf("# plot %d: %.*s (%d values)\n", h.plot, h.count, data, int(h.time));
+  else {
+    if (h.kind == STREAM_AXIS) printf("# plot %d, axis %d:", h.plot, int(h.time));
+    else                       printf("%d %.10g", h.plot, h.time);
+    for (int i = 0; i < h.count; i++) printf(" %.10g", v[i]);
+    printf("\n");
+  }
+  fflush(stdout);
+}
+
+//**************************************************************************
+
+int monitorStream(const char *fname, int plot)
+{
+#ifdef _WIN32
+  throw makeMessage("Plot streaming is not available on this platform");
+#else
+  struct stat st;
+  int    fd;
+
+  if ( stat(fname, &st) == 0 && S_ISFIFO(st.st_mode) ) fd = open(fname, O_RDONLY);
+  else {
+    struct sockaddr_un addr;
+    if ( strlen(fname) >= sizeof(addr.sun_path) ) throw makeMessage("The stream socket name \"%s\" is too long", fname);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, fname);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) ) { close(fd); fd = -1; }
+  }
+  if (fd < 0) throw makeMessage("Cannot connect to the plot stream \"%s\": %s", fname, strerror(errno));
+
+  FILE   *f = fdopen(fd, "rb");
+  char   *data = 0;
+  size_t size = 0;
+  long   frames = 0;
+  bool   corrupt = false;
+  StreamHeader h;
+
+  while ( fread(&h, sizeof(h), 1, f) == 1 ) {
+    if ( h.magic != STREAM_MAGIC || h.kind < STREAM_TITLE || h.kind > STREAM_VALUES || h.count < 0 ) { corrupt = true; break; }
+    size_t bytes = (h.kind == STREAM_TITLE) ? size_t(h.count) : h.count * sizeof(double);
+    if (bytes + 1 > size) {
+      delete [] data;
+      data = new char[size = bytes + 1];
+    }
+    if ( fread(data, 1, bytes, f) != bytes ) break;
+    frames++;
+    if (plot >= 0 && h.plot != plot) continue;
+
+    printFrame(h, data);
+  }
+
+  fclose(f);
+  delete [] data;
+  if (corrupt) throw makeMessage("Corrupt frame #%ld in the plot stream \"%s\"", frames + 1, fname);
+  if (VERBOSE) fprintf(stderr, "### %ld frames of the plot stream %s read\n", frames, fname);
+  return 0;
+#endif
+}
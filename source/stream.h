@@ -0,0 +1,139 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                              stream.h
+ *
+ *  Live binary streaming of the plots: with "plot.stream = path", each point
+ *  plot, and each 1D and 2D plot, is also sent as a sequence of frames to a
+ *  Unix-domain socket created at the path (any number of readers, up to
+ *  STREAM_READERS, may connect and leave during the run), or to a FIFO if
+ *  the path is one ("mkfifo path"). The frames are written without blocking:
+ *  when a reader does not keep up, the frames it cannot take are dropped, so
+ *  that the solver is never stalled. A frame is a 24-byte header followed by
+ *  its data:
+ *
+ *    header:  uint32 STREAM_MAGIC, uint32 kind, int32 plot, int32 count,
+ *             double time (the number of values of the plot for STREAM_TITLE,
+ *             the axis, 0 or 1, for STREAM_AXIS)
+ *    data:    STREAM_TITLE: the title of the plot (count characters);
+ *             STREAM_AXIS:  the coordinates along an axis of a 1D or 2D plot;
+ *             STREAM_VALUES: the values of the plot (count doubles; a 2D plot
+ *             is stored along its first axis first)
+ *
+ *  in the byte order of the machine. A new reader receives the titles and the
+ *  axes of all the plots first. The frames of a plot are sent "plot.steps.point"
+ *  ("plot.steps.1D", "plot.steps.2D") times per run; after a back-step of the
+ *  solver, the frames resume from an earlier time. "calc --monitor path [plot]"
+ *  prints the frames of a stream as text
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_STREAM_H_included
+#define CALC_STREAM_H_included
+
+#define STREAM_MAGIC    0x536c6143u   // "CalS" on a little-endian machine
+#define STREAM_TITLE    1
+#define STREAM_AXIS     2
+#define STREAM_VALUES   3
+
+#define STREAM_READERS  8
+
+//*************************************************************************************
+
+struct StreamHeader
+{
+  unsigned int magic, kind;
+  int    plot, count;
+  double time;
+};
+
+void printFrame(const StreamHeader &h, const char *data);   // as text (see monitorStream)
+
+//*************************************************************************************
+//  The destination of the stream plots (see StreamPlot in fplot.h): a stream, or a
+//  snapshot ring (see snapshot.h)
+
+class PlotSink
+{
+ protected:
+
+  char   *intro, *frame;  // the title and axis frames, sent to a new reader; the frame being sent
+  size_t introUsed, introSize, frameSize;
+  int    plots, maxValues;
+
+  size_t compose(int kind, int plot, double time, const void *data, int count, size_t bytes);   // into frame
+  virtual void introduce(size_t n);     // keeps the title or axis frame
+
+ public:
+
+  PlotSink();
+  virtual ~PlotSink();
+
+  int    title(const char *s, int values);   // returns the number of the new plot, of "values" values
+  void   axis(int plot, int axis, const double *x, int n);
+
+  virtual void start() { }               // once all the plots are set up
+  virtual int  listening() = 0;          // false if the frames would go nowhere
+  virtual void send(int plot, double time, const double *v, int n) = 0;
+};
+
+//*************************************************************************************
+
+class StreamSink : public PlotSink
+{
+  struct Reader {
+    int    fd;
+    char   *pending;      // the unsent rest of a frame (or of the titles), which holds back the next frames
+    size_t used, size;
+  };
+
+  char   path[512];
+  int    listener;        // the listening socket, or -1 for a FIFO
+  Reader readers[STREAM_READERS];
+  int    num;
+  long   sent, dropped;
+  bool   pipeSaved;       // SIGPIPE is ignored while a FIFO sink is open, and restored after
+  void   (*pipeHandler)(int);
+
+  void   introduce(size_t n);
+  void   connect();
+  void   join(int fd);
+  void   leave(int r);
+  long   put(int fd, const char *p, size_t n);   // write() for a FIFO, send() for a socket
+  void   deliver(int r, const char *p, size_t n);
+  bool   flush(int r);     // false if the reader still has pending bytes
+  void   keep(int r, const char *p, size_t n);
+
+ public:
+
+  StreamSink(const char *fname);   // throws if the socket cannot be created
+ ~StreamSink();
+
+  int    listening();              // the number of connected readers, after accepting the new ones
+  void   send(int plot, double time, const double *v, int n);
+};
+
+//*************************************************************************************
+
+int monitorStream(const char *fname, int plot = -1);   // prints the frames of a stream (of one plot if plot >= 0)
+
+#endif
@@ -0,0 +1,356 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                             sweep.cpp
+ *
+ *  Parallel execution of the steps of the "for" loops in worker processes
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "PlatformSpecific.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <thread>
+#include <mutex>
+#include "syntax.h"
+#include "sweep.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <signal.h>
+  #include <sys/types.h>
+  #include <sys/wait.h>
+#endif
+
+extern thread_local int VERBOSE;
+
+#define STAGED_NAME "%s.calc-step%ld"   // temporary name of a file written by a worker
+
+static long  stagingStep = -1;   // in a worker process: its step
+static FILE *stagingLog  = 0;    // the record of the staged files, followed by the outcome of the step
+static char **stagedFiles = 0;
+static int   stagedNum = 0, stagedMax = 0;
+static std::mutex staging;       // the plot output thread (see output.h) opens files as well
+
+//**************************************************************************
+//  Removes "-j N" (or "-jN") from the command line, so that the script
+//  arguments $1, $2, ... are not affected; returns N, or 0 if the option is
+//  absent. "-j 0" or "-j" without a number use all the available cores
+//**************************************************************************
+
+int sweepJobs(int &argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		int n = 0, k = 0;
+		if ( equal(argv[i], "-j") ) {
+			k = 1;
+			if ( i + 1 < argc && isInt(argv[i + 1]) ) { n = atoi(argv[i + 1]); k = 2; }
+		}
+		else if ( equal_(argv[i], "-j") && isInt(argv[i] + 2) ) { n = atoi(argv[i] + 2); k = 1; }
+		if (!k) continue;
+
+		if (n <= 0) n = int( std::thread::hardware_concurrency() );
+		if (n <= 0) n = 1;
+		for (int j = i; j + k <= argc; j++) argv[j] = argv[j + k];
+		argc -= k;
+		return n;
+	}
+	return 0;
+}
+
+//**************************************************************************
+//  Removes "--resume" from the command line; returns true if it is present
+//**************************************************************************
+
+bool sweepResume(int &argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+		if ( equal(argv[i], "--resume") ) {
+			for (int j = i; j + 1 <= argc; j++) argv[j] = argv[j + 1];
+			argc--;
+			return true;
+		}
+	return false;
+}
+
+//**************************************************************************
+
+static void copyOutput(FILE *from, FILE *to)
+{
+	char   buffer[4096];
+	size_t n;
+
+	rewind(from);
+	while ( (n = fread(buffer, 1, sizeof(buffer), from)) > 0 ) fwrite(buffer, 1, n, to);
+	fflush(to);
+}
+
+//**************************************************************************
+//  Staging of the files written by a worker: a file is opened under its
+//  staged name, and recorded in the log of the job as 'w' (created) or 'a'
+//  (appended to). Reading a file staged by the same step reads the staged
+//  version. On collection, a created file replaces the original, and the
+//  output appended to an existing file is added to its end
+//**************************************************************************
+
+static bool isStaged(const char *fname)
+{
+	for (int i = 0; i < stagedNum; i++) if ( equal(stagedFiles[i], fname) ) return true;
+	return false;
+}
+
+//**************************************************************************
+
+FILE *sweepOpen(const char *fname, const char *mode)
+{
+	if (stagingStep < 0) return fopen(fname, mode);
+	std::lock_guard<std::mutex> guard(staging);
+
+	char staged[MAX_STRING_LENGTH];
+	snprintf(staged, MAX_STRING_LENGTH - 1, STAGED_NAME, fname, stagingStep);
+
+	bool known = isStaged(fname);
+	if (mode[0] == 'r') return fopen(known ? staged : fname, mode);
+
+	if (!known || mode[0] == 'w') {
+		fprintf(stagingLog, "%c%s%c", mode[0], fname, 0);
+		fflush(stagingLog);
+	}
+	if (!known) {
+		if (stagedNum == stagedMax) {
+			stagedMax = stagedMax ? 2 * stagedMax : 16;
+			char **names = new char *[stagedMax];
+			for (int i = 0; i < stagedNum; i++) names[i] = stagedFiles[i];
+			if (stagedFiles) delete [] stagedFiles;
+			stagedFiles = names;
+		}
+		stagedFiles[stagedNum++] = StrCpy(fname);
+	}
+	return fopen(staged, mode);
+}
+
+//**************************************************************************
+
+int sweepRemove(const char *fname)
+{
+	char staged[MAX_STRING_LENGTH];
+
+	if (stagingStep < 0) return remove(fname);
+	std::lock_guard<std::mutex> guard(staging);
+	if (!isStaged(fname)) return remove(fname);
+	snprintf(staged, MAX_STRING_LENGTH - 1, STAGED_NAME, fname, stagingStep);
+	return remove(staged);
+}
+
+//**************************************************************************
+//  Reads the records of the staged files from the log of a job (up to the
+//  outcome record 'E'), and commits them (commit = true) or discards them
+//**************************************************************************
+
+static int readStaged(FILE *log, long step, bool commit)
+{
+	char fname[MAX_STRING_LENGTH], staged[MAX_STRING_LENGTH];
+	char **names = new char *[1];      // kind ('w' or 'a') followed by the file name
+	int  num = 0, max = 1, c, d, i, j;
+
+	rewind(log);
+	while ( (c = fgetc(log)) == 'w' || c == 'a' ) {
+		i = 0;
+		while ( (d = fgetc(log)) > 0 ) if (i < MAX_STRING_LENGTH - 1) fname[i++] = char(d);
+		fname[i] = 0;
+		for (j = 0; j < num; j++) if ( equal(names[j] + 1, fname) ) break;
+		if (j == num) {
+			if (num == max) {
+				char **n = new char *[max *= 2];
+				for (i = 0; i < num; i++) n[i] = names[i];
+				delete [] names;
+				names = n;
+			}
+			names[num] = new char[strlen(fname) + 2];
+			names[num][0] = 'a';
+			strcpy(names[num++] + 1, fname);
+		}
+		if (c == 'w') names[j][0] = 'w';   // the file was (re)created during the step
+	}
+	if (c != EOF) ungetc(c, log);
+
+	for (j = 0; j < num; j++) {
+		snprintf(staged, MAX_STRING_LENGTH - 1, STAGED_NAME, names[j] + 1, step);
+		if (commit && names[j][0] == 'w') {
+			if ( rename(staged, names[j] + 1) != 0 ) remove(names[j] + 1);   // created, then removed
+		}
+		else if (commit) {
+			FILE *from = fopen(staged, "rb"), *to = fopen(names[j] + 1, "ab");
+			if (from && to) copyOutput(from, to);
+			if (from) fclose(from);
+			if (to)   fclose(to);
+			remove(staged);
+		}
+		else remove(staged);
+		delete [] names[j];
+	}
+	delete [] names;
+	return c;
+}
+
+//**************************************************************************
+
+SweepJobs::SweepJobs(int jobs_, int resultSize_)
+{
+	jobs       = jobs_;
+	resultSize = resultSize_;
+	slots      = SWEEP_LOOKAHEAD * jobs;
+	running    = 0;
+	current    = 0;
+	job        = new SweepJob[slots];
+	for (int i = 0; i < slots; i++) { job[i].step = -1; job[i].out = job[i].err = job[i].res = 0; }
+}
+
+//**************************************************************************
+
+SweepJobs::~SweepJobs()
+{
+	for (int i = 0; i < slots; i++) {
+		if (job[i].step < 0) continue;
+#ifndef _WIN32
+		if (!job[i].finished) { kill(job[i].pid, SIGKILL); waitpid(job[i].pid, 0, 0); }
+#endif
+		readStaged(job[i].res, job[i].step, false);
+		fclose(job[i].out);
+		fclose(job[i].err);
+		fclose(job[i].res);
+	}
+	delete [] job;
+}
+
+//**************************************************************************
+
+bool SweepJobs::available()
+{
+#ifdef _WIN32
+	return false;
+#else
+	return true;
+#endif
+}
+
+//**************************************************************************
+
+bool SweepJobs::start(long step)
+{
+#ifdef _WIN32
+	throw makeMessage("Parallel sweeps are not available on this platform");
+#else
+	SweepJob &J = slot(step);
+
+	J.out = tmpfile();
+	J.err = tmpfile();
+	J.res = tmpfile();
+	if (!J.out || !J.err || !J.res) throw makeMessage("Cannot create the temporary files for sweep step %ld", step + 1);
+	J.step     = step;
+	J.finished = false;
+
+	fflush(stdout);
+	fflush(stderr);
+	int pid = fork();
+	if (pid < 0) throw makeMessage("Cannot start the worker process for sweep step %ld", step + 1);
+
+	if (pid == 0) {     // worker
+		dup2(fileno(J.out), 1);
+		dup2(fileno(J.err), 2);
+		current = &J;
+		stagingStep = step;
+		stagingLog  = J.res;
+		return true;
+	}
+
+	J.pid = pid;
+	running++;
+	return false;
+#endif
+}
+
+//**************************************************************************
+
+void SweepJobs::finish(int status, const double *result)
+{
+#ifndef _WIN32
+	fflush(stdout);
+	fflush(stderr);
+	fputc('E', current->res);
+	fwrite(&status,     sizeof(int),    1,          current->res);
+	fwrite(&VERBOSE,    sizeof(int),    1,          current->res);
+	fwrite(&resultSize, sizeof(int),    1,          current->res);
+	fwrite(result,      sizeof(double), resultSize, current->res);
+	fflush(current->res);
+	_exit(0);           // skip the destructors of the objects inherited from the main process
+#endif
+}
+
+//**************************************************************************
+
+void SweepJobs::wait()
+{
+#ifndef _WIN32
+	int pid = int( waitpid(-1, 0, 0) );
+	if (pid <= 0) return;
+
+	for (int i = 0; i < slots; i++)
+		if (job[i].step >= 0 && job[i].pid == pid && !job[i].finished) { job[i].finished = true; running--; }
+#endif
+}
+
+//**************************************************************************
+
+int SweepJobs::collect(long step, double *result)
+{
+	SweepJob &J = slot(step);
+	int status, verbose, n;
+
+	copyOutput(J.out, stdout);
+	copyOutput(J.err, stderr);
+
+	if ( readStaged(J.res, step, true) == 'E' &&
+		 fgetc(J.res) == 'E' &&
+		 fread(&status,  sizeof(int), 1, J.res) == 1 &&
+		 fread(&verbose, sizeof(int), 1, J.res) == 1 &&
+		 fread(&n,       sizeof(int), 1, J.res) == 1 && n == resultSize &&
+		 fread(result, sizeof(double), n, J.res) == size_t(n) )  VERBOSE = verbose;
+	else {
+		status = STEP_ERROR;
+		fprintf(stderr, "\n\n*** Error: the worker process of sweep step %ld terminated abnormally\n", step + 1);
+		fflush(stderr);
+	}
+
+	fclose(J.out);
+	fclose(J.err);
+	fclose(J.res);
+	J.step = -1;
+	return status;
+}
+
+//**************************************************************************
@@ -0,0 +1,91 @@
+/*****************************************************************************
+ *
+ *                     Calcium Calculator (CalC)
+ *              Copyright (C) 2001-2019 Victor Matveev
+ *
+ *                              sweep.h
+ *
+ *  Parallel execution of the steps of the "for" loops ("calc script.par -j N"):
+ *  each step runs in a worker process, with its standard output and error
+ *  captured in temporary files; the main process collects the steps in order,
+ *  copies their output and draws the tracked results, so that the output is
+ *  identical to that of a serial run ("-j 1"). The files written by a step
+ *  are staged until the step is collected, so that the steps overwriting
+ *  or appending to the same file leave it as in a serial run. The steps
+ *  must be independent: a step cannot read the files written by another
+ *
+ ****************************************************************************
+
+    This file is part of Calcium Calculator (CalC).
+
+    CalC is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CalC is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CalC.  If not, see <https://www.gnu.org/licenses/>
+
+ ************************************************************************/
+
+#ifndef CALC_SWEEP_H_included
+#define CALC_SWEEP_H_included
+
+#define STEP_DONE      0   // outcome of a step of the "for" loops
+#define STEP_CONTINUE  1   //  "continue" statement: the step is not drawn
+#define STEP_EXIT      2   //  "exit" statement: the loops are terminated
+#define STEP_ERROR     3   //  error: execution is terminated
+
+#define SWEEP_LOOKAHEAD 4  // steps may finish up to SWEEP_LOOKAHEAD * jobs steps ahead of the collected one
+
+//*************************************************************************************
+
+struct SweepJob
+{
+  long  step;               // -1 if the slot is free
+  int   pid;
+  bool  finished;
+  FILE  *out, *err, *res;   // captured standard output and error; the outcome and the tracked values
+};
+
+class SweepJobs
+{
+  int       jobs, slots, running, resultSize;
+  SweepJob  *job;
+  SweepJob  *current;       // in a worker process: its own job
+
+  SweepJob &slot(long step) { return job[step % slots]; }
+
+ public:
+
+  SweepJobs(int jobs, int resultSize);
+ ~SweepJobs();    // terminates the workers still running
+
+  static bool available();
+
+  bool canStart(long step, long collected) { return running < jobs && step < collected + slots; }
+  bool finished(long step)                 { return slot(step).step == step && slot(step).finished; }
+
+  bool start (long step);                  // returns true in the worker process
+  void finish(int status, const double *result);   // worker: report the outcome and exit
+  void wait  ();                           // wait for any worker to finish
+  int  collect(long step, double *result); // copy the output of the step, return its outcome
+};
+
+int  sweepJobs  (int &argc, char **argv);  // extracts the "-j N" option from the command line
+bool sweepResume(int &argc, char **argv);  // extracts the "--resume" option (see LoopObj::openJournal)
+
+// In a worker process, the files opened for writing are staged under a temporary name, and 
+// committed (renamed, or appended to the original file) when the step is collected
+
+FILE *sweepOpen  (const char *fname, const char *mode);
+int   sweepRemove(const char *fname);
+
+//*************************************************************************************
+
+#endif
@@ -37,11 +37,13 @@
 #include <stdarg.h>
 #include <float.h>  // for compatibility with Visual C++
 #include <math.h>
+#include <thread>
 #include "syntax.h"
+#include "sweep.h"
 
-extern int VERBOSE;
+extern thread_local int VERBOSE;
 
-int ExpressionObj::callLevel = 0;
+thread_local int ExpressionObj::callLevel = 0;
 
 //**************************************************************************
 
@@ -178,23 +180,168 @@ void TokenString::checkName( long pos, const char *what) {
 //@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 //***************************************************************************
 
-TokenString::TokenString(const char *fname, const char *extra1, const char *extra2, int argc, char **argv)
+//  Token text arena
+//***************************************************************************
+
+static char endToken[] = CARR_RET_TOKEN;
+
+TokenArena::TokenArena(TokenArena *base)
+{
+	block = 0;
+	blockNum = blockMax = 0;
+	used = 0;
+	refs = 1;
+	if ( (parent = base) ) parent->refs++;
+}
+
+//***************************************************************************
+
+TokenArena::~TokenArena()
+{
+	for (int i = 0; i < blockNum; i++) delete [] block[i].text;
+	if (block) delete [] block;
+	if (parent) parent->release();
+}
+
+//***************************************************************************
+
+char *TokenArena::store(const char *s)
+{
+	size_t n = strlen(s) + 1;
+
+	if ( !blockNum || used + n > block[blockNum - 1].size ) {   // start a new block
+		size_t size = blockNum ? 2 * block[blockNum - 1].size : TOKEN_BLOCK_MIN;
+		if (size > TOKEN_BLOCK_MAX) size = TOKEN_BLOCK_MAX;
+		if (size < n) size = n;
+		if (blockNum == blockMax) {
+			blockMax = blockMax ? 2 * blockMax : 8;
+			TokenBlock *b = new TokenBlock[blockMax];
+			for (int i = 0; i < blockNum; i++) b[i] = block[i];
+			if (block) delete [] block;
+			block = b;
+		}
+		block[blockNum].text = new char[size];
+		block[blockNum].size = size;
+		blockNum++;
+		used = 0;
+	}
+
+	char *p = block[blockNum - 1].text + used;
+	memcpy(p, s, n);
+	used += n;
+	return p;
+}
+
+//***************************************************************************
+
+bool TokenArena::contains(const char *p) const
+{
+	for (const TokenArena *a = this; a; a = a->parent)
+		for (int i = 0; i < a->blockNum; i++)
+			if ( p >= a->block[i].text && p < a->block[i].text + a->block[i].size ) return true;
+	return false;
+}
+
+//***************************************************************************
+//  TokenString
+//***************************************************************************
+
+void TokenString::initTokens(TokenArena *base)
 {
 	scriptNum = 0;
-	length = 0;
 	token_num = 0;
-	token_ptr[0] = storage;
+	headerTokens = 0;
+	stepDependent = false;
+	arena = new TokenArena(base);
+	token_ptr = 0;
+	lineNum = 0;
+	tokenMax = 0;
+	sealed = false;
+	reserve(TOKEN_NUM_MIN);
+	token_ptr[0] = endToken;
 	lineNum[0] = 1;
+	initIndex();
+}
+
+//***************************************************************************
+
+void TokenString::reserve(long n)
+{
+	if (n <= tokenMax) return;
+	if (sealed) throw makeMessage("Internal error: the token arrays would move after the token addresses have been taken");
+
+	long  max = tokenMax ? tokenMax : TOKEN_NUM_MIN;
+	while (max < n) max *= 2;
+
+	char **ptr  = new char *[max];
+	long  *line = new long[max];
+	if (tokenMax) {
+		for (long p = 0; p <= token_num; p++) { ptr[p] = token_ptr[p]; line[p] = lineNum[p]; }
+		delete [] token_ptr;
+		delete [] lineNum;
+	}
+	token_ptr = ptr;
+	lineNum   = line;
+	tokenMax  = max;
+}
+
+//***************************************************************************
+
+TokenString::TokenString(const char *fname, const char *extra1, const char *extra2, int argc, char **argv)
+{
+	initTokens(0);
 
 	parse(fname, extra1, extra2, argc, argv);
-	strcpy(token_ptr[token_num], CARR_RET_TOKEN);
 	if (VERBOSE > 6) print();
 }
 
+//***************************************************************************
+//  Token string of a script already parsed by the constructor above, with
+//  a different first line (the loop variable bindings of the next sweep step):
+//  only the first line is tokenized, the rest is copied from "base". Valid
+//  only if the parsing of the base does not depend on the first line, i.e.
+//  if base.stepDependent is false
+//***************************************************************************
+
+TokenString::TokenString(const TokenString &base, const char *extra1, const char *extra2, int argc, char **argv)
+{
+	initTokens(base.arena);
+
+	parse(0, extra1, extra2, argc, argv);
+
+	reserve(token_num + base.token_num - base.headerTokens + 1);
+	for (long p = base.headerTokens; p < base.token_num; p++) addShared(base, p);
+
+	for (int i = 0; i < base.scriptNum; i++) scriptFileNames[i] = ::StrCpy(base.scriptFileNames[i]);
+	scriptNum = base.scriptNum;
+
+	if (VERBOSE > 6) print();
+}
+
+//***************************************************************************
+
+TokenString::TokenString(const TokenString &base)
+{
+	initTokens(base.arena);
+
+	reserve(base.token_num + 1);
+	for (long p = 0; p < base.token_num; p++) addShared(base, p);
+	lineNum[token_num] = base.lineNum[token_num];
+
+	for (int i = 0; i < base.scriptNum; i++) scriptFileNames[i] = ::StrCpy(base.scriptFileNames[i]);
+	scriptNum = base.scriptNum;
+	headerTokens  = base.headerTokens;
+	stepDependent = base.stepDependent;
+}
+
 //***************************************************************************
 
 TokenString::~TokenString()  { 
 	for (int i=0; i < scriptNum; i++) delete [] scriptFileNames[i];
+	freeIndex();
+	delete [] token_ptr;
+	delete [] lineNum;
+	arena->release();
 }
 
 
@@ -210,11 +357,14 @@ void TokenString::parse(const char *fname, const char *extra1, const char *extra
 
 	int currentLine = 0, currentScript = scriptNum;
 
-	f = fopenAssure(fname, "r", "simulation script", "");
-	scriptFileNames[scriptNum] = ::StrCpy(fname);
-	if (++scriptNum > MAX_SCRIPT_FILES) 
-		globalError( makeMessage("Cannot include script file \"%s\": the maximal number of allowed scripts is %d", 
-		fname, MAX_SCRIPT_FILES) );
+	if (fname) {   // otherwise, only the first line "extra1 extra2" is parsed
+		f = fopenAssure(fname, "r", "simulation script", "");
+		scriptFileNames[scriptNum] = ::StrCpy(fname);
+		if (++scriptNum > MAX_SCRIPT_FILES) 
+			globalError( makeMessage("Cannot include script file \"%s\": the maximal number of allowed scripts is %d", 
+			fname, MAX_SCRIPT_FILES) );
+	}
+	else f = 0;
 
 	//if (VERBOSE) fprintf(stderr, "========> Parsing script file \"%s\":\n", fname);
 
@@ -222,6 +372,7 @@ void TokenString::parse(const char *fname, const char *extra1, const char *extra
 
 	while (1)   {
 		if ( token_num == 0 && extra1) { strcpy(lineString, extra1); strcat(lineString, extra2); }
+		else if ( !f ) break;
 		else { fgets(lineString,MAX_LINE_LENGTH,f); currentLine ++; if ( feof(f) ) break; }
 
 		char cminus = -106;  // European keyboard long minus code
@@ -256,6 +407,7 @@ void TokenString::parse(const char *fname, const char *extra1, const char *extra
 					exprFlag = true;  //***  An expression
 
 				if ( ::equal(token, IF_TOKEN) )  {                //*** IF conditional statement
+					stepDependent = true;
 					if ( ++ifLevel == IF_NEST_LEVELS ) throw ::StrCpy("Exceeded \"if\" nesting limit");
 					ifStart[ifLevel] = token_num + 1;
 					waitForEndif[ifLevel] = waitForElse[ifLevel] = reachedThen[ifLevel] = false;
@@ -309,6 +461,7 @@ void TokenString::parse(const char *fname, const char *extra1, const char *extra
 					else continue;
 				}
 				else if ( ::equal(token,"echo") ) {    //*** Echo a message
+					stepDependent = true;
 					if ( (ptr0 = ptr1) >= last ) break;
 					getToken(ptr0,ptr1,last, exprFlag);
 					strncpy(token,ptr0,ptr1-ptr0); token[ptr1-ptr0] = '\0';
@@ -350,12 +503,13 @@ void TokenString::parse(const char *fname, const char *extra1, const char *extra
 				exprFlag = false;   // by default each new line is not an expression
 				if  (token_num > tnum_old ) addToken(CARR_RET_TOKEN, currentLine, currentScript);
 			}
+			if ( tnum_old == 0 && extra1 ) headerTokens = token_num;
 		} catch(char *str) {
-			fclose(f);
+			if (f) fclose(f);
 			globalError(makeMessage("%s on Line %d of file \"%s\":\n %s\n", str, currentLine, fname, lineString) ); }
 	}  // while (1) - loop over lines of script
 
-	fclose(f);
+	if (f) fclose(f);
 	//this->print();
 }
 
@@ -416,24 +570,41 @@ void TokenString::getToken(char *&ptr0, char *&ptr1, char *last, bool expression
 
 void TokenString::addToken(const char *token, int line, int script)
 {
-	size_t tlength = strlen(token);
-	if (tlength == 0) return;
+	if (token[0] == 0) return;
 
-	if (length + tlength + 2 >= MAX_STORAGE_LENGTH)
-		throw("******** Scripts is too long: increase MAX_STORAGE_LENGTH in file \"source/syntax.h\"");
+	reserve(token_num + 2);
+	lineNum[token_num] = (line << SCRIPT_ID_BITS) + script;
+	token_ptr[token_num] = arena->store(token);
 
-	if (token_num + 2 >= MAX_TOKEN_NUM)
-		throw("******** Script is too long: increase MAX_TOKEN_NUM in file \"source/syntax.h\"");
+	if (VERBOSE > 6) fprintf(stderr, "%s ", token_ptr[token_num]);
 
-	lineNum[token_num] = (line << SCRIPT_ID_BITS) + script;
-	strncpy( token_ptr[token_num], token, tlength + 1 );
-	*(token_ptr[token_num] + tlength) = 0;
+	token_ptr[++token_num] = endToken;
+
+	if (indexValid) indexToken(token_num - 1);
+}
+
+//***************************************************************************
+//  Appends token #p of "base", sharing its text if it is held by the arena of
+//  "base" (a token pointer substituted by InterpolObj is not)
+//***************************************************************************
+
+void TokenString::addShared(const TokenString &base, long p)
+{
+	if ( !arena->contains(base.token_ptr[p]) ) {
+		addToken(base.token_ptr[p]);
+		lineNum[token_num - 1] = base.lineNum[p];
+		return;
+	}
+
+	reserve(token_num + 2);
+	lineNum[token_num] = base.lineNum[p];
+	token_ptr[token_num] = base.token_ptr[p];
 
 	if (VERBOSE > 6) fprintf(stderr, "%s ", token_ptr[token_num]);
 
-	token_ptr[token_num+1] = token_ptr[token_num] + tlength + 1;
-	token_num++;
-	length += tlength + 1;
+	token_ptr[++token_num] = endToken;
+
+	if (indexValid) indexToken(token_num - 1);
 }
 
 //***************************************************************************
@@ -452,44 +623,186 @@ void TokenString::deleteToken(long p0, long p1)
 		lineNum[p] = lineNum[p + dp]; 
 	}
 
+	indexValid = false;
 }
 //***************************************************************************
 
-TokenString::TokenString(const TokenString &tstring)
+//***************************************************************************
+//  Hashed index of the tokens: for each distinct token text, the list of its
+//  positions in token_ptr[], in increasing order. The tokens appended by
+//  addToken() are indexed as they come; after deleteToken() or reindex() the
+//  index is rebuilt at the next lookup
+//***************************************************************************
+
+static unsigned long hashString(const char *s)   // FNV-1a
 {
-	token_num = tstring.token_num;
-	length    = tstring.length;
+	unsigned long h = 2166136261UL;
+	while (*s) { h ^= (unsigned char)(*s++); h *= 16777619UL; }
+	return h;
 }
 
 //***************************************************************************
 
-int TokenString::token_count(const char *token, long *p)
+void TokenString::initIndex()
 {
-	int cnt = 0;
-	for (long i=0; i<token_num; i++)  
-		if ( equal(i, token) ) { if (p && !cnt) *p = i; cnt++; }
+	indexEntry = 0;
+	indexNum = indexMax = 0;
+	indexTable = 0;
+	indexSize = 0;
+	indexValid = false;
+}
 
-	return cnt;
+//***************************************************************************
+
+void TokenString::freeIndex()
+{
+	for (long k = 0; k < indexNum; k++) { delete [] indexEntry[k].text; delete [] indexEntry[k].pos; }
+	if (indexEntry) delete [] indexEntry;
+	if (indexTable) delete [] indexTable;
+	initIndex();
 }
 
 //***************************************************************************
 
-int TokenString::token2_count(const char *token1, const char *token2, long *p)
+void TokenString::buildIndex()
+{
+	freeIndex();
+	indexSize = TOKEN_INDEX_MIN;
+	indexTable = new long[indexSize];
+	for (long h = 0; h < indexSize; h++) indexTable[h] = -1;
+	indexValid = true;
+
+	for (long p = 0; p < token_num; p++) indexToken(p);
+	if (VERBOSE > 6) fprintf(stderr, "\n>> Token index: %ld distinct tokens out of %ld\n", indexNum, token_num);
+}
+
+//***************************************************************************
+//  Returns the number of the index entry for the token text "s", or -1 if
+//  there is none; if "create" is set, a missing entry is added
+//***************************************************************************
+
+long TokenString::findEntry(const char *s, bool create)
 {
+	long mask = indexSize - 1;
+	long h = long(hashString(s) & (unsigned long)mask);
+
+	while (indexTable[h] >= 0) {
+		if (::equal(indexEntry[indexTable[h]].text, s)) return indexTable[h];
+		h = (h + 1) & mask;
+	}
+	if (!create) return -1;
+
+	if ( 2 * (indexNum + 1) > indexSize ) {   // keep the table at most half full
+		delete [] indexTable;
+		indexSize *= 2;
+		indexTable = new long[indexSize];
+		for (h = 0; h < indexSize; h++) indexTable[h] = -1;
+		for (long k = 0; k < indexNum; k++) {
+			h = long(hashString(indexEntry[k].text) & (unsigned long)(indexSize - 1));
+			while (indexTable[h] >= 0) h = (h + 1) & (indexSize - 1);
+			indexTable[h] = k;
+		}
+		return findEntry(s, true);
+	}
+
+	if (indexNum == indexMax) {
+		indexMax = indexMax ? 2 * indexMax : TOKEN_INDEX_MIN;
+		TokenIndexEntry *entry = new TokenIndexEntry[indexMax];
+		for (long k = 0; k < indexNum; k++) entry[k] = indexEntry[k];
+		if (indexEntry) delete [] indexEntry;
+		indexEntry = entry;
+	}
+
+	TokenIndexEntry &e = indexEntry[indexNum];
+	e.text = ::StrCpy(s);
+	e.pos  = 0;
+	e.num  = e.max = 0;
+	indexTable[h] = indexNum;
+	return indexNum++;
+}
+
+//***************************************************************************
+
+void TokenString::indexToken(long p)
+{
+	long k = findEntry(token_ptr[p], true);   // may reallocate indexEntry
+	TokenIndexEntry &e = indexEntry[k];
+
+	if (e.num == e.max) {
+		e.max = e.max ? 2 * e.max : 4;
+		long *pos = new long[e.max];
+		for (long k = 0; k < e.num; k++) pos[k] = e.pos[k];
+		if (e.pos) delete [] e.pos;
+		e.pos = pos;
+	}
+	e.pos[e.num++] = p;
+}
+
+//***************************************************************************
+
+const TokenString::TokenIndexEntry *TokenString::lookup(const char *s)
+{
+	if (!s) return 0;
+	if (!indexValid) buildIndex();
+	long k = findEntry(s);
+	return (k < 0) ? 0 : &indexEntry[k];
+}
+
+//***************************************************************************
+//  Counts the occurrences of the token sequence "t1 t2" (or "t1 t2 t3" if t3 
+//  is non-zero), scanning the positions of its least frequent token. Sets *p
+//  to the position of the last token of the first occurrence, or of the n-th
+//  one if n > 0, in which case the search stops there
+//***************************************************************************
+
+int TokenString::sequence(const char *t1, const char *t2, const char *t3, int n, long *p)
+{
+	const char *t[3] = { t1, t2, t3 };
+	int len = t3 ? 3 : 2, offset = 0;
+	const TokenIndexEntry *e = 0;
+
+	for (int j = 0; j < len; j++) {
+		const TokenIndexEntry *ej = lookup(t[j]);
+		if (!ej) return 0;
+		if (!e || ej->num < e->num) { e = ej; offset = j; }
+	}
+
 	int cnt = 0;
-	for (long i = 1; i < token_num; i++)
-		if ( equal(i-1, token1) && equal(i, token2) ) { if (p && !cnt) *p = i; cnt++; }
+	for (long k = 0; k < e->num; k++) {
+		long i0 = e->pos[k] - offset;   // position of the first token of the sequence
+		if (i0 < 0 || i0 + len > token_num) continue;
+		int j;
+		for (j = 0; j < len; j++)
+			if (j != offset && !equal(i0 + j, t[j])) break;
+		if (j < len) continue;
+		if (p && (!cnt || cnt + 1 == n)) *p = i0 + len - 1;
+		if (++cnt == n) break;
+	}
 	return cnt;
 }
 
 //***************************************************************************
 
+int TokenString::token_count(const char *token, long *p)
+{
+	const TokenIndexEntry *e = lookup(token);
+	if (!e) return 0;
+	if (p) *p = e->pos[0];
+	return int(e->num);
+}
+
+//***************************************************************************
+
+int TokenString::token2_count(const char *token1, const char *token2, long *p)
+{
+	return sequence(token1, token2, 0, 0, p);
+}
+
+//***************************************************************************
+
 int TokenString::token3_count(const char *token1, const char *token2, const char *token3, long *p)
 {
-	int cnt = 0;
-	for (long i = 2; i < token_num; i++)
-		if ( equal(i-2, token1) && equal(i-1, token2) && equal(i, token3) ) { if (p&& !cnt) *p = i; cnt++; }
-	return cnt;
+	return sequence(token1, token2, token3, 0, p);
 }
 
 //***************************************************************************
@@ -631,12 +944,8 @@ int TokenString::trail_pars(long ind0, va_list p)
 
 long TokenString::token_index(const char *token, int n) 
 { 
-	int cnt = 0;
-	for (long i = 0; i < token_num; i++)
-	{
-		if ( equal(i, token) ) cnt ++;
-		if (cnt == n) return i;
-	}
+	const TokenIndexEntry *e = lookup(token);
+	if (e && n >= 1 && n <= e->num) return e->pos[n - 1];
 	throw makeMessage("Less than %d instances of \"%s\"",n,token);
 }
 
@@ -644,12 +953,8 @@ long TokenString::token_index(const char *token, int n)
 
 long TokenString::token2_index(const char *token1, const char *token2, int n)
 { 
-	int cnt = 0;
-	for (long i = 1; i < token_num; i++)
-	{
-		if ( equal(i-1, token1) && equal(i, token2) ) cnt ++;
-		if (cnt == n) return i;
-	}
+	long p;
+	if ( n >= 1 && sequence(token1, token2, 0, n, &p) == n ) return p;
 	throw makeMessage("Less than %d instances of \"%s %s\"",n,token1,token2);
 }
 
@@ -658,12 +963,8 @@ long TokenString::token2_index(const char *token1, const char *token2, int n)
 
 long TokenString::token3_index(const char *token1, const char *token2, const char *token3, int n)
 { 
-	int cnt = 0;
-	for (long i = 2; i < token_num; i++)
-	{
-		if ( equal(i-2, token1) && equal(i-1, token2) && equal(i, token3) ) cnt ++;
-		if (cnt == n) return i;
-	}
+	long p;
+	if ( n >= 1 && sequence(token1, token2, token3, n, &p) == n ) return p;
 	throw makeMessage("Less than %d instances of \"%s %s %s\"",n,token1,token2,token3);
 }
 
@@ -715,14 +1016,17 @@ bool TokenString::isNumberParam(const char *s, long &pFirst, double *result)
 	if ( strchr( s, '{') ) {   // get an array element
 		char arg[1024];
 		strcpy(arg, s);
-		char *name = strtok( arg, "{");
+		char *name = arg, *sind = strchr(arg, '{');   // (not strtok, which is not reentrant)
+		*(sind++) = 0;
+		while (*sind == '}') sind++;
+		if (*sind) { char *end = strchr(sind, '}'); if (end) *end = 0; }
+		else sind = 0;
 		if ( !isParam(name, &pFirst) ) {
 			if ( token_count(name, &pFirst) ) pFirst++; // access definition keywords (like "grid n m")
 			else return false;
 		}
 
-		char  *sind;
-		if ( !( sind = strtok( NULL, "}") ) ) errorMessage( token_index(s), 0, "No closing curly bracket" );  
+		if ( !sind ) errorMessage( token_index(s), 0, "No closing curly bracket" );  
 
 		double dind;
 		if ( !isConst(sind, &dind) )  errorMessage( token_index(s), 0, "Bad array index");  
@@ -995,7 +1299,7 @@ inline double function(char op, double x)
 	switch (op)
 	{
 	case BRACKET:   return x;
-	case T_RAND:    return rand();
+	case T_RAND:    return randomNumber();
 	case T_NOT:     return (x > 0) ? 0 : 1;
 	case T_INT:     return double(int(x));
 	case T_COSH:    return cosh(x);
@@ -1079,6 +1383,212 @@ double ExpressionObj::Evaluate(int *firstTerm)
 	else return valStack[0] ;
 }
 
+//**************************************************************************
+//   Batch evaluation: the same operator-precedence algorithm as Evaluate(),
+//   applied to blocks of EXPRESSION_BLOCK points at a time, so that each
+//   operator and function is applied in a tight loop over the block.
+//   Variables whose addresses are listed in bindPtr[] take their values
+//   point-by-point from the arrays bindArr[]; all other variables are constant
+//   over the batch. Results are identical to repeated calls to Evaluate().
+//**************************************************************************
+
+inline void binaryBlock(char op, double *a, const double *b, int n)
+{
+	int i;
+
+	switch(op) {
+	case T_PLUS:  for (i = 0; i < n; i++) a[i] += b[i]; break;
+	case T_MINUS: for (i = 0; i < n; i++) a[i] -= b[i]; break;
+	case T_OR:    for (i = 0; i < n; i++) a[i] = ( (a[i] > 0) || (b[i] > 0) ? 1: 0 ); break;
+	case T_AND:   for (i = 0; i < n; i++) a[i] = ( (a[i] > 0) && (b[i] > 0) ? 1: 0 ); break;
+	case T_GT:    for (i = 0; i < n; i++) a[i] = (a[i] > b[i]  ? 1 : 0); break;
+	case T_GE:    for (i = 0; i < n; i++) a[i] = (a[i] >= b[i] ? 1 : 0); break;
+	case T_LT:    for (i = 0; i < n; i++) a[i] = (a[i] < b[i]  ? 1 : 0); break;
+	case T_LE:    for (i = 0; i < n; i++) a[i] = (a[i] <= b[i] ? 1 : 0); break;
+	case T_EQ:    for (i = 0; i < n; i++) a[i] = (a[i] == b[i] ? 1 : 0); break;
+	case T_NEQ:   for (i = 0; i < n; i++) a[i] = (a[i] != b[i] ? 1 : 0); break;
+	case T_MULT:  for (i = 0; i < n; i++) a[i] = ( a[i] == 0.0 || b[i] == 0.0 ) ? 0.0 : a[i] * b[i]; break;
+	case T_DIV:   for (i = 0; i < n; i++) a[i] = ( b[i] != 0 ) ? a[i] / b[i] : a[i]; break;  // same as binary()
+	case T_MOD:   for (i = 0; i < n; i++) a[i] = double ( int(a[i]) % int(b[i]) ); break;
+	case T_POWER: for (i = 0; i < n; i++) a[i] = pow(a[i], b[i]); break;
+	default:      throw makeMessage("Unknown binary operator %d", op);
+	}
+}
+
+//**************************************************************************
+
+inline void functionBlock(char op, double *x, int n)
+{
+	int i;
+
+	switch (op)
+	{
+	case BRACKET:   break;
+	case T_RAND:    for (i = 0; i < n; i++) x[i] = randomNumber(); break;
+	case T_NOT:     for (i = 0; i < n; i++) x[i] = (x[i] > 0) ? 0 : 1; break;
+	case T_INT:     for (i = 0; i < n; i++) x[i] = double(int(x[i])); break;
+	case T_COSH:    for (i = 0; i < n; i++) x[i] = cosh(x[i]); break;
+	case T_SINH:    for (i = 0; i < n; i++) x[i] = sinh(x[i]); break;
+	case T_COS:     for (i = 0; i < n; i++) x[i] = cos(x[i]); break;
+	case T_SIN:     for (i = 0; i < n; i++) x[i] = sin(x[i]); break;
+	case T_TANH:    for (i = 0; i < n; i++) x[i] = tanh(x[i]); break;
+	case T_TAN:     for (i = 0; i < n; i++) x[i] = tan(x[i]); break;
+	case T_ATAN:    for (i = 0; i < n; i++) x[i] = atan(x[i]); break;
+	case T_EXP:     for (i = 0; i < n; i++) x[i] = exp(x[i]); break;
+	case T_LOG:     for (i = 0; i < n; i++) x[i] = log(x[i]); break;
+	case T_LOG10:   for (i = 0; i < n; i++) x[i] = log10(x[i]); break;
+	case T_SQR:     for (i = 0; i < n; i++) x[i] = x[i] * x[i]; break;
+	case T_ABS:     for (i = 0; i < n; i++) x[i] = fabs( x[i] ); break;
+	case T_SQRT:    for (i = 0; i < n; i++) x[i] = sqrt(x[i]); break;
+	case T_THETA:   for (i = 0; i < n; i++) x[i] = (x[i] == 0.0) ? 0.5 : ( (x[i] > 0) ? 1 : 0 ); break;
+	case T_SIGMA:   for (i = 0; i < n; i++) x[i] = 0.5 * (1 + tanh(x[i]) ); break;
+	default:        throw makeMessage("Unknown function %d", op);
+	}
+}
+
+//**************************************************************************
+
+void ExpressionObj::EvaluateBlock(int n, double *result, int nbind, double **bindPtr, const double **bindArr, int *firstTerm)
+{
+	int    i, k, pr, unaryOp = 0;
+	int    opStack[priorityLevels];
+	double valStack[priorityLevels + 1][EXPRESSION_BLOCK];
+	int    j, j0, stackHead = 0;
+
+	if (n > EXPRESSION_BLOCK) throw makeMessage("Expression block size %d exceeds %d", n, EXPRESSION_BLOCK);
+	if (term_num <= 0 ) { for (i = 0; i < n; i++) result[i] = 0.0; return; }
+	if (firstTerm) j0 = *firstTerm;
+	else j0 = 0;
+
+	for (j = j0; j < term_num; j ++) { // *** LOOP OVER TERMS BEGINS HERE ***
+
+		struct TermStruct &term = term_array[j];
+		int    Type = term.type;
+		double *val = valStack[ stackHead ];
+
+		if ( isUnary(Type) ) {   // Catch unary sign operators here
+			unaryOp = Type; continue;
+		}
+
+		if ( isBinary(Type) ) {  
+			pr = priority[ Type ];
+			while ( stackHead )
+				if ( priority[ opStack[stackHead - 1] ] <= pr ) {
+					stackHead --; 
+					binaryBlock( opStack[stackHead], valStack[stackHead], valStack[stackHead+1], n );
+				} else break;
+			opStack[ stackHead++ ] = Type;
+			continue;
+		}
+
+		if ( Type == BR_CLOSE )  break;   // catch a closing bracket
+
+		if ( isFunction(Type) ) {                          // 1. a function call (or nested expression)
+			j ++;
+			EvaluateBlock(n, val, nbind, bindPtr, bindArr, &j);
+			functionBlock( Type, val, n );
+		}
+		else if ( Type == NUMBER_TYPE )                    // 2. a float      
+			for (i = 0; i < n; i++) val[i] = term.val;
+		else if ( Type == POINTER_TYPE ) {                 // 3. a variable, either bound to an array or constant
+			for (k = 0; k < nbind; k++) if ( term.ptr == bindPtr[k] ) break;
+			if (k < nbind) for (i = 0; i < n; i++) val[i] = bindArr[k][i];
+			else { double v = *term.ptr; for (i = 0; i < n; i++) val[i] = v; }
+		}
+		else throw makeMessage("Cannot evaluate expression { %s }: unknown term %d\n", formula, Type); 
+
+		if (unaryOp) {
+			if  (unaryOp == T_UNARY_NOT)  for (i = 0; i < n; i++) val[i] = (val[i] > 0) ? 0 : 1;
+			unaryOp = 0;
+		}
+	}
+
+	if (firstTerm) *firstTerm = j;
+	while ( stackHead-- ) 
+		binaryBlock( opStack[stackHead], valStack[stackHead], valStack[stackHead+1], n ); // *** Collect the result
+
+	for (i = 0; i < n; i++) {
+		if (!_finite(valStack[0][i]))
+			throw makeMessage("\n Not-a-number returned by the following expression: \n\n { %s }\n", formula);
+		result[i] = valStack[0][i];
+	}
+}
+
+//**************************************************************************
+
+bool ExpressionObj::isVolatile()
+{
+	for (int j = 0; j < term_num; j++) 
+		if (term_array[j].type == T_RAND) return true;
+	return false;
+}
+
+//**************************************************************************
+
+static void evaluateRange(ExpressionObj *E, long i0, long i1, double *result, int nbind, double **bindPtr, 
+                          const double **bindArr, char **errorMsg)
+{
+	const double *arr[MAX_BATCH_BIND];
+
+	try {
+		for (long i = i0; i < i1; i += EXPRESSION_BLOCK) {
+			int n = int( (i1 - i < EXPRESSION_BLOCK) ? i1 - i : EXPRESSION_BLOCK );
+			for (int k = 0; k < nbind; k++) arr[k] = bindArr[k] + i;
+			E->EvaluateBlock(n, result + i, nbind, bindPtr, arr);
+		}
+	}
+	catch (char *str) { *errorMsg = str; }
+}
+
+//**************************************************************************
+
+void ExpressionObj::EvaluateBatch(long n, double *result, int nbind, double **bindPtr, const double **bindArr, int threads)
+{
+	long i;
+	int  k;
+
+	if (nbind > MAX_BATCH_BIND) throw makeMessage("Cannot bind more than %d variables in a batch evaluation", MAX_BATCH_BIND);
+
+	if ( isVolatile() ) {     // rand() calls must be made in the same order as point-by-point evaluation
+		double *saved = new double[nbind+1];
+		for (k = 0; k < nbind; k++) saved[k] = *bindPtr[k];
+		for (i = 0; i < n; i++) {
+			for (k = 0; k < nbind; k++) *bindPtr[k] = bindArr[k][i];
+			result[i] = Evaluate();
+		}
+		for (k = 0; k < nbind; k++) *bindPtr[k] = saved[k];
+		delete [] saved;
+		return;
+	}
+
+	if (threads > 1 && n < long(threads) * EXPRESSION_BLOCK) threads = int( (n + EXPRESSION_BLOCK - 1) / EXPRESSION_BLOCK );
+	if (threads <= 1) {
+		char *errorMsg = 0;
+		evaluateRange(this, 0, n, result, nbind, bindPtr, bindArr, &errorMsg);
+		if (errorMsg) throw errorMsg;
+		return;
+	}
+
+	std::thread *pool     = new std::thread[threads];
+	char        **errorMsg = new char *[threads];
+	long         chunk    = ( (n / threads + EXPRESSION_BLOCK - 1) / EXPRESSION_BLOCK ) * EXPRESSION_BLOCK;
+
+	for (k = 0; k < threads; k++) {
+		long i0 = k * chunk, i1 = (k == threads - 1) ? n : (k + 1) * chunk;
+		if (i1 > n) i1 = n;
+		if (i0 > i1) i0 = i1;
+		errorMsg[k] = 0;
+		pool[k] = std::thread(evaluateRange, this, i0, i1, result, nbind, bindPtr, bindArr, errorMsg + k);
+	}
+	for (k = 0; k < threads; k++) pool[k].join();
+
+	char *error = 0;
+	for (k = 0; k < threads; k++) 
+		if (errorMsg[k]) { if (!error) error = errorMsg[k]; else delete [] errorMsg[k]; }
+	delete [] pool; delete [] errorMsg;
+	if (error) throw error;
+}
+
 //**************************************************************************
 
 int ExpressionObj::eliminate(int kill0, int kill1) {
@@ -1458,13 +1968,59 @@ FILE *fopenAssure(const char *fname, const char *mode, const char *action, const
 	FILE *f;
 	     if ( equal(fname, "stderr") )   return (FILE *)stderr;
 	else if ( equal(fname, "stdout") )   return (FILE *)stdout;
-	else if ( (f = fopen(fname, mode)) )   return f;
+	else if ( (f = sweepOpen(fname, mode)) )   return f;
 	else { perror(">>> fopen Error = ");
 	throw makeMessage("Could not open file \"%s\" for %s %s", fname, action, id); }
 }
 
 //*******************************************************************************************************
 
+void writeState(FILE *f, const void *data, size_t size) {
+	if ( size && fwrite(data, 1, size, f) != size )
+		throw makeMessage("Could not write the simulation state snapshot (%ld bytes)", long(size));
+}
+
+void readState(FILE *f, void *data, size_t size) {
+	if ( size && fread(data, 1, size, f) != size )
+		throw makeMessage("Could not read the simulation state snapshot: the file is truncated or corrupted");
+}
+
+//*******************************************************************************************************
+
+struct RandomGenerator {
+	unsigned int r[31];          // the additive feedback register: r[front] += r[rear]
+	int front, rear;
+	RandomGenerator() { seed(1); }
+	void seed(unsigned int s);
+	long next() {
+		unsigned int x = (r[front] += r[rear]);
+		if (++front == 31) front = 0;
+		if (++rear  == 31) rear  = 0;
+		return long(x >> 1);
+	}
+};
+
+void RandomGenerator::seed(unsigned int s) {
+	int word = s ? int(s) : 1;
+	r[0] = (unsigned int)word;
+	for (int i = 1; i < 31; i++) {      // r[i] = 16807 r[i-1] mod (2^31 - 1), without overflow
+		int hi = word / 127773, lo = word % 127773;
+		word = 16807 * lo - 2836 * hi;
+		if (word < 0) word += 2147483647;
+		r[i] = (unsigned int)word;
+	}
+	front = 3;
+	rear  = 0;
+	for (int i = 0; i < 310; i++) next();
+}
+
+static thread_local RandomGenerator randomGenerator;
+
+void seedRandom(unsigned int seed) { randomGenerator.seed(seed); }
+long randomNumber()                { return randomGenerator.next(); }
+
+//*******************************************************************************************************
+
 char *makeMessage(const char *fmt, ...) {
 
 	int n, size = 300;
@@ -33,15 +33,15 @@
 #ifndef CALC_SYNTAX_H_included
 #define CALC_SYNTAX_H_included
 
-extern int  VERBOSE;
-extern int  GEOMETRY;
-extern int  GEOMETRY1;
-extern int  GEOMETRY2;
-extern int  GEOMETRY3;
-extern int  DIMENSIONALITY;
-extern char LABEL_DIM1[2];
-extern char LABEL_DIM2[6];
-extern char LABEL_DIM3[4];
+extern thread_local int  VERBOSE;
+extern thread_local int  GEOMETRY;
+extern thread_local int  GEOMETRY1;
+extern thread_local int  GEOMETRY2;
+extern thread_local int  GEOMETRY3;
+extern thread_local int  DIMENSIONALITY;
+extern thread_local char LABEL_DIM1[2];
+extern thread_local char LABEL_DIM2[6];
+extern thread_local char LABEL_DIM3[4];
 
 //********************************************************************************************
 
@@ -72,17 +72,22 @@ extern char LABEL_DIM3[4];
 
 //********************************************************************************************
 
-#define MAX_STORAGE_LENGTH  1600000
-#define MAX_TOKEN_NUM       500000
+#define TOKEN_BLOCK_MIN   4096      // first block of the token text arena; each next block is twice larger,
+#define TOKEN_BLOCK_MAX   1048576   //   up to this size
+#define TOKEN_NUM_MIN     1024      // initial size of the token arrays, doubled as needed
 
 #define MAX_TOKEN_LENGTH  512
 #define MAX_LINE_LENGTH   2048
 #define MAX_STRING_LENGTH 2048
 
 #define MAX_FORMULA_LENGTH 2048    // Maximal length of the formula (ExpressionObj) string
+#define EXPRESSION_BLOCK   256     // Number of points processed at once by ExpressionObj::EvaluateBlock
+#define MAX_BATCH_BIND     8       // Maximal number of array-bound variables in a batch evaluation
 
 #define IF_NEST_LEVELS 10
 
+#define TOKEN_INDEX_MIN 256   // initial size of the hash table of the token index
+
 #define MAX_SCRIPT_FILES 31 // 2 ^ SCRIPT_ID_BITS - 1
 #define SCRIPT_ID_BITS   5    
 
@@ -250,8 +255,20 @@ inline char *StrCpy(const char *s, int n)
 
 FILE *fopenAssure(const char *fname, const char *mode, const char *id="", const char *str = "");
 
+void writeState(FILE *f, const void *data, size_t size);  // binary state snapshots (see prefix.h):
+void readState (FILE *f, void *data, size_t size);        //  error message thrown on failure
+
 char *makeMessage(const char *fmt, ...);
 
+//  The random numbers of the scripts (rand() in the expressions, the Markov gates) come from a
+//  generator kept per thread, so that concurrent scripts neither share nor perturb its sequence
+//  (that of the additive feedback rand() of glibc, on every platform)
+
+#define RANDOM_MAX 2147483647
+
+void seedRandom(unsigned int seed);
+long randomNumber();             // 0 ... RANDOM_MAX
+
 //**************************************************************************************************
                              
 void globalError(char *message); //, const char *constMessage = "");
@@ -275,6 +292,34 @@ class VarList          // An abstract class which contains a collection of varab
 //***********************************************************************************************
 
 
+//  Arena holding the text of the tokens. It is only appended to, in blocks that are never
+//  moved, and the stored text is never modified, so that the arena of a TokenString can be
+//  shared (by reference count) with its copies: the arena of a copy has the arena of the
+//  original as its parent, and the tokens of the copy point to the text held by either
+
+struct TokenBlock { char *text; size_t size; };
+
+class TokenArena
+{
+  TokenBlock *block;
+  int    blockNum, blockMax;
+  size_t used;              // bytes used in the last block
+  int    refs;
+  TokenArena *parent;
+
+  ~TokenArena();
+
+public:
+
+  TokenArena(TokenArena *parent = 0);
+  void  release() { if (--refs == 0) delete this; }
+
+  char *store(const char *s);
+  bool  contains(const char *p) const;   // "p" points into this arena or into its parents
+};
+
+//***********************************************************************************************
+
 class TokenString
 {
   friend class LoopObj;
@@ -282,27 +327,53 @@ class TokenString
 
 private:
 
- size_t length;
- char storage[MAX_STORAGE_LENGTH];
- char *token_ptr[MAX_TOKEN_NUM];
- long lineNum[MAX_TOKEN_NUM];
+ TokenArena *arena;
+ char **token_ptr;     // token_ptr[token_num] is the end-of-script token; the arrays grow until the
+ long  *lineNum;       //  first address of an element is kept (by InterpolObj), then they are sealed
+ long  tokenMax;       // allocated size of token_ptr[] and lineNum[]
+ bool  sealed;         // reserve() may no longer grow (move) the arrays
  char *scriptFileNames[MAX_SCRIPT_FILES];
  int  scriptNum;
 
+ void  initTokens(TokenArena *base);
+ void  reserve(long n);
+ void  addShared(const TokenString &base, long p);
+
+ // hashed index of the token text: the positions of each distinct token, in increasing order
+
+ struct TokenIndexEntry { char *text; long *pos; long num, max; };
+
+ TokenIndexEntry *indexEntry;
+ long  indexNum, indexMax;
+ long  *indexTable, indexSize;
+ bool  indexValid;
+
+ void  initIndex();
+ void  freeIndex();
+ void  buildIndex();
+ void  indexToken(long p);
+ long  findEntry(const char *s, bool create = false);
+ const TokenIndexEntry *lookup(const char *s);
+ int   sequence(const char *t1, const char *t2, const char *t3, int n, long *p);
+
 public:
 
  long  token_num;
+ long  headerTokens;   // tokens of the first line (the extra parameters and the loop variable bindings)
+ bool  stepDependent;  // the parsing depends on the parameter values ("if" conditions) or prints messages
 
  // constructor and parsing routines:
 
  TokenString(const char *fname, const char *, const char *, int argc, char **argv);
- TokenString(const TokenString &);
+ TokenString(const TokenString &);   // shares the token text
+ TokenString(const TokenString &base, const char *, const char *, int argc, char **argv);  // rebind first line
  ~TokenString(); 
 
  void parse(const char *fname, const char *extra1, const char *extra2, int argc, char **argv);
  void getToken(char *&ptr0, char *&ptr1, char *, bool);
  void addToken(const char *token, int line=0, int script=0);
  void deleteToken(long, long);
+ void reindex() { indexValid = false; }   // to be called after modifying token_ptr[] directly
 
  // routines returning the number of occurences of an argument token in the TokenString:
 
@@ -410,7 +481,7 @@ int get_max_term_num(TokenString &, long);
 class ExpressionObj
 {
 
-  static int callLevel;
+  static thread_local int callLevel;
 
  public:
 
@@ -441,6 +512,12 @@ class ExpressionObj
   void   pushOp(int op, int *opStack, int *indStack0, int *indStack1, int &stackHead, int &j);
   void   Optimize(int * = 0);
   double Evaluate(int * = 0);
+  bool   isVolatile();  // true if the expression calls rand(), and has to be evaluated point-by-point
+
+  // Evaluate over n points; variable *bindPtr[k] takes the value bindArr[k][i] at point i:
+
+  void   EvaluateBlock(int n, double *, int nbind, double **bindPtr, const double **bindArr, int * = 0);
+  void   EvaluateBatch(long n, double *, int nbind, double **bindPtr, const double **bindArr, int threads = 1);
   void   print(FILE *f = (FILE *)stderr);
 
   void  buildFormulaString(class VarList *, double *, const char *, double *, const char *, 
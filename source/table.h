@@ -34,7 +34,7 @@
 
 #define TABLE_TOKEN  "table"
 
-extern int VERBOSE;
+extern thread_local int VERBOSE;
 
 //**************************************************************************
 
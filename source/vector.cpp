@@ -46,12 +46,49 @@ extern char *makeMessage(const char *fmt, ...);
 //                       I M P L E M E N T A T I O N
 //*******************************************************************************
 
+struct VectorPool {
+  double *buffer[VECTOR_POOL_SIZE];
+  long   size[VECTOR_POOL_SIZE];
+  int    num;
+
+  VectorPool()  { num = 0; }
+  ~VectorPool() { while (num) delete [] buffer[--num]; }
+};
+
+static thread_local VectorPool pool;
+
+double *VectorObj::allocate(long n)
+{
+  if (n >= VECTOR_POOL_MIN)
+    for (int i = pool.num - 1; i >= 0; i--)
+      if (pool.size[i] == n) {
+        double *e = pool.buffer[i];
+        pool.buffer[i] = pool.buffer[--pool.num];   // the last buffer takes its place
+        pool.size[i]   = pool.size[pool.num];
+        return e;
+      }
+  return new double[n];
+}
+
+void VectorObj::release(double *e, long n)
+{
+  if (n < VECTOR_POOL_MIN) { delete [] e; return; }
+  if (pool.num == VECTOR_POOL_SIZE) {               // the first buffer makes room
+    delete [] pool.buffer[0];
+    pool.buffer[0] = pool.buffer[--pool.num];
+    pool.size[0]   = pool.size[pool.num];
+  }
+  pool.buffer[pool.num] = e;
+  pool.size[pool.num++] = n;
+}
+
+//===============================================================================
 
 VectorObj::VectorObj(const VectorObj &v)
 {
   size = v.size;
 
-  elem = new double[size];
+  elem = allocate(size);
   for (long i = 0; i < size; ++i)  elem[i] = v.elem[i];
 }
 
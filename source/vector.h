@@ -29,20 +29,30 @@
 #ifndef CALC_VectorObj_H_included
 #define CALC_VectorObj_H_included
 
-extern int VERBOSE;
+extern thread_local int VERBOSE;
+
+// The elements of the large vectors are recycled: the temporaries of the vector expressions of
+// each time step are released and allocated again with the same sizes, and are taken from a small
+// per-thread pool instead of being returned to the system and faulted in again every time
+
+#define VECTOR_POOL_MIN    4096     // the smallest vector (in elements) kept in the pool
+#define VECTOR_POOL_SIZE   16       // the number of buffers kept, per thread
 
 class VectorObj {
 
  protected:
 
+  static double *allocate(long n);
+  static void    release(double *e, long n);
+
  public:
 
   double *elem;
   long   size;
 
-  VectorObj(long n = 0)  { elem = new double[size = n]; };
+  VectorObj(long n = 0)  { elem = allocate(size = n); };
 
-  ~VectorObj() { delete [] elem; }
+  ~VectorObj() { release(elem, size); }
 
   VectorObj(const VectorObj &v);
 